@@ -0,0 +1,387 @@
+/*****************************************************************
+ NAME:
+   microbench - time the per-cell and per-byte routines of cxlsx_to_csv
+
+ USAGE:
+   microbench input.xlsx [sheet_id]
+
+ COMPILATION:
+   cc -O3 -o microbench microbench.c -lpthread
+
+ The library and the converter are included whole, so that their static
+ routines are timed exactly as they are inlined in cxlsx_to_csv.
+
+** Copyright (C) 2015 Victor Paesa
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+*****************************************************************/
+
+#include "../cxlsx.c"
+#define main cxlsx_to_csv_main
+#include "../cxlsx_to_csv.c"
+#undef main
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+/*
+** Each benchmark runs its kernel over a whole input (ops operations on
+** bytes bytes) as many times as fit in BENCH_MIN_TIME seconds, BENCH_REPS
+** times, and reports the median repetition.
+*/
+#define BENCH_REPS     7
+#define BENCH_MIN_TIME 0.1
+
+typedef struct Bench Bench;
+struct Bench {
+  const char *name;
+  void      (*run)(Bench *b);
+  void       *data;
+  size_t      ops, bytes;
+  mz_uint64   sink;     /* Results of the kernels */
+};
+
+/* The results end up here, so that the kernels are not optimized away */
+volatile mz_uint64 bench_sink;
+
+static double now(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static mz_uint64 cycles(void)
+{
+#ifdef HAVE_TSC
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+
+  return (x > y) - (x < y);
+}
+
+static void bench_run(Bench *b)
+{
+  double t[BENCH_REPS], c[BENCH_REPS], start;
+  mz_uint64 cstart;
+  long iters, i;
+  int r;
+
+  // Warm up, and find how many passes fill BENCH_MIN_TIME
+  b->run(b);
+  for (iters = 1; ; iters *= 2) {
+    start = now();
+    for (i = 0; i < iters; i++)
+      b->run(b);
+    if (now() - start >= BENCH_MIN_TIME)
+      break;
+  }
+  for (r = 0; r < BENCH_REPS; r++) {
+    start = now();
+    cstart = cycles();
+    for (i = 0; i < iters; i++)
+      b->run(b);
+    c[r] = (double) (cycles() - cstart) / iters;
+    t[r] = (now() - start) / iters;
+  }
+  bench_sink += b->sink;
+  qsort(t, BENCH_REPS, sizeof(double), cmp_double);
+  qsort(c, BENCH_REPS, sizeof(double), cmp_double);
+  printf("%-28s %14.2f %10.1f", b->name, t[BENCH_REPS/2] * 1e9 / b->ops, b->bytes / t[BENCH_REPS/2] / 1e6);
+#ifdef HAVE_TSC
+  printf(" %12.3f", b->bytes / c[BENCH_REPS/2]);
+#else
+  printf(" %12s", "-");
+#endif
+  printf("\n");
+}
+
+/*
+** output_csv: cells of a sheet, a share of them needing quotes
+*/
+typedef struct CsvInput CsvInput;
+struct CsvInput {
+  char    *text;
+  int     *len;
+  int      num;
+  XLSXOut  out;
+};
+
+static void run_output_csv(Bench *b)
+{
+  CsvInput *in = b->data;
+  const char *z = in->text;
+  int i;
+
+  for (i = 0; i < in->num; i++) {
+    output_csv(&in->out, ',', z, in->len[i], (i % 10) != 9);
+    if ((i % 10) == 9)
+      out_putc(&in->out, '\n');
+    z += in->len[i];
+  }
+}
+
+static CsvInput *csv_input(int num, int quote_pct)
+{
+  static const char *plain[] = { "12345.678", "alpha beta", "2015-06-01", "0", "Madrid", "-0.000123" };
+  static const char *quoted[] = { "a, b", "say \"hi\"", "two\nlines", "Ma\xc3\xb1" "ana" };
+  CsvInput *in = calloc(1, sizeof(CsvInput));
+  char *p;
+  int i;
+
+  in->text = p = malloc(num * 16);
+  in->len = malloc(num * sizeof(int));
+  in->num = num;
+  srand(1);
+  for (i = 0; i < num; i++) {
+    if ((rand() % 100) < quote_pct)
+      strcpy(p, quoted[rand() % 4]);
+    else
+      strcpy(p, plain[rand() % 6]);
+    in->len[i] = strlen(p);
+    p += in->len[i];
+  }
+  out_open(&in->out, fopen("/dev/null", "wb"), 0, 0, 0);
+  return in;
+}
+
+/*
+** excelcolrow and rangecolrow: references spread over A1..XFD1048576
+*/
+typedef struct RefInput RefInput;
+struct RefInput {
+  char  *text;   /* NUL separated references */
+  int    num;
+};
+
+static void run_excelcolrow(Bench *b)
+{
+  RefInput *in = b->data;
+  const char *z = in->text;
+  int i, col, row;
+  mz_uint64 sum = 0;
+
+  for (i = 0; i < in->num; i++) {
+    excelcolrow(z, &col, &row);
+    sum += col + row;
+    z += strlen(z) + 1;
+  }
+  b->sink += sum;
+}
+
+static void run_rangecolrow(Bench *b)
+{
+  RefInput *in = b->data;
+  const char *z = in->text;
+  int i, col, row;
+  mz_uint64 sum = 0;
+
+  for (i = 0; i < in->num; i++) {
+    rangecolrow(z, &col, &row);
+    sum += col + row;
+    z += strlen(z) + 1;
+  }
+  b->sink += sum;
+}
+
+static RefInput *ref_input(int num, int range, size_t *bytes)
+{
+  RefInput *in = calloc(1, sizeof(RefInput));
+  char *p, col[4];
+  int i, c, n;
+
+  in->text = p = malloc(num * 32);
+  in->num = num;
+  srand(2);
+  for (i = 0; i < num; i++) {
+    c = 1 + rand() % 16384;
+    n = 0;
+    for (; c > 0; c = (c - 1) / 26)
+      col[n++] = 'A' + (c - 1) % 26;
+    if (range)
+      p += sprintf(p, "A1:");
+    while (n)
+      *p++ = col[--n];
+    p += sprintf(p, "%d", 1 + rand() % 1048576) + 1;
+  }
+  *bytes = p - in->text;
+  return in;
+}
+
+/*
+** mz_crc32 and tinfl_decompress: the XML of a sheet
+*/
+typedef struct ZipInput ZipInput;
+struct ZipInput {
+  void   *comp, *xml;
+  size_t  comp_len, xml_len;
+  tinfl_decompressor inflator;
+};
+
+static void run_crc32(Bench *b)
+{
+  ZipInput *in = b->data;
+
+  b->sink += mz_crc32(MZ_CRC32_INIT, in->xml, in->xml_len);
+}
+
+static void run_tinfl(Bench *b)
+{
+  ZipInput *in = b->data;
+  size_t in_len = in->comp_len, out_len = in->xml_len;
+
+  tinfl_init(&in->inflator);
+  if (tinfl_decompress(&in->inflator, in->comp, &in_len, in->xml, in->xml, &out_len,
+                       TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF) != TINFL_STATUS_DONE) {
+    fputs("tinfl_decompress failed\n", stderr);
+    exit(-1);
+  }
+  b->sink += out_len;
+}
+
+static ZipInput *zip_input(const char *filename, int sheet_id)
+{
+  ZipInput *in = calloc(1, sizeof(ZipInput));
+  mz_zip_archive zip;
+  mz_zip_archive_file_stat st;
+  char name[64];
+  int i;
+
+  memset(&zip, 0, sizeof(zip));
+  if (!mz_zip_reader_init_file(&zip, filename, 0)) {
+    fprintf(stderr, "Couldn't open input file '%s' .\n", filename);
+    exit(-1);
+  }
+  snprintf(name, sizeof(name), "xl/worksheets/sheet%d.xml", sheet_id);
+  i = mz_zip_reader_locate_file(&zip, name, NULL, 0);
+  if ((i < 0) || !mz_zip_reader_file_stat(&zip, i, &st) || (st.m_method != MZ_DEFLATED)) {
+    fprintf(stderr, "No deflated part '%s' in '%s' .\n", name, filename);
+    exit(-1);
+  }
+  in->comp_len = (size_t) st.m_comp_size;
+  in->xml_len = (size_t) st.m_uncomp_size;
+  in->comp = malloc(in->comp_len);
+  in->xml = malloc(in->xml_len);
+  if (!in->comp || !in->xml ||
+      !mz_zip_reader_extract_to_mem(&zip, i, in->comp, in->comp_len, MZ_ZIP_FLAG_COMPRESSED_DATA)) {
+    fprintf(stderr, "Couldn't read part '%s' .\n", name);
+    exit(-1);
+  }
+  mz_zip_reader_end(&zip);
+  return in;
+}
+
+int main(int argc, char *argv[])
+{
+  static const int quote_pct[] = { 0, 10, 50, 100 };
+  static char names[4][32], variants[2 * (XLSX_CPU_AVX512 + 1)][40];
+  Bench b;
+  CsvInput *csv;
+  RefInput *ref;
+  ZipInput *zip;
+  size_t bytes;
+  int i, n, level;
+
+  if (argc < 2) {
+    fputs("Usage: microbench input.xlsx [sheet_id]\n", stderr);
+    return 1;
+  }
+  printf("%-28s %14s %10s %12s\n", "benchmark", "ns/op", "MB/s", "bytes/cycle");
+
+  for (i = 0; i < 4; i++) {
+    memset(&b, 0, sizeof(b));
+    csv = csv_input(100000, quote_pct[i]);
+    snprintf(names[i], sizeof(names[i]), "output_csv %d%% quoted", quote_pct[i]);
+    b.name = names[i];
+    b.run = run_output_csv;
+    b.data = csv;
+    b.ops = csv->num;
+    for (n = 0; n < csv->num; n++)
+      b.bytes += csv->len[n];
+    bench_run(&b);
+  }
+
+  // The scan for characters to quote, in each variant the CPU runs
+  csv = csv_input(100000, 0);
+  for (level = XLSX_CPU_SCALAR; level <= xlsx_cpu_level(); level++) {
+    csv_scan_select(level);
+    memset(&b, 0, sizeof(b));
+    snprintf(variants[level], sizeof(variants[level]), "output_csv 0%% quoted %s", xlsx_cpu_name(level));
+    b.name = variants[level];
+    b.run = run_output_csv;
+    b.data = csv;
+    b.ops = csv->num;
+    for (n = 0; n < csv->num; n++)
+      b.bytes += csv->len[n];
+    bench_run(&b);
+  }
+  csv_scan_select(xlsx_cpu_level());
+
+  memset(&b, 0, sizeof(b));
+  ref = ref_input(100000, 0, &bytes);
+  b.name = "excelcolrow A1..XFD1048576";
+  b.run = run_excelcolrow;
+  b.data = ref;
+  b.ops = ref->num;
+  b.bytes = bytes;
+  bench_run(&b);
+
+  memset(&b, 0, sizeof(b));
+  ref = ref_input(100000, 1, &bytes);
+  b.name = "rangecolrow A1:..";
+  b.run = run_rangecolrow;
+  b.data = ref;
+  b.ops = ref->num;
+  b.bytes = bytes;
+  bench_run(&b);
+
+  zip = zip_input(argv[1], (argc > 2) ? atoi(argv[2]) : 1);
+  memset(&b, 0, sizeof(b));
+  b.name = "tinfl_decompress sheet XML";
+  b.run = run_tinfl;
+  b.data = zip;
+  b.ops = 1;
+  b.bytes = zip->xml_len;
+  bench_run(&b);
+
+  for (level = XLSX_CPU_SCALAR; level <= xlsx_cpu_level(); level++) {
+    crc32_select(level);
+    memset(&b, 0, sizeof(b));
+    snprintf(variants[XLSX_CPU_AVX512 + 1 + level], sizeof(variants[0]), "mz_crc32 sheet XML %s", xlsx_cpu_name(level));
+    b.name = variants[XLSX_CPU_AVX512 + 1 + level];
+    b.run = run_crc32;
+    b.data = zip;
+    b.ops = 1;
+    b.bytes = zip->xml_len;
+    bench_run(&b);
+  }
+  crc32_select(xlsx_cpu_level());
+
+#ifdef HAVE_TSC
+  printf("\nbytes/cycle counts reference (TSC) cycles.\n");
+#endif
+  return 0;
+}
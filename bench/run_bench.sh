@@ -0,0 +1,45 @@
+#!/bin/bash
+# Run every cxlsx_to_csv backend built in the parent directory over the
+# synthetic corpus, and print the median wall time of N runs (default 5).
+
+runs=${1:-5}
+backends="expat mxml parsifal noxml"
+
+mkdir -p corpus
+gen() {
+  name=$1; shift
+  [ -f corpus/$name.xlsx ] || ./xlsx_gen -o corpus/$name.xlsx "$@" || exit 1
+}
+gen numbers    -rows 200000 -cols 10 -strings 0
+gen strings    -rows 200000 -cols 10 -strings 100 -unique 20
+gen mixed      -rows 200000 -cols 10 -strings 50 -unique 5
+gen richtext   -rows 100000 -cols 10 -strings 100 -unique 50 -rich 50
+gen sparse     -rows 200000 -cols 50 -sparse 90
+gen inline     -rows 200000 -cols 10 -strings 100 -inline 100
+
+median() {
+  sort -n | awk '{ t[NR] = $1 } END { printf "%.3f", (NR % 2) ? t[(NR+1)/2] : (t[NR/2] + t[NR/2+1]) / 2 }'
+}
+
+printf "%-10s %10s" "workbook" "MB"
+for b in $backends
+do
+  [ -x ../cxlsx_to_csv_$b ] && printf " %10s" $b
+done
+printf "\n"
+for i in corpus/*.xlsx
+do
+  printf "%-10s %10.1f" $(basename $i .xlsx) $(stat -c %s $i | awk '{ print $1 / 1048576 }')
+  for b in $backends
+  do
+    [ -x ../cxlsx_to_csv_$b ] || continue
+    for n in $(seq $runs)
+    do
+      start=$(date +%s.%N)
+      ../cxlsx_to_csv_$b -if $i -of /dev/null || exit 1
+      end=$(date +%s.%N)
+      awk "BEGIN { print $end - $start }"
+    done | median | xargs printf " %9ss"
+  done
+  printf "\n"
+done
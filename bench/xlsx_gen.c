@@ -0,0 +1,318 @@
+/*****************************************************************
+ NAME:
+   xlsx_gen - generate synthetic Excel 2007 workbooks for benchmarking
+
+ USAGE:
+   xlsx_gen -o output.xlsx [-rows N] [-cols N] [-strings pct] [-unique pct]
+            [-rich pct] [-sparse pct] [-inline pct] [-level N] [-seed N]
+
+ COMPILATION:
+   cc -O2 -o xlsx_gen xlsx_gen.c
+
+** Copyright (C) 2015 Victor Paesa
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+*****************************************************************/
+
+#include <stdlib.h>
+#include "../miniz.c"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+
+static char *usage_str = "\n\
+NAME:\n\
+xlsx_gen - generate synthetic Excel 2007 workbooks for benchmarking\n\
+\n\
+SYNOPSIS:\n\
+xlsx_gen -o output.xlsx [-rows N] [-cols N] [-strings pct] [-unique pct]\n\
+         [-rich pct] [-sparse pct] [-inline pct] [-level N] [-seed N]\n\
+    -rows N           number of rows (default is 10000)\n\
+    -cols N           number of columns (default is 10)\n\
+    -strings pct      percentage of cells holding text, the others hold numbers\n\
+                      (default is 50)\n\
+    -unique pct       distinct shared strings, as a percentage of the shared\n\
+                      string cells (default is 10)\n\
+    -rich pct         percentage of shared strings written as rich text runs\n\
+                      (default is 0)\n\
+    -sparse pct       percentage of empty cells (default is 0)\n\
+    -inline pct       percentage of text cells written as inline strings\n\
+                      (t=\"inlineStr\") instead of shared strings (default is 0)\n\
+    -level N          deflate level 0..10 of the parts (default is 6)\n\
+    -seed N           seed of the random generator (default is 1)\n\
+";
+
+/*
+** Growable text buffer, for the XML of a part
+*/
+typedef struct GenBuf GenBuf;
+struct GenBuf {
+  char  *ptr;
+  size_t len, cap;
+};
+
+static void buf_need(GenBuf *b, size_t len)
+{
+  if (b->len + len <= b->cap)
+    return;
+  while (b->len + len > b->cap)
+    b->cap = b->cap ? 2 * b->cap : 1024*1024;
+  b->ptr = realloc(b->ptr, b->cap);
+  if (!b->ptr) {
+    fputs("Couldn't allocate memory for XML\n", stderr);
+    exit(-1);
+  }
+}
+
+static void buf_puts(GenBuf *b, const char *s)
+{
+  size_t len = strlen(s);
+
+  buf_need(b, len);
+  memcpy(b->ptr + b->len, s, len);
+  b->len += len;
+}
+
+static void buf_printf(GenBuf *b, const char *fmt, ...)
+{
+  va_list ap;
+  int n;
+
+  buf_need(b, 256);
+  va_start(ap, fmt);
+  n = vsnprintf(b->ptr + b->len, b->cap - b->len, fmt, ap);
+  va_end(ap);
+  b->len += n;
+}
+
+/*
+** Deterministic random numbers (xorshift64*), so that a seed always
+** gives the same workbook.
+*/
+static mz_uint64 rnd_state;
+
+static mz_uint32 rnd(void)
+{
+  rnd_state ^= rnd_state >> 12;
+  rnd_state ^= rnd_state << 25;
+  rnd_state ^= rnd_state >> 27;
+  return (mz_uint32) ((rnd_state * 2685821657736338717ULL) >> 32);
+}
+
+static int rnd_pct(int pct)
+{
+  return (int) (rnd() % 100) < pct;
+}
+
+/*
+** Column name of col (1 for A)
+*/
+static void col_name(int col, char *name)
+{
+  char tmp[8];
+  int n = 0;
+
+  for (; col > 0; col = (col - 1) / 26)
+    tmp[n++] = 'A' + (col - 1) % 26;
+  while (n)
+    *name++ = tmp[--n];
+  *name = 0;
+}
+
+/*
+** Text of string number i, with some characters that need escaping in XML or quoting in CSV
+*/
+static void string_text(GenBuf *b, int i)
+{
+  static const char *words[] = { "alpha", "beta", "gamma", "delta", "epsilon", "zeta", "eta", "theta",
+                                 "iota", "kappa", "lambda", "mu", "&amp;", "&quot;quoted&quot;", "a,b", "&lt;x&gt;" };
+  int n;
+
+  buf_printf(b, "%s %d", words[i & 15], i);
+  for (n = (i >> 4) & 3; n; n--)
+    buf_printf(b, " %s", words[(i >> (2 * n)) & 15]);
+}
+
+static void add_part(mz_zip_archive *zip, const char *name, GenBuf *b, int level)
+{
+  if (!mz_zip_writer_add_mem(zip, name, b->ptr, b->len, level)) {
+    fprintf(stderr, "Couldn't add part '%s'\n", name);
+    exit(-1);
+  }
+  b->len = 0;
+}
+
+int main(int argc, char *argv[])
+{
+  static const char content_types[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
+    "<Types xmlns=\"http://schemas.openxmlformats.org/package/2006/content-types\">"
+    "<Default Extension=\"rels\" ContentType=\"application/vnd.openxmlformats-package.relationships+xml\"/>"
+    "<Default Extension=\"xml\" ContentType=\"application/xml\"/>"
+    "<Override PartName=\"/xl/workbook.xml\" ContentType=\"application/vnd.openxmlformats-officedocument.spreadsheetml.sheet.main+xml\"/>"
+    "<Override PartName=\"/xl/worksheets/sheet1.xml\" ContentType=\"application/vnd.openxmlformats-officedocument.spreadsheetml.worksheet+xml\"/>"
+    "<Override PartName=\"/xl/sharedStrings.xml\" ContentType=\"application/vnd.openxmlformats-officedocument.spreadsheetml.sharedStrings+xml\"/>"
+    "<Override PartName=\"/xl/styles.xml\" ContentType=\"application/vnd.openxmlformats-officedocument.spreadsheetml.styles+xml\"/>"
+    "</Types>";
+  static const char rels[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
+    "<Relationships xmlns=\"http://schemas.openxmlformats.org/package/2006/relationships\">"
+    "<Relationship Id=\"rId1\" Type=\"http://schemas.openxmlformats.org/officeDocument/2006/relationships/officeDocument\" Target=\"xl/workbook.xml\"/>"
+    "</Relationships>";
+  static const char workbook[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
+    "<workbook xmlns=\"http://schemas.openxmlformats.org/spreadsheetml/2006/main\" "
+    "xmlns:r=\"http://schemas.openxmlformats.org/officeDocument/2006/relationships\">"
+    "<sheets><sheet name=\"Sheet1\" sheetId=\"1\" r:id=\"rId1\"/></sheets></workbook>";
+  static const char workbook_rels[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
+    "<Relationships xmlns=\"http://schemas.openxmlformats.org/package/2006/relationships\">"
+    "<Relationship Id=\"rId1\" Type=\"http://schemas.openxmlformats.org/officeDocument/2006/relationships/worksheet\" Target=\"worksheets/sheet1.xml\"/>"
+    "<Relationship Id=\"rId2\" Type=\"http://schemas.openxmlformats.org/officeDocument/2006/relationships/sharedStrings\" Target=\"sharedStrings.xml\"/>"
+    "<Relationship Id=\"rId3\" Type=\"http://schemas.openxmlformats.org/officeDocument/2006/relationships/styles\" Target=\"styles.xml\"/>"
+    "</Relationships>";
+  static const char styles[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
+    "<styleSheet xmlns=\"http://schemas.openxmlformats.org/spreadsheetml/2006/main\">"
+    "<fonts count=\"1\"><font><sz val=\"11\"/><name val=\"Calibri\"/></font></fonts>"
+    "<fills count=\"1\"><fill><patternFill patternType=\"none\"/></fill></fills>"
+    "<borders count=\"1\"><border/></borders>"
+    "<cellStyleXfs count=\"1\"><xf numFmtId=\"0\" fontId=\"0\" fillId=\"0\" borderId=\"0\"/></cellStyleXfs>"
+    "<cellXfs count=\"1\"><xf numFmtId=\"0\" fontId=\"0\" fillId=\"0\" borderId=\"0\" xfId=\"0\"/></cellXfs>"
+    "</styleSheet>";
+  mz_zip_archive zip;
+  GenBuf b;
+  char col[8];
+  const char *output = NULL;
+  int rows = 10000, cols = 10, strings = 50, unique = 10, rich = 0, sparse = 0, inl = 0, level = 6, seed = 1;
+  int i, r, c, num_shared, num_refs, k;
+  int *opt;
+
+  for (i = 1; i < argc; i++) {
+    opt = NULL;
+    if (!strcmp("-o", argv[i]) && ((i+1) < argc)) {
+      output = argv[++i];
+      continue;
+    }
+    if (!strcmp("-rows", argv[i]))
+      opt = &rows;
+    else if (!strcmp("-cols", argv[i]))
+      opt = &cols;
+    else if (!strcmp("-strings", argv[i]))
+      opt = &strings;
+    else if (!strcmp("-unique", argv[i]))
+      opt = &unique;
+    else if (!strcmp("-rich", argv[i]))
+      opt = &rich;
+    else if (!strcmp("-sparse", argv[i]))
+      opt = &sparse;
+    else if (!strcmp("-inline", argv[i]))
+      opt = &inl;
+    else if (!strcmp("-level", argv[i]))
+      opt = &level;
+    else if (!strcmp("-seed", argv[i]))
+      opt = &seed;
+    if (!opt || ((i+1) >= argc)) {
+      fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+      fputs(usage_str, stderr);
+      return 1;
+    }
+    *opt = atoi(argv[++i]);
+  }
+  if (!output || (rows < 1) || (cols < 1) || (cols > 16384)) {
+    fputs(usage_str, stderr);
+    return 1;
+  }
+  rnd_state = 0x9E3779B97F4A7C15ULL * (mz_uint64) (seed ? seed : 1);
+
+  memset(&zip, 0, sizeof(zip));
+  if (!mz_zip_writer_init_file(&zip, output, 0)) {
+    fprintf(stderr, "Couldn't open output file '%s' .\n", output);
+    return 1;
+  }
+  memset(&b, 0, sizeof(b));
+  buf_puts(&b, content_types);
+  add_part(&zip, "[Content_Types].xml", &b, level);
+  buf_puts(&b, rels);
+  add_part(&zip, "_rels/.rels", &b, level);
+  buf_puts(&b, workbook);
+  add_part(&zip, "xl/workbook.xml", &b, level);
+  buf_puts(&b, workbook_rels);
+  add_part(&zip, "xl/_rels/workbook.xml.rels", &b, level);
+  buf_puts(&b, styles);
+  add_part(&zip, "xl/styles.xml", &b, level);
+
+  // Shared strings: the expected number of shared string cells, times the uniqueness ratio
+  num_refs = (int) ((double) rows * cols * (100 - sparse) / 100 * strings / 100 * (100 - inl) / 100);
+  num_shared = (int) ((double) num_refs * unique / 100);
+  if (num_shared < 1)
+    num_shared = 1;
+
+  // Sheet
+  col_name(cols, col);
+  buf_printf(&b, "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
+             "<worksheet xmlns=\"http://schemas.openxmlformats.org/spreadsheetml/2006/main\">"
+             "<dimension ref=\"A1:%s%d\"/><sheetData>", col, rows);
+  for (r = 1; r <= rows; r++) {
+    buf_printf(&b, "<row r=\"%d\">", r);
+    for (c = 1; c <= cols; c++) {
+      if (rnd_pct(sparse))
+        continue;
+      col_name(c, col);
+      if (!rnd_pct(strings))
+        buf_printf(&b, "<c r=\"%s%d\"><v>%d.%03d</v></c>", col, r, (int) (rnd() % 1000000), (int) (rnd() % 1000));
+      else if (rnd_pct(inl)) {
+        buf_printf(&b, "<c r=\"%s%d\" t=\"inlineStr\"><is><t>", col, r);
+        string_text(&b, (int) (rnd() % 100000));
+        buf_puts(&b, "</t></is></c>");
+      }
+      else
+        buf_printf(&b, "<c r=\"%s%d\" t=\"s\"><v>%d</v></c>", col, r, (int) (rnd() % num_shared));
+    }
+    buf_puts(&b, "</row>");
+  }
+  buf_puts(&b, "</sheetData></worksheet>");
+  add_part(&zip, "xl/worksheets/sheet1.xml", &b, level);
+
+  buf_printf(&b, "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
+             "<sst xmlns=\"http://schemas.openxmlformats.org/spreadsheetml/2006/main\" count=\"%d\" uniqueCount=\"%d\">",
+             num_refs, num_shared);
+  for (i = 0; i < num_shared; i++) {
+    if (rnd_pct(rich)) {
+      buf_puts(&b, "<si><r><rPr><b/><sz val=\"11\"/></rPr><t xml:space=\"preserve\">");
+      string_text(&b, i);
+      buf_puts(&b, " </t></r><r><rPr><i/><sz val=\"11\"/></rPr><t>");
+      for (k = 0; k < 2; k++)
+        string_text(&b, i + k);
+      buf_puts(&b, "</t></r></si>");
+    }
+    else {
+      buf_puts(&b, "<si><t>");
+      string_text(&b, i);
+      buf_puts(&b, "</t></si>");
+    }
+  }
+  buf_puts(&b, "</sst>");
+  add_part(&zip, "xl/sharedStrings.xml", &b, level);
+
+  if (!mz_zip_writer_finalize_archive(&zip) || !mz_zip_writer_end(&zip)) {
+    fprintf(stderr, "Couldn't write output file '%s' .\n", output);
+    return 1;
+  }
+  free(b.ptr);
+  return 0;
+}
@@ -0,0 +1,3242 @@
+/*****************************************************************
+ NAME:
+   cxlsx - read Excel 2007 files row by row
+
+ COMPILATION:
+   cc -DCONFIG_EXPAT -c cxlsx.c
+   or
+   cc -DCONFIG_MXML -c cxlsx.c
+   or
+   cc -DCONFIG_PARSIFAL -c cxlsx.c
+   or (to benchmark the time used by decompressing step)
+   cc -c cxlsx.c
+
+ Must be used with Expat compiled for UTF-8 output.
+
+** Copyright (C) 2015 Victor Paesa
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+*****************************************************************/
+
+#include <ctype.h>
+#include <stdlib.h>
+#define MINIZ_CRC32_DISPATCH
+#include "miniz.c"
+
+typedef unsigned char uint8;
+typedef unsigned short uint16;
+typedef unsigned int uint;
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "cxlsx.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif /* __linux__ */
+
+#ifdef CONFIG_PARSIFAL
+#include "libparsifal/parsifal.h"
+#endif /* CONFIG_PARSIFAL */
+
+#ifdef CONFIG_MXML
+#include <mxml.h>
+#endif /* CONFIG_MXML */
+
+#ifdef CONFIG_EXPAT
+#include <expat.h>
+
+#if defined(__amigaos__) && defined(__USE_INLINE__)
+#include <proto/expat.h>
+#endif
+
+#ifdef XML_LARGE_SIZE
+#if defined(XML_USE_MSC_EXTENSIONS) && _MSC_VER < 1400
+#define XML_FMT_INT_MOD "I64"
+#else
+#define XML_FMT_INT_MOD "ll"
+#endif
+#else
+#define XML_FMT_INT_MOD "l"
+#endif
+#endif /* CONFIG_EXPAT */
+
+#ifdef _MSC_VER
+#define XLSX_THREAD_LOCAL __declspec(thread)
+#else
+#define XLSX_THREAD_LOCAL __thread
+#endif
+
+/*
+** Kernels in several variants, for the instruction sets of xlsx_cpu_level(),
+** built with the target attribute of GCC and Clang so that the binary needs
+** no -march and runs on any x86 CPU.
+*/
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define XLSX_X86_DISPATCH
+#include <immintrin.h>
+#define XLSX_TARGET(isa) __attribute__((target(isa)))
+#endif /* x86 && __GNUC__ */
+
+static int cpu_level = -1;
+
+int xlsx_cpu_level(void)
+{
+  const char *cap;
+  int level = XLSX_CPU_SCALAR, i;
+
+  if (cpu_level >= 0)
+    return cpu_level;
+#ifdef XLSX_X86_DISPATCH
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2")) {
+    level = XLSX_CPU_SSE42;
+    if (__builtin_cpu_supports("avx2")) {
+      level = XLSX_CPU_AVX2;
+      if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+        level = XLSX_CPU_AVX512;
+    }
+  }
+#endif /* XLSX_X86_DISPATCH */
+  if ((cap = getenv("CXLSX_CPU")))
+    for (i = XLSX_CPU_SCALAR; i < level; i++)
+      if (!strcmp(cap, xlsx_cpu_name(i)))
+        level = i;
+  return cpu_level = level;
+}
+
+const char *xlsx_cpu_name(int level)
+{
+  static const char *names[] = { "scalar", "sse4.2", "avx2", "avx512" };
+
+  return ((level >= XLSX_CPU_SCALAR) && (level <= XLSX_CPU_AVX512)) ? names[level] : "unknown";
+}
+
+/*
+** CRC-32 of miniz, checked over every part inflated. With PCLMULQDQ the
+** buffer is folded 64 bytes at a time by carry-less multiplications, as in
+** "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ" (Intel, 2009),
+** the remaining bytes going through mz_crc32_portable(). crc is taken and
+** returned not inverted, len is a multiple of 16 and at least 64.
+*/
+#ifdef XLSX_X86_DISPATCH
+// x^(4*128+32), x^(4*128-32), x^(128+32), x^(128-32) and x^64 mod P, then P and x^64 / P, bit reflected
+static const mz_uint64 crc32_k1k2[2] __attribute__((aligned(16))) = { 0x0154442bd4, 0x01c6e41596 };
+static const mz_uint64 crc32_k3k4[2] __attribute__((aligned(16))) = { 0x01751997d0, 0x00ccaa009e };
+static const mz_uint64 crc32_k5k0[2] __attribute__((aligned(16))) = { 0x0163cd6124, 0x0000000000 };
+static const mz_uint64 crc32_poly[2] __attribute__((aligned(16))) = { 0x01db710641, 0x01f7011641 };
+
+// Fold x1..x4 into 128 bits, then the rest 16 bytes at a time, and reduce to 32 bits
+XLSX_TARGET("sse4.2,pclmul")
+static inline mz_uint32 crc32_reduce(__m128i x1, __m128i x2, __m128i x3, __m128i x4, const mz_uint8 *p, size_t len)
+{
+  __m128i x0, x5;
+
+  x0 = _mm_load_si128((const __m128i *) crc32_k3k4);
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+  for (; len >= 16; p += 16, len -= 16) {
+    x2 = _mm_loadu_si128((const __m128i *) p);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+  }
+  // 128 bits to 64, then Barrett reduction to 32
+  x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+  x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+  x0 = _mm_loadl_epi64((const __m128i *) crc32_k5k0);
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, x3), x0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+  x0 = _mm_load_si128((const __m128i *) crc32_poly);
+  x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, x3), x0, 0x10);
+  x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, x3), x0, 0x00);
+  return (mz_uint32) _mm_extract_epi32(_mm_xor_si128(x1, x2), 1);
+}
+
+XLSX_TARGET("sse4.2,pclmul")
+static mz_uint32 crc32_fold_sse42(mz_uint32 crc, const mz_uint8 *p, size_t len)
+{
+  __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+  x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) p), _mm_cvtsi32_si128((int) crc));
+  x2 = _mm_loadu_si128((const __m128i *) (p + 16));
+  x3 = _mm_loadu_si128((const __m128i *) (p + 32));
+  x4 = _mm_loadu_si128((const __m128i *) (p + 48));
+  x0 = _mm_load_si128((const __m128i *) crc32_k1k2);
+  for (p += 64, len -= 64; len >= 64; p += 64, len -= 64) {
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+    x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *) p));
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *) (p + 16)));
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *) (p + 32)));
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *) (p + 48)));
+  }
+  return crc32_reduce(x1, x2, x3, x4, p, len);
+}
+
+// The same 64 bytes at a time, in the four lanes of a single register
+XLSX_TARGET("avx512f,vpclmulqdq,sse4.2,pclmul")
+static mz_uint32 crc32_fold_avx512(mz_uint32 crc, const mz_uint8 *p, size_t len)
+{
+  __m512i z0, z1, k;
+
+  z0 = _mm512_xor_si512(_mm512_loadu_si512(p), _mm512_castsi128_si512(_mm_cvtsi32_si128((int) crc)));
+  k = _mm512_broadcast_i32x4(_mm_load_si128((const __m128i *) crc32_k1k2));
+  for (p += 64, len -= 64; len >= 64; p += 64, len -= 64) {
+    z1 = _mm512_clmulepi64_epi128(z0, k, 0x00);
+    z0 = _mm512_clmulepi64_epi128(z0, k, 0x11);
+    z0 = _mm512_ternarylogic_epi64(z0, z1, _mm512_loadu_si512(p), 0x96);
+  }
+  return crc32_reduce(_mm512_extracti32x4_epi32(z0, 0), _mm512_extracti32x4_epi32(z0, 1),
+                      _mm512_extracti32x4_epi32(z0, 2), _mm512_extracti32x4_epi32(z0, 3), p, len);
+}
+#endif /* XLSX_X86_DISPATCH */
+
+static mz_uint32 (*crc32_fold)(mz_uint32 crc, const mz_uint8 *p, size_t len);
+
+mz_ulong mz_crc32(mz_ulong crc, const mz_uint8 *ptr, size_t buf_len)
+{
+  size_t n;
+
+  if (!ptr || !crc32_fold || (buf_len < 64))
+    return mz_crc32_portable(crc, ptr, buf_len);
+  n = buf_len & ~(size_t) 15;
+  crc = ~crc32_fold(~(mz_uint32) crc, ptr, n);
+  return mz_crc32_portable(crc, ptr + n, buf_len - n);
+}
+
+static void crc32_select(int level)
+{
+  crc32_fold = NULL;
+#ifdef XLSX_X86_DISPATCH
+  if ((level >= XLSX_CPU_AVX512) && __builtin_cpu_supports("vpclmulqdq"))
+    crc32_fold = crc32_fold_avx512;
+  else if ((level >= XLSX_CPU_SSE42) && __builtin_cpu_supports("pclmul"))
+    crc32_fold = crc32_fold_sse42;
+#else
+  (void) level;
+#endif /* XLSX_X86_DISPATCH */
+}
+
+#ifdef __GNUC__
+__attribute__((constructor))
+static void crc32_dispatch(void)
+{
+  crc32_select(xlsx_cpu_level());
+}
+#endif /* __GNUC__ */
+
+/*
+** Number formats, as far as their output is concerned: plain numbers, or
+** dates and times that are output in ISO 8601 (YYYY-MM-DDTHH:MM:SS.sss).
+*/
+enum { STYLE_NUMBER, STYLE_DATE, STYLE_TIME, STYLE_DATETIME };
+
+typedef struct XLSXNumFmt XLSXNumFmt;
+struct XLSXNumFmt {
+  int    id;             /* numFmtId */
+  uint8  kind;           /* STYLE_NUMBER, STYLE_DATE, STYLE_TIME or STYLE_DATETIME */
+  uint8  frac;           /* Number of decimals of the seconds */
+};
+
+/*
+** Destination of the character data while parsing
+*/
+enum { COLLECT_NONE, COLLECT_SHARED, COLLECT_VALUE };
+
+/*
+** State of the open sheet
+*/
+enum { SHEET_NONE, SHEET_OPEN, SHEET_PARSING, SHEET_DONE };
+
+/*
+** XML parts of the workbook, each one with its own handlers.
+*/
+enum { PART_SHAREDSTRINGS, PART_SHEET, PART_STYLES, PART_WORKBOOK };
+
+#if defined(CONFIG_EXPAT) || defined(CONFIG_PARSIFAL)
+static const char *part_names[] = { "SharedStrings", "Sheet", "Styles", "Workbook" };
+#endif /* CONFIG_EXPAT || CONFIG_PARSIFAL */
+
+/*
+** Phases of xlsx_stats() where the inflating and the parsing of each part are accounted
+*/
+static const int part_inflate_phase[] = { XLSX_PHASE_SST_INFLATE, XLSX_PHASE_SHEET_INFLATE, XLSX_PHASE_STYLES, XLSX_PHASE_STYLES };
+static const int part_parse_phase[] = { XLSX_PHASE_SST_PARSE, XLSX_PHASE_SHEET_PARSE, XLSX_PHASE_STYLES, XLSX_PHASE_STYLES };
+
+/*
+** Names of the spans of each part, for xlsx_set_trace()
+*/
+static const char *part_inflate_span[] = { "inflate sharedStrings", "inflate sheet", "inflate styles", "inflate workbook" };
+static const char *part_parse_span[] = { "parse sharedStrings", "parse sheet", "parse styles", "parse workbook" };
+
+/*
+** Start of a measured phase
+*/
+typedef struct XLSXTime XLSXTime;
+struct XLSXTime {
+  struct timespec wall, cpu;
+  uint64_t perf[XLSX_PERF_COUNTERS];
+};
+
+/*
+** Type of a column exported to Arrow
+*/
+enum { ARROW_DICT, ARROW_FLOAT64, ARROW_UTF8 };
+
+/*
+** A cell of the batch being exported to Arrow. Shared strings keep their
+** index, other values are copied into arrow_text.
+*/
+typedef struct ArrowCell ArrowCell;
+struct ArrowCell {
+  int    row;            /* Row within the batch */
+  int    col;
+  int    type;
+  int    index;
+  size_t off;
+  int    len;
+};
+
+/*
+** Memory owned by an exported ArrowArray or ArrowSchema, freed by its release callback
+*/
+typedef struct ArrowPriv ArrowPriv;
+struct ArrowPriv {
+  int    num;
+  void  *mem[6];
+};
+
+/*
+** Header of the blocks allocated for miniz and Expat, see mem_alloc()
+*/
+typedef union XLSXMemHeader XLSXMemHeader;
+union XLSXMemHeader {
+  struct {
+    XLSXCtx       *ctx;
+    size_t         size;
+    XLSXMemHeader *prev, *next;   /* Links of the blocks of their own */
+  } h;
+  double     align;   /* Keeps the block after the header aligned as malloc() does */
+  void      *align_ptr;
+  uint64_t   align_u64;
+};
+
+/*
+** Slab of the arena, small blocks are cut from it
+*/
+typedef struct XLSXSlab XLSXSlab;
+struct XLSXSlab {
+  XLSXSlab  *next;
+  double     align;
+};
+
+/*
+** An object used to parse XML content of XLSX
+*/
+struct XLSXCtx {
+  mz_zip_archive zip;
+  int    flags;
+  int    xml_depth;      /* Current dept while parsing the XML tree */
+  int    collect;        /* Where character data goes: COLLECT_NONE, COLLECT_SHARED or COLLECT_VALUE */
+  int    failed;         /* Flag set when out of memory while parsing */
+  char   errmsg[256];
+  /* Shared strings, back to back in one arena: string i is shrdstr_buff[shrdstr_offs[i]..shrdstr_offs[i+1]] */
+  char  *shrdstr_buff;
+  size_t shrdstr_len, shrdstr_cap;
+  int    shrdstr_huge;   /* Flag set once shrdstr_buff is on huge pages, see grow_buf() */
+  int   *shrdstr_offs;
+  int    shrdstr_num, shrdstr_cnt;
+  int    in_rph;         /* Flag set while inside a phonetic run <rPh>, whose text is not part of the string */
+  int    in_is;          /* Flag set while inside the inline string <is> of a cell */
+  /* Styles */
+  int    date1904;       /* Flag for the 1904 date system (workbookPr date1904) */
+  XLSXNumFmt *styles;    /* Number format of each style index, from xl/styles.xml cellXfs */
+  int    styles_num, styles_cap;
+  XLSXNumFmt *numfmts;   /* Custom number formats, from xl/styles.xml numFmts */
+  int    numfmts_num, numfmts_cap;
+  int    in_cellxfs;     /* Flag set while inside <cellXfs> of xl/styles.xml */
+  XLSXStats stats;       /* Measured with XLSX_STATS */
+  int    perf_state;     /* PERF_NONE until the counters are first needed, then PERF_OPEN or PERF_FAILED */
+  int    perf_fd[XLSX_PERF_COUNTERS];  /* Counters of the group, the first one opened leads it */
+  unsigned int perf_mask;
+  XLSXMemory memory;     /* Accounted by grow() and the allocators given to miniz and Expat */
+  XLSXSlab *slabs;       /* Arena of the allocations of miniz and Expat, kept from workbook to workbook */
+  XLSXSlab *slab;        /* Slab being cut, NULL before the first one */
+  char  *slab_ptr, *slab_end;
+  XLSXMemHeader *big;    /* Blocks of their own, too big for a slab */
+  size_t max_memory;     /* Budget of xlsx_set_max_memory(), 0 for none */
+  /* Sheet */
+  char  *sheet_ptr;      /* Inflated part being parsed, kept with its capacity for the next parts */
+  size_t sheet_size, sheet_cap;
+  int    sheet_huge;     /* Flag set once sheet_ptr is on huge pages, see grow_buf() */
+  uint64_t part_comp_size;   /* Compressed size of the last part inflated or streamed */
+  uint8 *zip_buff;       /* Read buffer of the inflater */
+  /* Sheet inflated in pieces, when it does not fit in max_memory */
+  int    stream;         /* Flag set when the sheet is streamed, see stream_next() */
+  int    stream_inflated;      /* Flag set once the whole part has been inflated */
+  int    stream_done;          /* Flag set once the parser has been told the part is over */
+  int    stream_method;        /* 0 for stored, MZ_DEFLATED */
+  tinfl_decompressor stream_inflator;
+  mz_uint64 stream_ofs, stream_left;  /* Archive offset and size of the compressed data still to read */
+  const uint8 *stream_in;      /* Compressed data read and not inflated yet */
+  size_t stream_in_len;
+  mz_uint64 stream_out;        /* Bytes inflated so far, the last TINFL_LZ_DICT_SIZE of them are in sheet_ptr */
+  mz_uint32 stream_crc, stream_crc_part;
+  int    sheet_state;
+  int    sheet_num_rows, sheet_num_cols;
+  int    current_col, cell_type, cell_style;
+  XLSXRow row;           /* Row being read */
+  int    cells_cap;
+  char  *row_buff;       /* Text of the values of the row */
+  size_t row_len, row_cap, value_start;
+  xlsx_row_cb row_cb;    /* Callback for each row, NULL when pulling rows */
+  void  *row_data;
+  /* Arrow export */
+  int    arrow_cols;     /* Number of columns, 0 until the first batch */
+  uint8 *arrow_kinds;    /* ARROW_DICT, ARROW_FLOAT64 or ARROW_UTF8, for each column */
+  char **arrow_names;    /* Name of each column */
+  int    arrow_last_row;  /* Sheet row of the last batch row, the rows missing after it are null rows */
+  const XLSXRow *arrow_pending;  /* Row read after a gap, gathered once the null rows before it are */
+  ArrowCell *arrow_cells;
+  int    arrow_cells_num, arrow_cells_cap;
+  char  *arrow_text;
+  size_t arrow_text_len, arrow_text_cap;
+#ifndef CONFIG_EXPAT
+  /* Rows queued for xlsx_next_row(), when the parser cannot be suspended */
+  XLSXRow  *q_rows;
+  int       q_rows_num, q_rows_cap, q_next;
+  XLSXCell *q_cells;
+  size_t   *q_offs;      /* Offset of each value in q_text, or -1 for shared strings */
+  int       q_cells_num, q_cells_cap;
+  size_t    q_offs_cap;
+  char     *q_text;
+  size_t    q_len, q_cap;
+#endif /* Not(CONFIG_EXPAT) */
+#ifdef CONFIG_EXPAT
+  XML_Parser parser;     /* Parser of the open sheet, suspended at the end of each pulled row */
+#endif /* CONFIG_EXPAT */
+#ifdef CONFIG_PARSIFAL
+  XMLCH *sheet_cur_ptr;
+  XMLCH *sheet_end_ptr;
+#endif /* CONFIG_PARSIFAL */
+};
+
+
+/*  
+    XLSX files are zip files which contain several xml files with data:
+ _rels/.rels
+ docProps/app.xml
+ docProps/core.xml
+ xl/_rels/workbook.xml.rels
+ xl/sharedStrings.xml
+ xl/worksheets/sheet2.xml
+ xl/worksheets/sheet1.xml
+ xl/styles.xml
+ xl/workbook.xml
+ [Content_Types].xml
+
+  The name of each sheet is in xl/workbook.xml
+  The individual sheets are kept in xl/worksheets/sheet1.xml
+  To save on space, Microsoft stores all the character literal values in one common xl/sharedStrings.xml dictionary file. The individual cell value found for this string in the actual sheet1.xml file is just an index into this dictionary.
+  OLEDB created xlsx use inline strings instead of shared ones.
+  Some brief tutorial: http://openxmldeveloper.org/files/1928/download.aspx
+  Dates are stored as day number since 1900/01/01 (or 1904/01/01 when workbookPr has date1904 set in xl/workbook.xml).
+  Only the style of the cell, found in "s" attribute as an index into cellXfs of xl/styles.xml, tells a date from a plain number.
+  Time portion of the date is stored as a fraction of a day, so it has to be multiplied by 60*60*24 (86400) to get the actual number os seconds.
+  Microsoft does not store empty cells or rows in xl/worksheets/sheet1.xml, so any gaps between values have to be taken care by the code.
+  To figure out the number of skipped columns one need to be able to figure out the distance between, say, cell "AB67" and "C67". The way columns are named: A through Z, then AA through AZ, then AAA through AAZ, etc., suggests that we may assume they are using a base-26 system and therefore use a simple conversion method from a base-26 to the decimal system and then use subtraction to find out the number of commas between columns.
+    
+-------------------------------------------------------------------------
+xl/sharedStrings.xml has in "sst:uniqueCount" a count of the number of unique strings
+unzip -c 3x2.xlsx xl/sharedStrings.xml | tidy -indent -xml
+-------------------------------------------------------------------------
+<sst count="9" uniqueCount="5">
+  <si>
+    <t>Col1</t>
+  </si>
+  <si>
+    <t>Col2</t>
+  </si>
+  <si>
+    <t>Col3</t>
+  </si>
+  <si>
+    <t>a</t>
+  </si>
+  <si>
+    <t>b</t>
+  </si>
+  <si>
+    <t>c</t>
+  </si>
+</sst>
+-------------------------------------------------------------------------
+
+-------------------------------------------------------------------------
+xl/worksheets/sheet1.xml has in "dimension:ref" the enclosing range of cells used
+unzip -c 3x2.xlsx xl/worksheets/sheet1.xml | tidy -indent -xml
+-------------------------------------------------------------------------
+<worksheet>
+  <dimension ref="A1:C3" />
+  <sheetData>
+    <row r="1" spans="1:3">
+      <c r="A1" t="s">
+        <v>0</v>
+      </c>
+      <c r="B1" t="s">
+        <v>1</v>
+      </c>
+      <c r="C1" t="s">
+        <v>27.344</v>
+      </c>
+    </row>
+    <row r="2" spans="1:3">
+      <c r="A2" t="s">
+        <v>3</v>
+      </c>
+      <c r="B2" s="1">
+        <v>42283</v>
+      </c>
+      <c r="C2" t="s">
+        <v>3</v>
+      </c>
+    </row>
+    <row r="3">
+      <c r="A3" t="inlineStr">
+        <is>
+          <t>some value</t>
+        </is>
+      </c>
+      <c r="B4" t="inlineStr">
+        <is>
+          <t>some other value</t>
+        </is>
+      </c>
+      <c r="C4" t="inlineStr">
+        <is>
+          <t>yet some value</t>
+        </is>
+      </c>
+    </row>
+  </sheetData>
+</worksheet>
+-------------------------------------------------------------------------
+
+-------------------------------------------------------------------------
+xl/styles.xml
+-------------------------------------------------------------------------
+<styleSheet>
+  <numFmts count="10">
+    <numFmt numFmtId="164" formatCode="GENERAL" />
+    <numFmt numFmtId="165" formatCode="DD/MM/YY" />
+    <numFmt numFmtId="166" formatCode="DD/MM/YYYY" />
+    <numFmt numFmtId="167" formatCode="D&quot; de &quot;MMM&quot; de &quot;YY" />
+    <numFmt numFmtId="168" formatCode="D&quot; de &quot;MMM&quot; de &quot;YYYY" />
+    <numFmt numFmtId="169" formatCode="DDDD, MMMM\ DD&quot;, &quot;YYYY" />
+    <numFmt numFmtId="170" formatCode="YYYY\-MM\-DD" />
+    <numFmt numFmtId="171" formatCode="YYYY\-MM\-DD" />
+    <numFmt numFmtId="172" formatCode="DDDD, D\ MMMM\ YYYY" />
+    <numFmt numFmtId="173" formatCode="YYYY\-MM\-DD\ HH:MM:SS.SSS" />
+  </numFmts>
+</styleSheet>
+-------------------------------------------------------------------------
+
+
+
+*/
+
+/*
+** Memory accounting, by use. Allocations of miniz and Expat carry a header
+** with their XLSXCtx and size, so that they can be accounted when freed.
+*/
+static void mem_count(XLSXCtx *ctx, int use, size_t old_size, size_t new_size)
+{
+  XLSXMemUse *u[2];
+  int i;
+
+  u[0] = &ctx->memory.use[use];
+  u[1] = &ctx->memory.total;
+  for (i = 0; i < 2; i++) {
+    u[i]->bytes += new_size - old_size;
+    if (u[i]->bytes > u[i]->peak)
+      u[i]->peak = u[i]->bytes;
+    if (new_size > old_size)
+      u[i]->allocs++;
+  }
+}
+
+/*
+** Buffers of HUGE_PAGE bytes or more with XLSX_HUGEPAGES: they are scanned
+** from end to end, and a 2 MB page takes a single entry of the TLB instead of
+** 512. They are mmap()ed and advised to be backed by transparent huge pages,
+** or, when built with -DCONFIG_HUGETLB, taken first from the huge pages that
+** the administrator reserved (vm.nr_hugepages). Other systems use malloc().
+*/
+#define HUGE_PAGE (2*1024*1024)
+#define HUGE_ROUND(n) (((n) + HUGE_PAGE - 1) & ~((size_t) HUGE_PAGE - 1))
+
+#ifdef __linux__
+static inline int huge_wanted(XLSXCtx *ctx, size_t size)
+{
+  return (ctx->flags & XLSX_HUGEPAGES) && (size >= HUGE_PAGE);
+}
+
+static void *huge_alloc(size_t size)
+{
+  void *p;
+
+  size = HUGE_ROUND(size);
+#ifdef CONFIG_HUGETLB
+  p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (p != MAP_FAILED)
+    return p;
+#endif /* CONFIG_HUGETLB */
+  p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    return NULL;
+#ifdef MADV_HUGEPAGE
+  madvise(p, size, MADV_HUGEPAGE);
+#endif /* MADV_HUGEPAGE */
+  return p;
+}
+
+static void huge_free(void *ptr, size_t size)
+{
+  if (ptr)
+    munmap(ptr, HUGE_ROUND(size));
+}
+
+static void *huge_realloc(void *ptr, size_t old_size, size_t size)
+{
+  void *p;
+
+#if defined(MREMAP_MAYMOVE) && !defined(CONFIG_HUGETLB)
+  p = mremap(ptr, HUGE_ROUND(old_size), HUGE_ROUND(size), MREMAP_MAYMOVE);
+  if (p == MAP_FAILED)
+    return NULL;
+#ifdef MADV_HUGEPAGE
+  madvise(p, HUGE_ROUND(size), MADV_HUGEPAGE);
+#endif /* MADV_HUGEPAGE */
+#else
+  // Pages of MAP_HUGETLB may not be remapped, they are copied
+  p = huge_alloc(size);
+  if (!p)
+    return NULL;
+  memcpy(p, ptr, old_size);
+  huge_free(ptr, old_size);
+#endif /* MREMAP_MAYMOVE && Not(CONFIG_HUGETLB) */
+  return p;
+}
+#else
+static inline int huge_wanted(XLSXCtx *ctx, size_t size)
+{
+  (void) ctx;
+  (void) size;
+  return 0;
+}
+
+static void *huge_alloc(size_t size)
+{
+  return malloc(size);
+}
+
+static void huge_free(void *ptr, size_t size)
+{
+  (void) size;
+  free(ptr);
+}
+
+static void *huge_realloc(void *ptr, size_t old_size, size_t size)
+{
+  (void) old_size;
+  return realloc(ptr, size);
+}
+#endif /* __linux__ */
+
+/*
+** The allocations of miniz and Expat for a workbook come from an arena: blocks
+** of up to ARENA_BIG bytes are cut in turn from slabs of ARENA_SLAB bytes, and
+** are not freed but all at once, when the slabs are rewound (in O(1), they are
+** kept for the next workbook) by arena_reset(). Freeing or growing the last
+** block cut reuses its room. Bigger blocks, such as the buffer of Expat, are
+** allocated on their own and listed, so that they can be freed one by one
+** (on huge pages when huge_wanted(), the flags do not change until then).
+** The accounting is of the blocks, not of the slabs they are cut from.
+*/
+#define ARENA_SLAB  (256*1024)
+#define ARENA_BIG   (16*1024)
+#define ARENA_ROUND(n) (((n) + sizeof(XLSXMemHeader) - 1) / sizeof(XLSXMemHeader) * sizeof(XLSXMemHeader))
+
+static XLSXMemHeader *slab_cut(XLSXCtx *ctx, size_t size)
+{
+  XLSXSlab *next;
+  char *p;
+
+  size = sizeof(XLSXMemHeader) + ARENA_ROUND(size);
+  while ((size_t) (ctx->slab_end - ctx->slab_ptr) < size) {
+    next = ctx->slab ? ctx->slab->next : ctx->slabs;
+    if (!next) {
+      if (!(next = malloc(ARENA_SLAB)))
+        return NULL;
+      next->next = NULL;
+      if (ctx->slab)
+        ctx->slab->next = next;
+      else
+        ctx->slabs = next;
+    }
+    ctx->slab = next;
+    ctx->slab_ptr = (char *) next + ARENA_ROUND(sizeof(XLSXSlab));
+    ctx->slab_end = (char *) next + ARENA_SLAB;
+  }
+  p = ctx->slab_ptr;
+  ctx->slab_ptr += size;
+  return (XLSXMemHeader *) p;
+}
+
+/*
+** Flag for a block that ends where the next one would be cut
+*/
+static inline int slab_last(XLSXCtx *ctx, XLSXMemHeader *m)
+{
+  return (char *) (m + 1) + ARENA_ROUND(m->h.size) == ctx->slab_ptr;
+}
+
+static void big_link(XLSXCtx *ctx, XLSXMemHeader *m)
+{
+  if (m->h.prev)
+    m->h.prev->h.next = m;
+  else
+    ctx->big = m;
+  if (m->h.next)
+    m->h.next->h.prev = m;
+}
+
+static void *mem_alloc(XLSXCtx *ctx, int use, size_t size)
+{
+  XLSXMemHeader *m;
+
+  if (size > ARENA_BIG) {
+    if (huge_wanted(ctx, sizeof(XLSXMemHeader) + size))
+      m = huge_alloc(sizeof(XLSXMemHeader) + size);
+    else
+      m = malloc(sizeof(XLSXMemHeader) + size);
+    if (!m)
+      return NULL;
+    m->h.prev = NULL;
+    m->h.next = ctx->big;
+    big_link(ctx, m);
+  }
+  else if (!(m = slab_cut(ctx, size)))
+    return NULL;
+  m->h.ctx = ctx;
+  m->h.size = size;
+  mem_count(ctx, use, 0, size);
+  return m + 1;
+}
+
+static void mem_free(int use, void *ptr)
+{
+  XLSXMemHeader *m;
+  XLSXCtx *ctx;
+
+  if (!ptr)
+    return;
+  m = (XLSXMemHeader *) ptr - 1;
+  ctx = m->h.ctx;
+  mem_count(ctx, use, m->h.size, 0);
+  if (m->h.size > ARENA_BIG) {
+    m->h.ctx = NULL;
+    if (m->h.prev)
+      m->h.prev->h.next = m->h.next;
+    else
+      ctx->big = m->h.next;
+    if (m->h.next)
+      m->h.next->h.prev = m->h.prev;
+    if (huge_wanted(ctx, sizeof(XLSXMemHeader) + m->h.size))
+      huge_free(m, sizeof(XLSXMemHeader) + m->h.size);
+    else
+      free(m);
+  }
+  else if (slab_last(ctx, m))
+    ctx->slab_ptr = (char *) m;
+}
+
+static void *mem_realloc(XLSXCtx *ctx, int use, void *ptr, size_t size)
+{
+  XLSXMemHeader *m;
+  void *p;
+
+  if (!ptr)
+    return mem_alloc(ctx, use, size);
+  m = (XLSXMemHeader *) ptr - 1;
+  ctx = m->h.ctx;
+  if ((m->h.size > ARENA_BIG) && (size > ARENA_BIG) &&
+      (huge_wanted(ctx, sizeof(XLSXMemHeader) + m->h.size) == huge_wanted(ctx, sizeof(XLSXMemHeader) + size))) {
+    // The neighbours are relinked to the block wherever realloc() leaves it
+    if (huge_wanted(ctx, sizeof(XLSXMemHeader) + size))
+      m = huge_realloc(m, sizeof(XLSXMemHeader) + m->h.size, sizeof(XLSXMemHeader) + size);
+    else
+      m = realloc(m, sizeof(XLSXMemHeader) + size);
+    if (!m)
+      return NULL;
+    big_link(ctx, m);
+  }
+  else if ((m->h.size <= ARENA_BIG) && (size <= ARENA_BIG) &&
+           ((size <= m->h.size) ||
+            (slab_last(ctx, m) && ((size_t) (ctx->slab_end - (char *) (m + 1)) >= ARENA_ROUND(size))))) {
+    if (slab_last(ctx, m))
+      ctx->slab_ptr = (char *) (m + 1) + ARENA_ROUND(size);
+  }
+  else {
+    if (!(p = mem_alloc(ctx, use, size)))
+      return NULL;
+    memcpy(p, ptr, (size < m->h.size) ? size : m->h.size);
+    mem_free(use, ptr);
+    return p;
+  }
+  mem_count(ctx, use, m->h.size, size);
+  m->h.size = size;
+  return m + 1;
+}
+
+/*
+** Free the blocks of their own, and rewind the slabs for the next workbook.
+** Everything allocated by miniz and Expat is gone then.
+*/
+static void arena_reset(XLSXCtx *ctx)
+{
+  XLSXMemHeader *m;
+
+  while ((m = ctx->big)) {
+    ctx->big = m->h.next;
+    if (huge_wanted(ctx, sizeof(XLSXMemHeader) + m->h.size))
+      huge_free(m, sizeof(XLSXMemHeader) + m->h.size);
+    else
+      free(m);
+  }
+  mem_count(ctx, XLSX_MEM_ZIP, ctx->memory.use[XLSX_MEM_ZIP].bytes, 0);
+  mem_count(ctx, XLSX_MEM_PARSER, ctx->memory.use[XLSX_MEM_PARSER].bytes, 0);
+  ctx->slab = NULL;
+  ctx->slab_ptr = ctx->slab_end = NULL;
+}
+
+static void arena_free(XLSXCtx *ctx)
+{
+  XLSXSlab *s;
+
+  arena_reset(ctx);
+  while ((s = ctx->slabs)) {
+    ctx->slabs = s->next;
+    free(s);
+  }
+}
+
+static void *zip_alloc(void *opaque, size_t items, size_t size)
+{
+  return mem_alloc(opaque, XLSX_MEM_ZIP, items * size);
+}
+
+static void *zip_realloc(void *opaque, void *address, size_t items, size_t size)
+{
+  return mem_realloc(opaque, XLSX_MEM_ZIP, address, items * size);
+}
+
+static void zip_free(void *opaque, void *address)
+{
+  (void) opaque;
+  mem_free(XLSX_MEM_ZIP, address);
+}
+
+/*
+** Grow *ptr to hold need elements of size elsize, accounted for use.
+** Returns -1 when out of memory.
+*/
+static int grow(XLSXCtx *ctx, int use, void **ptr, size_t *cap, size_t need, size_t elsize)
+{
+  void *p;
+  size_t n;
+
+  if (need <= *cap)
+    return 0;
+  n = (*cap < 64) ? 64 : *cap;
+  while (n < need)
+    n *= 2;
+  p = realloc(*ptr, n * elsize);
+  if (!p) {
+    ctx->failed = 1;
+    snprintf(ctx->errmsg, sizeof(ctx->errmsg), "Out of memory");
+    return -1;
+  }
+  mem_count(ctx, use, *cap * elsize, n * elsize);
+  *ptr = p;
+  *cap = n;
+  return 0;
+}
+
+/*
+** Same as grow() for the big buffers of bytes, that are moved to huge pages
+** once they reach HUGE_PAGE bytes with XLSX_HUGEPAGES; *huge is set then.
+*/
+static int grow_buf(XLSXCtx *ctx, int use, char **ptr, size_t *cap, size_t need, int *huge)
+{
+  char *p;
+  size_t n;
+
+  if (need <= *cap)
+    return 0;
+  if (!*huge && !huge_wanted(ctx, need))
+    return grow(ctx, use, (void **) ptr, cap, need, 1);
+  n = (*cap < 64) ? 64 : *cap;
+  while (n < need)
+    n *= 2;
+  if (*huge)
+    p = huge_realloc(*ptr, *cap, n);
+  else if ((p = huge_alloc(n)) && *ptr) {
+    memcpy(p, *ptr, *cap);
+    free(*ptr);
+  }
+  if (!p) {
+    ctx->failed = 1;
+    snprintf(ctx->errmsg, sizeof(ctx->errmsg), "Out of memory");
+    return -1;
+  }
+  mem_count(ctx, use, *cap, n);
+  *ptr = p;
+  *cap = n;
+  *huge = 1;
+  return 0;
+}
+
+static void free_buf(char *ptr, size_t cap, int huge)
+{
+  if (huge)
+    huge_free(ptr, cap);
+  else
+    free(ptr);
+}
+
+static int grow_int(XLSXCtx *ctx, int use, void **ptr, int *cap, int need, size_t elsize)
+{
+  size_t c = *cap;
+  int ret;
+
+  ret = grow(ctx, use, ptr, &c, need, elsize);
+  *cap = (int) c;
+  return ret;
+}
+
+/*
+** Hardware counters for XLSX_PERF, as one perf_event_open() group of the
+** calling thread, so that all of them are read with a single read().
+** Events the CPU or the kernel do not offer are left out of the group.
+*/
+enum { PERF_NONE, PERF_OPEN, PERF_FAILED };
+
+#ifdef __linux__
+static void perf_open(XLSXCtx *ctx)
+{
+  static const struct { uint32_t type; uint64_t config; } events[XLSX_PERF_COUNTERS] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) }
+  };
+  struct perf_event_attr attr;
+  int i, leader = -1;
+
+  ctx->perf_mask = 0;
+  for (i = 0; i < XLSX_PERF_COUNTERS; i++) {
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[i].type;
+    attr.config = events[i].config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    ctx->perf_fd[i] = (int) syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+    if (ctx->perf_fd[i] < 0)
+      continue;
+    if (leader < 0)
+      leader = ctx->perf_fd[i];
+    ctx->perf_mask |= 1u << i;
+  }
+  ctx->perf_state = ctx->perf_mask ? PERF_OPEN : PERF_FAILED;
+}
+
+static void perf_close(XLSXCtx *ctx)
+{
+  int i;
+
+  if (ctx->perf_state == PERF_OPEN)
+    for (i = 0; i < XLSX_PERF_COUNTERS; i++)
+      if (ctx->perf_mask & (1u << i))
+        close(ctx->perf_fd[i]);
+}
+
+int xlsx_perf_read(XLSXCtx *ctx, uint64_t counters[XLSX_PERF_COUNTERS])
+{
+  uint64_t buf[1 + XLSX_PERF_COUNTERS];
+  int i, n, leader;
+
+  if (!(ctx->flags & XLSX_PERF))
+    return -1;
+  if (ctx->perf_state == PERF_NONE)
+    perf_open(ctx);
+  if (ctx->perf_state != PERF_OPEN)
+    return -1;
+  // The values come in the order the counters joined the group
+  for (leader = 0; !(ctx->perf_mask & (1u << leader)); leader++)
+    ;
+  if (read(ctx->perf_fd[leader], buf, sizeof(buf)) < (ssize_t) sizeof(uint64_t))
+    return -1;
+  for (i = 0, n = 1; i < XLSX_PERF_COUNTERS; i++)
+    counters[i] = ((ctx->perf_mask & (1u << i)) && (n <= (int) buf[0])) ? buf[n++] : 0;
+  return 0;
+}
+#else
+static void perf_close(XLSXCtx *ctx)
+{
+  (void) ctx;
+}
+
+int xlsx_perf_read(XLSXCtx *ctx, uint64_t counters[XLSX_PERF_COUNTERS])
+{
+  (void) ctx;
+  (void) counters;
+  return -1;
+}
+#endif /* __linux__ */
+
+/*
+** Measure phases with XLSX_STATS. The clocks are not read otherwise.
+*/
+static void stats_start(XLSXCtx *ctx, XLSXTime *t)
+{
+  if (!(ctx->flags & XLSX_STATS))
+    return;
+  clock_gettime(CLOCK_MONOTONIC, &t->wall);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t->cpu);
+  if ((ctx->flags & XLSX_PERF) && xlsx_perf_read(ctx, t->perf))
+    memset(t->perf, 0, sizeof(t->perf));
+}
+
+static void stats_stop(XLSXCtx *ctx, int phase, const XLSXTime *t, uint64_t bytes)
+{
+  XLSXPhase *ph = &ctx->stats.phase[phase];
+  struct timespec wall, cpu;
+  uint64_t perf[XLSX_PERF_COUNTERS];
+  int i;
+
+  if (!(ctx->flags & XLSX_STATS))
+    return;
+  if ((ctx->flags & XLSX_PERF) && !xlsx_perf_read(ctx, perf)) {
+    for (i = 0; i < XLSX_PERF_COUNTERS; i++)
+      ph->perf[i] += perf[i] - t->perf[i];
+    ctx->stats.perf = ctx->perf_mask;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &wall);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+  ph->wall += (wall.tv_sec - t->wall.tv_sec) + (wall.tv_nsec - t->wall.tv_nsec) * 1e-9;
+  ph->cpu += (cpu.tv_sec - t->cpu.tv_sec) + (cpu.tv_nsec - t->cpu.tv_nsec) * 1e-9;
+  ph->bytes += bytes;
+}
+
+/*
+** Spans of work for xlsx_set_trace(). The clock is not read otherwise.
+*/
+static xlsx_trace_cb trace_cb;
+static void *trace_data;
+
+static uint64_t trace_now(void)
+{
+  struct timespec t;
+
+  if (!trace_cb)
+    return 0;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static void trace_stop(const char *name, uint64_t start, uint64_t bytes)
+{
+  if (trace_cb)
+    trace_cb(trace_data, name, start, trace_now(), bytes);
+}
+
+static inline void excelcolrow(const char *string, int *outcol, int *outrow)
+{
+  int i, col;
+
+  col = 0;
+  for (i = 0; isalpha((unsigned char) string[i]); i++)
+    col = col * 26 + ((toupper((unsigned char) string[i])) - 'A' + 1);
+  *outcol = col;
+  *outrow = atoi(string + i);
+  return;
+}
+
+static inline void rangecolrow(const char *string, int *outcol, int *outrow)
+{
+  int col, row;
+  const char *coloninstr;
+
+  coloninstr = strchr(string, ':');
+  if (coloninstr) {
+    string = coloninstr + 1;
+    //fprintf(stderr, "rangecolrow: %s \n", string);
+  }
+  excelcolrow(string, &col, &row);
+  *outcol = col;
+  *outrow = row;
+}
+
+/*
+** Shared strings
+*/
+static inline void shared_append(XLSXCtx *ctx, const char *s, int len)
+{
+  if (ctx->failed || grow_buf(ctx, XLSX_MEM_SST, &ctx->shrdstr_buff, &ctx->shrdstr_cap, ctx->shrdstr_len + len, &ctx->shrdstr_huge))
+    return;
+  memcpy(ctx->shrdstr_buff + ctx->shrdstr_len, s, len);
+  ctx->shrdstr_len += len;
+}
+
+static inline void shared_end(XLSXCtx *ctx)
+{
+  if (ctx->failed || grow_int(ctx, XLSX_MEM_SST, (void **) &ctx->shrdstr_offs, &ctx->shrdstr_cnt, ctx->shrdstr_num + 2, sizeof(int)))
+    return;
+  if (ctx->shrdstr_len > 0x7fffffff) {
+    ctx->failed = 1;
+    snprintf(ctx->errmsg, sizeof(ctx->errmsg), "Shared strings larger than 2 GB");
+    return;
+  }
+  ctx->shrdstr_offs[++ctx->shrdstr_num] = (int) ctx->shrdstr_len;
+}
+
+#if defined(CONFIG_EXPAT) || defined(CONFIG_MXML) || defined(CONFIG_PARSIFAL)
+static void shared_reserve(XLSXCtx *ctx, const char *unique_count)
+{
+  int n = atoi(unique_count);
+
+  if (n > 0)
+    grow_int(ctx, XLSX_MEM_SST, (void **) &ctx->shrdstr_offs, &ctx->shrdstr_cnt, n + 1, sizeof(int));
+}
+#endif /* CONFIG_EXPAT || CONFIG_MXML || CONFIG_PARSIFAL */
+
+/*
+** Date and time output.
+** The number format of each style index is classified once while reading
+** xl/styles.xml, so that each cell only costs a lookup in ctx->styles[].
+** Serial numbers are converted to dates with integer arithmetic.
+*/
+
+#if defined(CONFIG_EXPAT) || defined(CONFIG_MXML) || defined(CONFIG_PARSIFAL)
+/*
+** Kind of the built-in number formats (numFmtId below 164).
+*/
+static uint8 builtin_numfmt(int id, uint8 *frac)
+{
+  *frac = 0;
+  if ((id >= 14) && (id <= 17))
+    return STYLE_DATE;
+  if ((id >= 18) && (id <= 21))
+    return STYLE_TIME;
+  if (id == 22)
+    return STYLE_DATETIME;
+  if ((id >= 27) && (id <= 36) && (id != 32) && (id != 33))
+    return STYLE_DATE;  /* East Asian dates */
+  if ((id == 32) || (id == 33) || (id == 45))
+    return STYLE_TIME;
+  if (id == 47) {
+    *frac = 1;          /* mm:ss.0 */
+    return STYLE_TIME;
+  }
+  if ((id >= 50) && (id <= 58))
+    return STYLE_DATE;  /* East Asian dates */
+  return STYLE_NUMBER;  /* 46, [h]:mm:ss, is an elapsed time */
+}
+
+/*
+** Kind of a custom number format, from its formatCode: it is a date if its
+** first section has y, m or d tokens, a time if it has h, m or s tokens.
+** Quoted text, escaped characters and [...] modifiers are skipped, and
+** elapsed times ([h], [m], [s]) are left as numbers.
+*/
+static uint8 custom_numfmt(const char *code, uint8 *frac)
+{
+  int date = 0, time = 0, month = 0;
+  char c;
+
+  *frac = 0;
+  for (; *code && (*code != ';'); code++) {
+    c = tolower(*(unsigned char *) code);
+    if (c == '"') {
+      for (code++; *code && (*code != '"'); code++)
+        ;
+      if (!*code)
+        break;
+    }
+    else if ((c == '\\') || (c == '_') || (c == '*')) {
+      if (!code[1])
+        break;
+      code++;
+    }
+    else if (c == '[') {
+      c = tolower(*(unsigned char *) (code + 1));
+      if ((c == 'h') || (c == 'm') || (c == 's'))
+        return STYLE_NUMBER;
+      for (; *code && (*code != ']'); code++)
+        ;
+      if (!*code)
+        break;
+    }
+    else if ((c == 'y') || (c == 'd'))
+      date = 1;
+    else if (c == 'm')
+      month = 1;
+    else if ((c == 'h') || (c == 's')) {
+      time = 1;
+      if ((c == 's') && (code[1] == '.'))
+        for (code += 2; *code == '0'; code++)
+          if (*frac < 9)
+            (*frac)++;
+    }
+  }
+  if (month && !time)
+    date = 1;  /* Without hours nor seconds, m is a month (the m of AM/PM comes with h) */
+  if (date && time)
+    return STYLE_DATETIME;
+  if (date)
+    return STYLE_DATE;
+  if (time)
+    return STYLE_TIME;
+  return STYLE_NUMBER;
+}
+
+static void styles_numfmt(XLSXCtx *ctx, const char *id, const char *code)
+{
+  XLSXNumFmt *fmt;
+
+  if (!id || !code)
+    return;
+  if (grow_int(ctx, XLSX_MEM_ROWS, (void **) &ctx->numfmts, &ctx->numfmts_cap, ctx->numfmts_num + 1, sizeof(XLSXNumFmt)))
+    return;
+  fmt = &ctx->numfmts[ctx->numfmts_num++];
+  fmt->id = atoi(id);
+  fmt->kind = custom_numfmt(code, &fmt->frac);
+}
+
+static void styles_xf(XLSXCtx *ctx, const char *numfmtid)
+{
+  XLSXNumFmt *fmt;
+  int i, id;
+
+  if (grow_int(ctx, XLSX_MEM_ROWS, (void **) &ctx->styles, &ctx->styles_cap, ctx->styles_num + 1, sizeof(XLSXNumFmt)))
+    return;
+  fmt = &ctx->styles[ctx->styles_num++];
+  id = numfmtid ? atoi(numfmtid) : 0;
+  fmt->id = id;
+  fmt->kind = builtin_numfmt(id, &fmt->frac);
+  for (i = 0; i < ctx->numfmts_num; i++)
+    if (ctx->numfmts[i].id == id) {
+      *fmt = ctx->numfmts[i];
+      break;
+    }
+}
+#endif /* CONFIG_EXPAT || CONFIG_MXML || CONFIG_PARSIFAL */
+
+/*
+** Convert a number of days since 1970-01-01 into a date of the proleptic
+** Gregorian calendar (civil_from_days() by Howard Hinnant).
+*/
+static inline void civil_from_days(long long z, int *y, int *m, int *d)
+{
+  long long era;
+  unsigned doe, yoe, doy, mp;
+
+  z += 719468;
+  era = (z >= 0 ? z : z - 146096) / 146097;
+  doe = (unsigned) (z - era * 146097);                    /* [0, 146096] */
+  yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;  /* [0, 399] */
+  doy = doe - (365*yoe + yoe/4 - yoe/100);                /* [0, 365] */
+  mp = (5*doy + 2) / 153;                                 /* [0, 11] */
+  *d = doy - (153*mp + 2)/5 + 1;                          /* [1, 31] */
+  *m = mp < 10 ? mp + 3 : mp - 9;                         /* [1, 12] */
+  *y = (int) (yoe + era * 400) + (*m <= 2);
+}
+
+int xlsx_format_date(XLSXCtx *ctx, const XLSXCell *cell, char *dst)
+{
+  static const long long pow10[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+  const XLSXNumFmt *fmt;
+  long long scale, units, days, secs;
+  double serial;
+  char num[64], *end;
+  int y, m, d, n;
+
+  if ((cell->style < 0) || (cell->style >= ctx->styles_num) || (cell->len <= 0) || (cell->len >= (int) sizeof(num)))
+    return 0;
+  fmt = &ctx->styles[cell->style];
+  if (fmt->kind == STYLE_NUMBER)
+    return 0;
+  memcpy(num, cell->ptr, cell->len);
+  num[cell->len] = 0;
+  serial = strtod(num, &end);
+  if (*end || (serial < 0) || (serial > 2958466))  /* 9999-12-31 */
+    return 0;
+  scale = pow10[fmt->frac];
+  units = (long long) (serial * 86400.0 * scale + 0.5);
+  days = units / (86400 * scale);
+  units -= days * 86400 * scale;
+  n = 0;
+  if (fmt->kind != STYLE_TIME) {
+    if (ctx->date1904)
+      days -= 24107;       /* 1904-01-01 is day 0 */
+    else if (days < 61)
+      days -= 25568;       /* 1899-12-31 is day 0 before the fictitious 1900-02-29 */
+    else
+      days -= 25569;       /* 1899-12-30 is day 0 after it */
+    civil_from_days(days, &y, &m, &d);
+    n = sprintf(dst, "%04d-%02d-%02d", y, m, d);
+    if (fmt->kind == STYLE_DATE)
+      return n;
+    dst[n++] = 'T';
+  }
+  secs = units / scale;
+  n += sprintf(dst + n, "%02d:%02d:%02d", (int) (secs / 3600), (int) (secs / 60 % 60), (int) (secs % 60));
+  if (fmt->frac)
+    n += sprintf(dst + n, ".%0*lld", fmt->frac, units % scale);
+  return n;
+}
+
+/*
+** Building of rows, common to all XML backends.
+** The text of the values is collected into row_buff, and the cells point
+** into it (or into the shared strings) once the value is complete.
+*/
+static inline void sheet_row_start(XLSXCtx *ctx, const char *r, const char *spans)
+{
+  const char *colon;
+
+  ctx->row.row = r ? atoi(r) : ctx->row.row + 1;
+  // spans is a list of ranges such as "1:6" or "1:3 5:8", the last one ends the widest
+  ctx->row.span = (spans && (colon = strrchr(spans, ':'))) ? atoi(colon + 1) : 0;
+  ctx->row.num_cells = 0;
+  ctx->row_len = 0;
+  ctx->current_col = 0;
+}
+
+/*
+** Type of a cell from its t attribute, told apart by its first characters:
+** n, s, str, inlineStr, b and e (d, a date in ISO 8601, is left as text)
+*/
+static inline int cell_type(const char *t)
+{
+  if (!t)
+    return XLSX_CELL_NUMBER;
+  switch (*t) {
+    case 'n': return XLSX_CELL_NUMBER;
+    case 's': return (t[1] == '\0') ? XLSX_CELL_SHARED : XLSX_CELL_STRING;
+    case 'i': return XLSX_CELL_INLINE;
+    case 'b': return XLSX_CELL_BOOL;
+    case 'e': return XLSX_CELL_ERROR;
+  }
+  return XLSX_CELL_STRING;
+}
+
+static inline void sheet_cell_start(XLSXCtx *ctx, const char *r, const char *t, const char *s)
+{
+  int row;
+
+  if (r)
+    excelcolrow(r, &(ctx->current_col), &row);
+  else
+    ctx->current_col++;
+  ctx->in_is = ctx->in_rph = 0;
+  ctx->cell_type = cell_type(t);
+  ctx->cell_style = s ? atoi(s) : 0;
+  if ((ctx->cell_type == XLSX_CELL_NUMBER) && (ctx->cell_style >= 0) && (ctx->cell_style < ctx->styles_num) &&
+      (ctx->styles[ctx->cell_style].kind != STYLE_NUMBER))
+    ctx->cell_type = XLSX_CELL_DATE;
+}
+
+/*
+** Append text to the value being collected. When row_buff moves, the
+** cells already pointing into it are moved along.
+*/
+static inline void sheet_value_append(XLSXCtx *ctx, const char *s, int len)
+{
+  char *old, *p;
+  size_t cap;
+  int i;
+
+  if (ctx->row_len + len > ctx->row_cap) {
+    if (ctx->failed)
+      return;
+    old = ctx->row_buff;
+    cap = ctx->row_cap;
+    p = NULL;
+    if (grow(ctx, XLSX_MEM_ROWS, (void **) &p, &cap, ctx->row_len + len, 1))
+      return;
+    memcpy(p, old, ctx->row_len);
+    for (i = 0; i < ctx->row.num_cells; i++)
+      if ((ctx->row.cells[i].ptr >= old) && (ctx->row.cells[i].ptr <= old + ctx->row_len))
+        ctx->row.cells[i].ptr = p + (ctx->row.cells[i].ptr - old);
+    free(old);
+    ctx->row_buff = p;
+    ctx->row_cap = cap;
+  }
+  memcpy(ctx->row_buff + ctx->row_len, s, len);
+  ctx->row_len += len;
+}
+
+static inline void sheet_value_start(XLSXCtx *ctx)
+{
+  ctx->value_start = ctx->row_len;
+  ctx->collect = COLLECT_VALUE;
+}
+
+static inline void sheet_value_end(XLSXCtx *ctx)
+{
+  XLSXCell *cell;
+  const char *p, *end;
+  int n;
+
+  ctx->collect = COLLECT_NONE;
+  if (ctx->failed || grow_int(ctx, XLSX_MEM_ROWS, (void **) &ctx->row.cells, &ctx->cells_cap, ctx->row.num_cells + 1, sizeof(XLSXCell)))
+    return;
+  cell = &ctx->row.cells[ctx->row.num_cells++];
+  cell->type = ctx->cell_type;
+  cell->col = ctx->current_col;
+  cell->style = ctx->cell_style;
+  cell->index = 0;
+  p = ctx->row_buff + ctx->value_start;
+  end = ctx->row_buff + ctx->row_len;
+  if (ctx->cell_type == XLSX_CELL_SHARED) {
+    for (n = 0; (p < end) && isdigit((unsigned char) *p); p++)
+      n = n * 10 + (*p - '0');
+    ctx->row_len = ctx->value_start;
+    cell->index = n;
+    if (n < ctx->shrdstr_num) {
+      cell->ptr = ctx->shrdstr_buff + ctx->shrdstr_offs[n];
+      cell->len = ctx->shrdstr_offs[n + 1] - ctx->shrdstr_offs[n];
+    }
+    else {
+      cell->ptr = "";
+      cell->len = 0;
+    }
+  }
+  else {
+    cell->ptr = p;
+    cell->len = (int) (end - p);
+  }
+}
+
+/*
+** Inline strings (t="inlineStr"), <is><t>text</t></is>, or runs of rich text
+** <is><r><t>text</t></r>...</is>: the text of every <t> but those of the
+** phonetic runs <rPh> is collected as the value, as that of a <v>.
+*/
+static inline void sheet_inline_start(XLSXCtx *ctx)
+{
+  sheet_value_start(ctx);
+  ctx->collect = COLLECT_NONE;
+  ctx->in_is = 1;
+}
+
+static inline void sheet_inline_open(XLSXCtx *ctx, const char *el)
+{
+  if (!strcmp(el, "rPh"))
+    ctx->in_rph = 1;
+  else if ((*el == 't') && (el[1] == '\0') && !ctx->in_rph)
+    ctx->collect = COLLECT_VALUE;
+}
+
+static inline void sheet_inline_close(XLSXCtx *ctx, const char *el)
+{
+  if (!strcmp(el, "rPh"))
+    ctx->in_rph = 0;
+  else if ((*el == 't') && (el[1] == '\0'))
+    ctx->collect = COLLECT_NONE;
+}
+
+static inline void sheet_inline_end(XLSXCtx *ctx)
+{
+  ctx->in_is = 0;
+  sheet_value_end(ctx);
+}
+
+static inline void sheet_value(XLSXCtx *ctx, const char *s)
+{
+  sheet_value_start(ctx);
+  sheet_value_append(ctx, s, strlen(s));
+  sheet_value_end(ctx);
+}
+
+static inline void sheet_row_end(XLSXCtx *ctx)
+{
+  if (ctx->failed)
+    return;
+  if (ctx->row_cb)
+    ctx->row_cb(ctx->row_data, &ctx->row);
+#ifdef CONFIG_EXPAT
+  else
+    XML_StopParser(ctx->parser, XML_TRUE);
+#endif /* CONFIG_EXPAT */
+}
+
+#ifdef CONFIG_EXPAT
+static void XMLCALL StartSharedStrings(void *data, const char *el, const char **attr)
+{
+  int i;
+  XLSXCtx *ctx = data;
+
+  if ((ctx->xml_depth == 0) && (!strcmp(el, "sst"))) {
+    for (i = 0; attr[i]; i += 2) {
+      if (!strcmp(attr[i], "uniqueCount")) {
+        //fprintf(stderr, " %s='%s'\n", attr[i], attr[i + 1]);
+        shared_reserve(ctx, attr[i + 1]);
+      }
+    }
+  }
+  if ((ctx->xml_depth == 2) && (!strcmp(el, "rPh")))
+    ctx->in_rph = 1;
+  if (((ctx->xml_depth == 2)||(ctx->xml_depth == 3)) && (!strcmp(el, "t")) && !ctx->in_rph)
+    ctx->collect = COLLECT_SHARED;
+  ctx->xml_depth++;
+}
+
+static void XMLCALL EndSharedStrings(void *data, const char *el)
+{
+  XLSXCtx *ctx = data;
+
+  ctx->xml_depth--;
+  // "t" at depth 3 are due to multiple styles in cell, and then the substrings are concatenated
+  if (((ctx->xml_depth == 2)||(ctx->xml_depth == 3)) && (!strcmp(el, "t")))
+    ctx->collect = COLLECT_NONE;
+  if ((ctx->xml_depth == 2) && (!strcmp(el, "rPh")))
+    ctx->in_rph = 0;
+  if ((ctx->xml_depth == 1) && (!strcmp(el, "si")))
+    shared_end(ctx);
+}
+
+static void XMLCALL ChrHndlr(void *data, const char *s, int len)
+{
+  XLSXCtx *ctx = data;
+
+  if (ctx->collect == COLLECT_VALUE)
+    sheet_value_append(ctx, s, len);
+  else if (ctx->collect == COLLECT_SHARED)
+    shared_append(ctx, s, len);
+}
+
+static void XMLCALL StartStyles(void *data, const char *el, const char **attr)
+{
+  int i;
+  const char *id, *code;
+  XLSXCtx *ctx = data;
+
+  if (ctx->xml_depth == 1)
+    ctx->in_cellxfs = !strcmp(el, "cellXfs");
+  if ((ctx->xml_depth == 2) && (!strcmp(el, "numFmt") || (ctx->in_cellxfs && !strcmp(el, "xf")))) {
+    id = code = NULL;
+    for (i = 0; attr[i]; i += 2) {
+      if (!strcmp(attr[i], "numFmtId"))
+        id = attr[i + 1];
+      else if (!strcmp(attr[i], "formatCode"))
+        code = attr[i + 1];
+    }
+    if (*el == 'n')
+      styles_numfmt(ctx, id, code);
+    else
+      styles_xf(ctx, id);
+  }
+  ctx->xml_depth++;
+}
+
+static void XMLCALL StartWorkbook(void *data, const char *el, const char **attr)
+{
+  int i;
+  XLSXCtx *ctx = data;
+
+  if ((ctx->xml_depth == 1) && (!strcmp(el, "workbookPr"))) {
+    for (i = 0; attr[i]; i += 2) {
+      if (!strcmp(attr[i], "date1904"))
+        ctx->date1904 = (*attr[i + 1] == '1') || (*attr[i + 1] == 't');
+    }
+  }
+  ctx->xml_depth++;
+}
+
+static void XMLCALL EndElement(void *data, const char *el)
+{
+  XLSXCtx *ctx = data;
+
+  (void) el;
+  ctx->xml_depth--;
+}
+
+static void XMLCALL StartSheet(void *data, const char *el, const char **attr)
+{
+  int i;
+  const char *r, *t, *s;
+  XLSXCtx *ctx = data;
+
+  if ((ctx->xml_depth == 1) && (!strcmp(el, "dimension"))) {
+    for (i = 0; attr[i]; i += 2) {
+      if (!strcmp(attr[i], "ref")) {
+        //fprintf(stderr, "dimension %s='%s'\n", attr[i], attr[i + 1]);
+        rangecolrow(attr[i + 1], &(ctx->sheet_num_cols), &(ctx->sheet_num_rows));
+        //fprintf(stderr, "cols: %d  rows: %d\n", ctx->sheet_num_cols, ctx->sheet_num_rows);
+      }
+    }
+  }
+  if ((ctx->xml_depth == 2) && (!strcmp(el, "row"))) {
+    r = s = NULL;
+    for (i = 0; attr[i]; i += 2) {
+      // (!strcmp(attr[i], "r")
+      if ((*attr[i] == 'r') && attr[i][1] == '\0')
+        r = attr[i + 1];
+      else if (!strcmp(attr[i], "spans"))
+        s = attr[i + 1];
+    }
+    sheet_row_start(ctx, r, s);
+  }
+  if ((ctx->xml_depth == 3) && (!strcmp(el, "c"))) {
+    r = t = s = NULL;
+    for (i = 0; attr[i]; i += 2) {
+      if (attr[i][1] == '\0') {
+        if (*attr[i] == 'r')
+          r = attr[i + 1];
+        else if (*attr[i] == 't')
+          t = attr[i + 1];
+        else if (*attr[i] == 's')
+          s = attr[i + 1];
+      }
+    }
+    sheet_cell_start(ctx, r, t, s);
+  }
+  if ((ctx->xml_depth == 4) && (*el == 'v') && (el[1] == '\0'))
+    sheet_value_start(ctx);
+  else if ((ctx->xml_depth == 4) && !strcmp(el, "is"))
+    sheet_inline_start(ctx);
+  else if (ctx->in_is)
+    sheet_inline_open(ctx, el);
+  ctx->xml_depth++;
+}
+
+static void XMLCALL EndSheet(void *data, const char *el)
+{
+  XLSXCtx *ctx = data;
+
+  ctx->xml_depth--;
+  if ((ctx->xml_depth == 4) && (*el == 'v') && (el[1] == '\0'))
+    sheet_value_end(ctx);
+  else if ((ctx->xml_depth == 4) && ctx->in_is)
+    sheet_inline_end(ctx);
+  else if (ctx->in_is)
+    sheet_inline_close(ctx, el);
+  if ((ctx->xml_depth == 2) && (!strcmp(el, "row")))
+    sheet_row_end(ctx);
+}
+#endif /* CONFIG_EXPAT */
+
+#ifdef CONFIG_MXML
+static void SharedStrings(mxml_node_t *node, mxml_sax_event_t event, void *data)
+{
+  const char *el, *uniqueCount;
+  XLSXCtx *ctx = data;
+
+  if (event == MXML_SAX_ELEMENT_OPEN) {
+    el = mxmlGetElement(node);
+    if (ctx->xml_depth == 0) {
+      if (!strcmp(el, "sst")) {
+        uniqueCount = mxmlElementGetAttr(node, "uniqueCount");
+        if (uniqueCount) {
+          //fprintf(stderr, " uniqueCount='%s'\n", uniqueCount);
+          shared_reserve(ctx, uniqueCount);
+        }
+      }
+    }
+    if ((ctx->xml_depth == 2) && (!strcmp(el, "rPh")))
+      ctx->in_rph = 1;
+    ctx->xml_depth++;
+    //fprintf(stderr, "shared strings '%s' %d\n", el, ctx->xml_depth);
+  }
+  else if (event == MXML_SAX_DATA) {
+    // "t" at depth 4 are due to multiple styles in cell, and then the substrings are concatenated
+    if (((ctx->xml_depth == 3) || (ctx->xml_depth == 4)) && !ctx->in_rph) {
+      el = mxmlGetElement(mxmlGetParent(node));
+      if (!strcmp(el, "t")) {
+        //fprintf(stderr, " shrStr[%d]='%s'\n", ctx->shrdstr_num, mxmlGetOpaque(node));
+        shared_append(ctx, mxmlGetOpaque(node), strlen(mxmlGetOpaque(node)));
+      }
+    }
+  }
+  else if (event == MXML_SAX_ELEMENT_CLOSE) {
+    ctx->xml_depth--;
+    el = mxmlGetElement(node);
+    if ((ctx->xml_depth == 2) && (!strcmp(el, "rPh")))
+      ctx->in_rph = 0;
+    if ((ctx->xml_depth == 1) && (!strcmp(el, "si")))
+      shared_end(ctx);
+  }
+}
+
+static void Styles(mxml_node_t *node, mxml_sax_event_t event, void *data)
+{
+  const char *el;
+  XLSXCtx *ctx = data;
+
+  if (event == MXML_SAX_ELEMENT_OPEN) {
+    el = mxmlGetElement(node);
+    if (ctx->xml_depth == 1)
+      ctx->in_cellxfs = !strcmp(el, "cellXfs");
+    if ((ctx->xml_depth == 2) && (!strcmp(el, "numFmt")))
+      styles_numfmt(ctx, mxmlElementGetAttr(node, "numFmtId"), mxmlElementGetAttr(node, "formatCode"));
+    if ((ctx->xml_depth == 2) && ctx->in_cellxfs && (!strcmp(el, "xf")))
+      styles_xf(ctx, mxmlElementGetAttr(node, "numFmtId"));
+    ctx->xml_depth++;
+  }
+  else if (event == MXML_SAX_ELEMENT_CLOSE) {
+    ctx->xml_depth--;
+  }
+}
+
+static void Workbook(mxml_node_t *node, mxml_sax_event_t event, void *data)
+{
+  const char *date1904;
+  XLSXCtx *ctx = data;
+
+  if (event == MXML_SAX_ELEMENT_OPEN) {
+    if ((ctx->xml_depth == 1) && (!strcmp(mxmlGetElement(node), "workbookPr"))) {
+      date1904 = mxmlElementGetAttr(node, "date1904");
+      if (date1904)
+        ctx->date1904 = (*date1904 == '1') || (*date1904 == 't');
+    }
+    ctx->xml_depth++;
+  }
+  else if (event == MXML_SAX_ELEMENT_CLOSE) {
+    ctx->xml_depth--;
+  }
+}
+
+static void Sheet(mxml_node_t *node, mxml_sax_event_t event, void *data)
+{
+  const char *el, *ref, *text;
+  XLSXCtx *ctx = data;
+
+  if (event == MXML_SAX_ELEMENT_OPEN) {
+    el = mxmlGetElement(node);
+    if ((ctx->xml_depth == 1) && (!strcmp(el, "dimension"))) {
+      ref = mxmlElementGetAttr(node, "ref");
+      if (ref) {
+        rangecolrow(ref, &(ctx->sheet_num_cols), &(ctx->sheet_num_rows));
+        //fprintf(stderr, " dimension ref='%s'\n", ref);
+        //fprintf(stderr, "cols: %d  rows: %d\n", ctx->sheet_num_cols, ctx->sheet_num_rows);
+      }
+    }
+    if ((ctx->xml_depth == 2) && (!strcmp(el, "row"))) {
+      sheet_row_start(ctx, mxmlElementGetAttr(node, "r"), mxmlElementGetAttr(node, "spans"));
+    }
+    if ((ctx->xml_depth == 3) && (!strcmp(el, "c"))) {
+      sheet_cell_start(ctx, mxmlElementGetAttr(node, "r"), mxmlElementGetAttr(node, "t"), mxmlElementGetAttr(node, "s"));
+    }
+    if ((ctx->xml_depth == 4) && (!strcmp(el, "is")))
+      sheet_inline_start(ctx);
+    else if (ctx->in_is)
+      sheet_inline_open(ctx, el);
+    ctx->xml_depth++;
+  }
+  else if (event == MXML_SAX_DATA) {
+    if (ctx->xml_depth == 5) {
+      el = mxmlGetElement(mxmlGetParent(node));
+      if (!strcmp(el, "v")) {
+        //fprintf(stderr, "v %s\n", mxmlGetOpaque(node));
+        sheet_value(ctx, mxmlGetOpaque(node));
+      }
+    }
+    // Text of the <t> of an inline string, at depth 6 or 7
+    if ((ctx->collect == COLLECT_VALUE) && (text = mxmlGetOpaque(node)))
+      sheet_value_append(ctx, text, strlen(text));
+  }
+  else if (event == MXML_SAX_ELEMENT_CLOSE) {
+    ctx->xml_depth--;
+    if (ctx->in_is) {
+      if (ctx->xml_depth == 4)
+        sheet_inline_end(ctx);
+      else
+        sheet_inline_close(ctx, mxmlGetElement(node));
+    }
+    if (ctx->xml_depth == 2) {
+      el = mxmlGetElement(node);
+      if (!strcmp(el, "row")) {
+        sheet_row_end(ctx);
+      }
+    }
+  }
+}
+#endif /* CONFIG_MXML */
+
+#ifdef CONFIG_PARSIFAL
+int StartSharedStrings(void *data, const XMLCH *uri, const XMLCH *localName, const XMLCH *el, LPXMLVECTOR atts)
+{
+  int i;
+  LPXMLRUNTIMEATT att;
+  XLSXCtx *ctx = data;
+
+  if ((ctx->xml_depth == 0) && (!strcmp(el, "sst"))) {
+    for (i = 0; i<atts->length; i++) {
+      att = (LPXMLRUNTIMEATT) XMLVector_Get(atts, i);
+      if (!strcmp(att->qname, "uniqueCount")) {
+        //fprintf(stderr, " %s='%s'\n", att->qname, att->value);
+        shared_reserve(ctx, att->value);
+      }
+    }
+  }
+  if ((ctx->xml_depth == 2) && (!strcmp(el, "rPh")))
+    ctx->in_rph = 1;
+  if (((ctx->xml_depth == 2)||(ctx->xml_depth == 3)) && (!strcmp(el, "t")) && !ctx->in_rph)
+    ctx->collect = COLLECT_SHARED;
+  ctx->xml_depth++;
+  return 0;
+}
+
+int EndSharedStrings(void *data, const XMLCH *uri, const XMLCH *localName, const XMLCH *el)
+{
+  XLSXCtx *ctx = data;
+
+  ctx->xml_depth--;
+  // "t" at depth 3 are due to multiple styles in cell, and then the substrings are concatenated
+  if (((ctx->xml_depth == 2)||(ctx->xml_depth == 3)) && (!strcmp(el, "t")))
+    ctx->collect = COLLECT_NONE;
+  if ((ctx->xml_depth == 2) && (!strcmp(el, "rPh")))
+    ctx->in_rph = 0;
+  if ((ctx->xml_depth == 1) && (!strcmp(el, "si")))
+    shared_end(ctx);
+  return 0;
+}
+
+int ChrHndlr(void *data, const XMLCH *s, int len)
+{
+  XLSXCtx *ctx = data;
+
+  if (ctx->collect == COLLECT_VALUE)
+    sheet_value_append(ctx, (const char *) s, len);
+  else if (ctx->collect == COLLECT_SHARED)
+    shared_append(ctx, (const char *) s, len);
+  return 0;
+}
+
+int StartStyles(void *data, const XMLCH *uri, const XMLCH *localName, const XMLCH *el, LPXMLVECTOR atts)
+{
+  int i;
+  const XMLCH *id, *code;
+  LPXMLRUNTIMEATT att;
+  XLSXCtx *ctx = data;
+
+  if (ctx->xml_depth == 1)
+    ctx->in_cellxfs = !strcmp(el, "cellXfs");
+  if ((ctx->xml_depth == 2) && (!strcmp(el, "numFmt") || (ctx->in_cellxfs && !strcmp(el, "xf")))) {
+    id = code = NULL;
+    for (i = 0; i<atts->length; i++) {
+      att = (LPXMLRUNTIMEATT) XMLVector_Get(atts, i);
+      if (!strcmp(att->qname, "numFmtId"))
+        id = att->value;
+      else if (!strcmp(att->qname, "formatCode"))
+        code = att->value;
+    }
+    if (*el == 'n')
+      styles_numfmt(ctx, id, code);
+    else
+      styles_xf(ctx, id);
+  }
+  ctx->xml_depth++;
+  return 0;
+}
+
+int StartWorkbook(void *data, const XMLCH *uri, const XMLCH *localName, const XMLCH *el, LPXMLVECTOR atts)
+{
+  int i;
+  LPXMLRUNTIMEATT att;
+  XLSXCtx *ctx = data;
+
+  if ((ctx->xml_depth == 1) && (!strcmp(el, "workbookPr"))) {
+    for (i = 0; i<atts->length; i++) {
+      att = (LPXMLRUNTIMEATT) XMLVector_Get(atts, i);
+      if (!strcmp(att->qname, "date1904"))
+        ctx->date1904 = (*(att->value) == '1') || (*(att->value) == 't');
+    }
+  }
+  ctx->xml_depth++;
+  return 0;
+}
+
+int EndElement(void *data, const XMLCH *uri, const XMLCH *localName, const XMLCH *el)
+{
+  XLSXCtx *ctx = data;
+
+  ctx->xml_depth--;
+  return 0;
+}
+
+int StartSheet(void *data, const XMLCH *uri, const XMLCH *localName, const XMLCH *el, LPXMLVECTOR atts)
+{
+  int i;
+  const XMLCH *r, *t, *s;
+  LPXMLRUNTIMEATT att;
+  XLSXCtx *ctx = data;
+
+  if ((ctx->xml_depth == 1) && (!strcmp(el, "dimension"))) {
+    for (i = 0; i<atts->length; i++) {
+      att = (LPXMLRUNTIMEATT) XMLVector_Get(atts, i);
+      if (!strcmp(att->qname, "ref")) {
+        //fprintf(stderr, "dimension %s='%s'\n", att->qname, att->value);
+        rangecolrow((const char *) att->value, &(ctx->sheet_num_cols), &(ctx->sheet_num_rows));
+        //fprintf(stderr, "cols: %d  rows: %d\n", ctx->sheet_num_cols, ctx->sheet_num_rows);
+      }
+    }
+  }
+  if ((ctx->xml_depth == 2) && (!strcmp(el, "row"))) {
+    r = s = NULL;
+    for (i = 0; i<atts->length; i++) {
+      att = (LPXMLRUNTIMEATT) XMLVector_Get(atts, i);
+      if (!strcmp(att->qname, "r"))
+        r = att->value;
+      else if (!strcmp(att->qname, "spans"))
+        s = att->value;
+    }
+    sheet_row_start(ctx, (const char *) r, (const char *) s);
+  }
+  if ((ctx->xml_depth == 3) && (!strcmp(el, "c"))) {
+    r = t = s = NULL;
+    for (i = 0; i<atts->length; i++) {
+      att = (LPXMLRUNTIMEATT) XMLVector_Get(atts, i);
+      if (!strcmp(att->qname, "r"))
+        r = att->value;
+      else if (!strcmp(att->qname, "t"))
+        t = att->value;
+      else if (!strcmp(att->qname, "s"))
+        s = att->value;
+    }
+    sheet_cell_start(ctx, (const char *) r, (const char *) t, (const char *) s);
+  }
+  if ((ctx->xml_depth == 4) && (*el == 'v') && (el[1] == '\0'))
+    sheet_value_start(ctx);
+  else if ((ctx->xml_depth == 4) && !strcmp(el, "is"))
+    sheet_inline_start(ctx);
+  else if (ctx->in_is)
+    sheet_inline_open(ctx, el);
+  ctx->xml_depth++;
+  return 0;
+}
+
+int EndSheet(void *data, const XMLCH *uri, const XMLCH *localName, const XMLCH *el)
+{
+  XLSXCtx *ctx = data;
+
+  ctx->xml_depth--;
+  if ((ctx->xml_depth == 4) && (*el == 'v') && (el[1] == '\0'))
+    sheet_value_end(ctx);
+  else if ((ctx->xml_depth == 4) && ctx->in_is)
+    sheet_inline_end(ctx);
+  else if (ctx->in_is)
+    sheet_inline_close(ctx, el);
+  if ((ctx->xml_depth == 2) && (!strcmp(el, "row")))
+    sheet_row_end(ctx);
+  return 0;
+}
+
+int GetSheetBytes(BYTE *buf, int cBytes, int *cBytesActual, void *data)
+{
+  XLSXCtx *ctx = data;
+
+  //fprintf(stderr, "GetSheetBytes %p %d\n", ctx->sheet_cur_ptr, cBytes);
+  if ((ctx->sheet_end_ptr - ctx->sheet_cur_ptr) >= cBytes) {
+    memcpy(buf, ctx->sheet_cur_ptr, cBytes);
+    *cBytesActual = cBytes;
+    ctx->sheet_cur_ptr += cBytes;
+    return 0;
+  }
+  else {
+    *cBytesActual = ctx->sheet_end_ptr - ctx->sheet_cur_ptr;
+    memcpy(buf, ctx->sheet_cur_ptr, *cBytesActual);
+    ctx->sheet_cur_ptr = ctx->sheet_end_ptr;
+    return 1;
+  }
+}
+
+void ErrorHandler(LPXMLPARSER parser) {} /* dummy, only for switching ErrorString etc. on */
+#endif /* CONFIG_PARSIFAL */
+
+#ifdef CONFIG_EXPAT
+static const XML_StartElementHandler part_start[] = { StartSharedStrings, StartSheet, StartStyles, StartWorkbook };
+static const XML_EndElementHandler part_end[] = { EndSharedStrings, EndSheet, EndElement, EndElement };
+
+/*
+** Memory of the parser, accounted to the XLSXCtx being parsed on this thread.
+** Expat hands no user data to its allocator.
+*/
+static XLSX_THREAD_LOCAL XLSXCtx *expat_ctx;
+
+static void *expat_malloc(size_t size)
+{
+  return mem_alloc(expat_ctx, XLSX_MEM_PARSER, size);
+}
+
+static void *expat_realloc(void *ptr, size_t size)
+{
+  return mem_realloc(expat_ctx, XLSX_MEM_PARSER, ptr, size);
+}
+
+static void expat_free(void *ptr)
+{
+  mem_free(XLSX_MEM_PARSER, ptr);
+}
+
+static const XML_Memory_Handling_Suite expat_memsuite = { expat_malloc, expat_realloc, expat_free };
+
+/*
+** The parser of ctx, reset for part. It is created for the first part of
+** a workbook in its arena, reset for the next parts, keeping its buffers,
+** and freed with the arena by workbook_reset().
+*/
+static XML_Parser expat_create(XLSXCtx *ctx, int part)
+{
+  XML_Parser p;
+
+  expat_ctx = ctx;
+  if (ctx->parser && XML_ParserReset(ctx->parser, NULL))
+    p = ctx->parser;
+  else {
+    if (ctx->parser)
+      XML_ParserFree(ctx->parser);
+    p = ctx->parser = XML_ParserCreate_MM(NULL, &expat_memsuite, NULL);
+  }
+  if (!p) {
+    snprintf(ctx->errmsg, sizeof(ctx->errmsg), "Couldn't allocate memory for parser");
+    return NULL;
+  }
+  XML_SetUserData(p, ctx);
+  XML_SetElementHandler(p, part_start[part], part_end[part]);
+  XML_SetCharacterDataHandler(p, ChrHndlr);
+  return p;
+}
+
+static int expat_error(XLSXCtx *ctx, XML_Parser p, int part)
+{
+  snprintf(ctx->errmsg, sizeof(ctx->errmsg), "%s parse error at line %" XML_FMT_INT_MOD "u:\n%s",
+           part_names[part],
+           XML_GetCurrentLineNumber(p),
+           XML_ErrorString(XML_GetErrorCode(p)));
+  return -1;
+}
+#endif /* CONFIG_EXPAT */
+#ifdef CONFIG_MXML
+static const mxml_sax_cb_t part_sax[] = { SharedStrings, Sheet, Styles, Workbook };
+#endif /* CONFIG_MXML */
+#ifdef CONFIG_PARSIFAL
+static const XML_START_ELEMENT_HANDLER part_start[] = { StartSharedStrings, StartSheet, StartStyles, StartWorkbook };
+static const XML_END_ELEMENT_HANDLER part_end[] = { EndSharedStrings, EndSheet, EndElement, EndElement };
+#endif /* CONFIG_PARSIFAL */
+
+/*
+** Parse a whole XML part of the workbook, already inflated into buf.
+** Returns 0 on success, -1 on failure.
+*/
+static int parse_part(XLSXCtx *ctx, int part, char *buf, size_t len)
+{
+#ifdef CONFIG_EXPAT
+  XML_Parser p;
+  int ret = 0;
+#endif /* CONFIG_EXPAT */
+#ifdef CONFIG_MXML
+  mxml_node_t *root_node;
+#endif /* CONFIG_MXML */
+#ifdef CONFIG_PARSIFAL
+  LPXMLPARSER parser;
+  int ret = 0;
+#endif /* CONFIG_PARSIFAL */
+#if !defined(CONFIG_EXPAT) && !defined(CONFIG_MXML) && !defined(CONFIG_PARSIFAL)
+  (void) part;
+  (void) buf;
+#endif
+#if !defined(CONFIG_EXPAT) && !defined(CONFIG_PARSIFAL)
+  (void) len;
+#endif
+
+  ctx->xml_depth = 0;
+  ctx->collect = COLLECT_NONE;
+#ifdef CONFIG_EXPAT
+  p = expat_create(ctx, part);
+  if (!p)
+    return -1;
+  if (XML_Parse(p, buf, len, -1) == XML_STATUS_ERROR)
+    ret = expat_error(ctx, p, part);
+  if (ret)
+    return ret;
+#endif /* CONFIG_EXPAT */
+#ifdef CONFIG_MXML
+  root_node = mxmlSAXLoadString(NULL, buf, MXML_OPAQUE_CALLBACK, part_sax[part], ctx);
+  if (root_node)
+    mxmlDelete(root_node);
+#endif /* CONFIG_MXML */
+#ifdef CONFIG_PARSIFAL
+  if (!XMLParser_Create(&parser)) {
+    snprintf(ctx->errmsg, sizeof(ctx->errmsg), "Error creating parser!");
+    return -1;
+  }
+  _XMLParser_SetFlag(parser, XMLFLAG_NAMESPACES, 0);
+  _XMLParser_SetFlag(parser, XMLFLAG_EXTERNAL_GENERAL_ENTITIES, 0);
+  _XMLParser_SetFlag(parser, XMLFLAG_PRESERVE_WS_ATTRIBUTES, -1);
+  parser->errorHandler = ErrorHandler;
+  parser->startElementHandler = part_start[part];
+  parser->endElementHandler = part_end[part];
+  parser->charactersHandler = ChrHndlr;
+  parser->UserData = ctx;
+  ctx->sheet_cur_ptr = (XMLCH *) buf;
+  ctx->sheet_end_ptr = (XMLCH *) buf + len;
+  if (!XMLParser_Parse(parser, GetSheetBytes, ctx, "UTF-8")) {
+    snprintf(ctx->errmsg, sizeof(ctx->errmsg), "%s Error: %s\nLine: %d Col: %d", part_names[part], parser->ErrorString, parser->ErrorLine, parser->ErrorColumn);
+    ret = -1;
+  }
+  XMLParser_Free(parser);
+  if (ret)
+    return ret;
+#endif /* CONFIG_PARSIFAL */
+  return ctx->failed ? -1 : 0;
+}
+
+/*
+** Read buffer of the inflater, allocated once
+*/
+static int zip_buff_alloc(XLSXCtx *ctx)
+{
+  if (ctx->zip_buff)
+    return 0;
+  if (!(ctx->zip_buff = malloc(MZ_ZIP_MAX_IO_BUF_SIZE))) {
+    snprintf(ctx->errmsg, sizeof(ctx->errmsg), "Out of memory");
+    return -1;
+  }
+  mem_count(ctx, XLSX_MEM_INFLATE, 0, MZ_ZIP_MAX_IO_BUF_SIZE);
+  return 0;
+}
+
+/*
+** Inflate a part of the workbook into sheet_ptr, NUL terminated. Both
+** sheet_ptr and the read buffer of the inflater are reused from part to part.
+** Returns NULL if the part does not exist.
+*/
+static char *extract_part(XLSXCtx *ctx, const char *name, size_t *size)
+{
+  mz_zip_archive_file_stat stat;
+  int index;
+
+  index = mz_zip_reader_locate_file(&ctx->zip, name, NULL, MZ_ZIP_FLAG_CASE_SENSITIVE);
+  if ((index < 0) || !mz_zip_reader_file_stat(&ctx->zip, index, &stat))
+    return NULL;
+  if (grow_buf(ctx, XLSX_MEM_INFLATE, &ctx->sheet_ptr, &ctx->sheet_cap, (size_t) stat.m_uncomp_size + 1, &ctx->sheet_huge) ||
+      zip_buff_alloc(ctx))
+    return NULL;
+  if (!mz_zip_reader_extract_to_mem_no_alloc(&ctx->zip, index, ctx->sheet_ptr, (size_t) stat.m_uncomp_size, 0,
+                                             ctx->zip_buff, MZ_ZIP_MAX_IO_BUF_SIZE))
+    return NULL;
+  ctx->sheet_ptr[stat.m_uncomp_size] = 0;
+  ctx->part_comp_size = stat.m_comp_size;
+  *size = (size_t) stat.m_uncomp_size;
+  return ctx->sheet_ptr;
+}
+
+#ifdef CONFIG_EXPAT
+/*
+** Open the part at index for stream_next(), which inflates it in pieces into
+** sheet_ptr, used as a ring of TINFL_LZ_DICT_SIZE bytes (the window of
+** deflate), as mz_zip_reader_extract_to_callback() does.
+** Returns 0 on success, -1 on failure.
+*/
+static int stream_open(XLSXCtx *ctx, mz_uint index, const mz_zip_archive_file_stat *st)
+{
+  mz_uint8 hdr[MZ_ZIP_LOCAL_DIR_HEADER_SIZE];
+  mz_uint64 ofs;
+
+  (void) index;
+  // Encrypted parts, and methods other than stored and deflate, are not supported
+  if ((st->m_bit_flag & (1 | 32)) || ((st->m_method != 0) && (st->m_method != MZ_DEFLATED)))
+    return -1;
+  ofs = st->m_local_header_ofs;
+  if ((ctx->zip.m_pRead(ctx->zip.m_pIO_opaque, ofs, hdr, sizeof(hdr)) != sizeof(hdr)) ||
+      (MZ_READ_LE32(hdr) != MZ_ZIP_LOCAL_DIR_HEADER_SIG))
+    return -1;
+  ofs += sizeof(hdr) + MZ_READ_LE16(hdr + MZ_ZIP_LDH_FILENAME_LEN_OFS) + MZ_READ_LE16(hdr + MZ_ZIP_LDH_EXTRA_LEN_OFS);
+  if (ofs + st->m_comp_size > ctx->zip.m_archive_size)
+    return -1;
+  if (grow_buf(ctx, XLSX_MEM_INFLATE, &ctx->sheet_ptr, &ctx->sheet_cap, TINFL_LZ_DICT_SIZE, &ctx->sheet_huge) ||
+      zip_buff_alloc(ctx))
+    return -1;
+  tinfl_init(&ctx->stream_inflator);
+  ctx->stream = 1;
+  ctx->stream_inflated = ctx->stream_done = 0;
+  ctx->stream_method = st->m_method;
+  ctx->stream_ofs = ofs;
+  ctx->stream_left = st->m_comp_size;
+  ctx->stream_in_len = 0;
+  ctx->stream_out = 0;
+  ctx->stream_crc = MZ_CRC32_INIT;
+  ctx->stream_crc_part = st->m_crc32;
+  return 0;
+}
+
+/*
+** Next piece of the streamed part, valid until the following call.
+** Returns 1 with a piece, 0 at the end of the part, -1 on failure.
+*/
+static int stream_next(XLSXCtx *ctx, const char **ptr, size_t *len)
+{
+  mz_uint8 *ring = (mz_uint8 *) ctx->sheet_ptr;
+  size_t n, in_len, out_len, pos;
+  tinfl_status status;
+
+  while (!ctx->stream_inflated) {
+    if (!ctx->stream_in_len && ctx->stream_left) {
+      if (ctx->zip.m_pState->m_pMem) {
+        n = (size_t) ctx->stream_left;
+        ctx->stream_in = (const mz_uint8 *) ctx->zip.m_pState->m_pMem + ctx->stream_ofs;
+      }
+      else {
+        n = (size_t) MZ_MIN(ctx->stream_left, MZ_ZIP_MAX_IO_BUF_SIZE);
+        if (ctx->zip.m_pRead(ctx->zip.m_pIO_opaque, ctx->stream_ofs, ctx->zip_buff, n) != n)
+          goto fail;
+        ctx->stream_in = ctx->zip_buff;
+      }
+      ctx->stream_ofs += n;
+      ctx->stream_left -= n;
+      ctx->stream_in_len = n;
+    }
+    if (!ctx->stream_method) {
+      // Stored: the data read is the part
+      *ptr = (const char *) ctx->stream_in;
+      *len = ctx->stream_in_len;
+      ctx->stream_in_len = 0;
+      ctx->stream_inflated = !ctx->stream_left;
+    }
+    else {
+      pos = (size_t) (ctx->stream_out & (TINFL_LZ_DICT_SIZE - 1));
+      in_len = ctx->stream_in_len;
+      out_len = TINFL_LZ_DICT_SIZE - pos;
+      status = tinfl_decompress(&ctx->stream_inflator, ctx->stream_in, &in_len, ring, ring + pos, &out_len,
+                                ctx->stream_left ? TINFL_FLAG_HAS_MORE_INPUT : 0);
+      ctx->stream_in += in_len;
+      ctx->stream_in_len -= in_len;
+      ctx->stream_out += out_len;
+      if ((status < TINFL_STATUS_DONE) || ((status == TINFL_STATUS_NEEDS_MORE_INPUT) && !ctx->stream_left))
+        goto fail;
+      ctx->stream_inflated = (status == TINFL_STATUS_DONE);
+      *ptr = (const char *) ring + pos;
+      *len = out_len;
+    }
+    ctx->stream_crc = (mz_uint32) mz_crc32(ctx->stream_crc, (const mz_uint8 *) *ptr, *len);
+    if (ctx->stream_inflated && (ctx->stream_crc != ctx->stream_crc_part))
+      goto fail;
+    if (*len)
+      return 1;
+  }
+  return 0;
+
+fail:
+  snprintf(ctx->errmsg, sizeof(ctx->errmsg), "%s: corrupt or unreadable data", part_names[PART_SHEET]);
+  return -1;
+}
+#endif /* CONFIG_EXPAT */
+
+/*
+** Extract and parse a part of the workbook. A missing part is not an error.
+*/
+static int load_part(XLSXCtx *ctx, int part, const char *name)
+{
+  XLSXTime t;
+  uint64_t start;
+  char *buf;
+  size_t size;
+  int ret;
+
+  stats_start(ctx, &t);
+  start = trace_now();
+  buf = extract_part(ctx, name, &size);
+  //fprintf(stderr, "%s size:%d\n", name, size);
+  if (!buf)
+    return 0;
+  trace_stop(part_inflate_span[part], start, size);
+  stats_stop(ctx, part_inflate_phase[part], &t, size);
+  stats_start(ctx, &t);
+  start = trace_now();
+  ret = parse_part(ctx, part, buf, size);
+  trace_stop(part_parse_span[part], start, size);
+  stats_stop(ctx, part_parse_phase[part], &t, size);
+  return ret;
+}
+
+static void sheet_close(XLSXCtx *ctx);
+
+/*
+** Close the workbook of ctx, keeping the capacity of its buffers.
+*/
+static void workbook_reset(XLSXCtx *ctx)
+{
+  int i;
+
+  sheet_close(ctx);
+  mz_zip_reader_end(&ctx->zip);
+  memset(&ctx->zip, 0, sizeof(ctx->zip));
+#ifdef CONFIG_EXPAT
+  // The parser lives in the arena, it is created again for the next workbook
+  if (ctx->parser)
+    XML_ParserFree(ctx->parser);
+  ctx->parser = NULL;
+#endif /* CONFIG_EXPAT */
+  arena_reset(ctx);
+  ctx->failed = 0;
+  ctx->errmsg[0] = 0;
+  ctx->shrdstr_len = 0;
+  ctx->shrdstr_num = 0;
+  ctx->in_rph = 0;
+  ctx->date1904 = 0;
+  ctx->styles_num = 0;
+  ctx->numfmts_num = 0;
+  ctx->in_cellxfs = 0;
+  memset(&ctx->stats, 0, sizeof(ctx->stats));
+  // Peaks and counts start again, from the buffers kept
+  for (i = 0; i < XLSX_MEMS; i++) {
+    ctx->memory.use[i].peak = ctx->memory.use[i].bytes;
+    ctx->memory.use[i].allocs = 0;
+  }
+  ctx->memory.total.peak = ctx->memory.total.bytes;
+  ctx->memory.total.allocs = 0;
+}
+
+/*
+** Read the shared strings, and styles when asked, of the zip just opened in ctx->zip
+*/
+static int workbook_load(XLSXCtx *ctx, int flags)
+{
+  // Process xl/sharedStrings.xml and load them into shrdstr_buff[]
+  // TODO: Only warn about missing xl/sharedStrings.xml is it referenced by some t="s"
+  if (grow_int(ctx, XLSX_MEM_SST, (void **) &ctx->shrdstr_offs, &ctx->shrdstr_cnt, 1, sizeof(int)) ||
+      load_part(ctx, PART_SHAREDSTRINGS, "xl/sharedStrings.xml"))
+    goto fail;
+  ctx->shrdstr_offs[0] = 0;
+  // Process xl/styles.xml and xl/workbook.xml to tell dates from numbers
+  if ((flags & XLSX_DATES) &&
+      (load_part(ctx, PART_STYLES, "xl/styles.xml") || load_part(ctx, PART_WORKBOOK, "xl/workbook.xml")))
+    goto fail;
+  return 0;
+
+fail:
+  mz_zip_reader_end(&ctx->zip);
+  memset(&ctx->zip, 0, sizeof(ctx->zip));
+  ctx->shrdstr_num = 0;
+  return -1;
+}
+
+int xlsx_reopen(XLSXCtx *ctx, const char *filename, int flags)
+{
+  XLSXTime t;
+  uint64_t start;
+
+  workbook_reset(ctx);
+  ctx->flags = flags;
+  ctx->zip.m_pAlloc = zip_alloc;
+  ctx->zip.m_pRealloc = zip_realloc;
+  ctx->zip.m_pFree = zip_free;
+  ctx->zip.m_pAlloc_opaque = ctx;
+  stats_start(ctx, &t);
+  start = trace_now();
+  if (!mz_zip_reader_init_file(&ctx->zip, filename, 0)) {
+    snprintf(ctx->errmsg, sizeof(ctx->errmsg), "Not a zip file");
+    return -1;
+  }
+  trace_stop("open", start, ctx->zip.m_archive_size);
+  stats_stop(ctx, XLSX_PHASE_OPEN, &t, ctx->zip.m_archive_size);
+  return workbook_load(ctx, flags);
+}
+
+int xlsx_reopen_mem(XLSXCtx *ctx, const void *buf, size_t size, int flags)
+{
+  XLSXTime t;
+  uint64_t start;
+
+  workbook_reset(ctx);
+  ctx->flags = flags;
+  ctx->zip.m_pAlloc = zip_alloc;
+  ctx->zip.m_pRealloc = zip_realloc;
+  ctx->zip.m_pFree = zip_free;
+  ctx->zip.m_pAlloc_opaque = ctx;
+  stats_start(ctx, &t);
+  start = trace_now();
+  if (!mz_zip_reader_init_mem(&ctx->zip, buf, size, 0)) {
+    snprintf(ctx->errmsg, sizeof(ctx->errmsg), "Not a zip file");
+    return -1;
+  }
+  trace_stop("open", start, ctx->zip.m_archive_size);
+  stats_stop(ctx, XLSX_PHASE_OPEN, &t, ctx->zip.m_archive_size);
+  return workbook_load(ctx, flags);
+}
+
+XLSXCtx *xlsx_open(const char *filename, int flags)
+{
+  XLSXCtx *ctx;
+
+  ctx = calloc(1, sizeof(XLSXCtx));
+  if (!ctx)
+    return NULL;
+  if (xlsx_reopen(ctx, filename, flags)) {
+    fprintf(stderr, "%s\n", ctx->errmsg);
+    xlsx_close(ctx);
+    return NULL;
+  }
+  return ctx;
+}
+
+XLSXCtx *xlsx_open_mem(const void *buf, size_t size, int flags)
+{
+  XLSXCtx *ctx;
+
+  ctx = calloc(1, sizeof(XLSXCtx));
+  if (!ctx)
+    return NULL;
+  if (xlsx_reopen_mem(ctx, buf, size, flags)) {
+    fprintf(stderr, "%s\n", ctx->errmsg);
+    xlsx_close(ctx);
+    return NULL;
+  }
+  return ctx;
+}
+
+static void arrow_reset(XLSXCtx *ctx)
+{
+  int i;
+
+  for (i = 0; ctx->arrow_names && (i < ctx->arrow_cols); i++)
+    free(ctx->arrow_names[i]);
+  free(ctx->arrow_names);
+  free(ctx->arrow_kinds);
+  ctx->arrow_names = NULL;
+  ctx->arrow_kinds = NULL;
+  ctx->arrow_cols = 0;
+  ctx->arrow_last_row = 0;
+  ctx->arrow_pending = NULL;
+}
+
+static void sheet_close(XLSXCtx *ctx)
+{
+  arrow_reset(ctx);
+#ifndef CONFIG_EXPAT
+  ctx->q_rows_num = ctx->q_cells_num = ctx->q_next = 0;
+  ctx->q_len = 0;
+#endif /* Not(CONFIG_EXPAT) */
+  ctx->sheet_size = 0;
+  ctx->stream = 0;
+  ctx->sheet_state = SHEET_NONE;
+}
+
+/*
+** Stream the sheet called name when it would not fit whole in the budget of
+** ctx. Returns 1 if it is streamed, 0 if it is to be inflated whole.
+*/
+static int sheet_stream(XLSXCtx *ctx, const char *name)
+{
+#ifdef CONFIG_EXPAT
+  mz_zip_archive_file_stat stat;
+  int index;
+
+  if (!ctx->max_memory)
+    return 0;
+  index = mz_zip_reader_locate_file(&ctx->zip, name, NULL, MZ_ZIP_FLAG_CASE_SENSITIVE);
+  if ((index < 0) || !mz_zip_reader_file_stat(&ctx->zip, index, &stat) ||
+      (ctx->memory.total.bytes + MZ_MAX(stat.m_uncomp_size + 1, ctx->sheet_cap) - ctx->sheet_cap <= ctx->max_memory) ||
+      stream_open(ctx, index, &stat))
+    return 0;
+  ctx->sheet_size = (size_t) stat.m_uncomp_size;
+  ctx->part_comp_size = stat.m_comp_size;
+  return 1;
+#else
+  (void) ctx;
+  (void) name;
+  return 0;
+#endif /* CONFIG_EXPAT */
+}
+
+int xlsx_sheet_open(XLSXCtx *ctx, int sheet_id)
+{
+  char sheetname[64];
+  XLSXTime t;
+  uint64_t start;
+
+  sheet_close(ctx);
+  ctx->errmsg[0] = 0;
+  // Process xl/worksheets/sheet1.xml
+  sprintf(sheetname, "xl/worksheets/sheet%d.xml", sheet_id);
+  stats_start(ctx, &t);
+  start = trace_now();
+  //fprintf(stderr, "%s size:%d\n", sheetname, ctx->sheet_size);
+  if (!sheet_stream(ctx, sheetname) && !extract_part(ctx, sheetname, &ctx->sheet_size)) {
+    snprintf(ctx->errmsg, sizeof(ctx->errmsg), "Error: could not read sheet number %d.", sheet_id);
+    return -1;
+  }
+  if (!ctx->stream)
+    trace_stop(part_inflate_span[PART_SHEET], start, ctx->sheet_size);
+  stats_stop(ctx, XLSX_PHASE_SHEET_INFLATE, &t, ctx->stream ? 0 : ctx->sheet_size);
+  ctx->sheet_state = SHEET_OPEN;
+  ctx->sheet_num_rows = ctx->sheet_num_cols = 0;
+  ctx->row.row = 0;
+  ctx->row.num_cells = 0;
+  ctx->row.span = 0;
+  return 0;
+}
+
+#ifdef CONFIG_EXPAT
+/*
+** Hand the pieces of the streamed sheet to the parser, as long as status, of
+** the previous XML_Parse() or XML_ResumeParser(), is XML_STATUS_OK. Returns
+** the last status, XML_STATUS_SUSPENDED when a row was read for xlsx_next_row().
+** Pieces are traced as parsed only when pushed, as xlsx_next_row() suspends
+** the parser in the middle of them.
+*/
+static enum XML_Status stream_parse(XLSXCtx *ctx, enum XML_Status status)
+{
+  const char *buf = NULL;
+  size_t len = 0;
+  uint64_t start;
+  int n;
+
+  while ((status == XML_STATUS_OK) && !ctx->stream_done) {
+    start = trace_now();
+    n = stream_next(ctx, &buf, &len);
+    if (n < 0)
+      return XML_STATUS_ERROR;
+    trace_stop(part_inflate_span[PART_SHEET], start, n ? len : 0);
+    ctx->stream_done = !n;
+    start = trace_now();
+    status = XML_Parse(ctx->parser, buf, n ? (int) len : 0, !n);
+    if (ctx->row_cb)
+      trace_stop(part_parse_span[PART_SHEET], start, n ? len : 0);
+  }
+  return status;
+}
+
+static int stream_rows(XLSXCtx *ctx)
+{
+  ctx->xml_depth = 0;
+  ctx->collect = COLLECT_NONE;
+  if (!expat_create(ctx, PART_SHEET))
+    return -1;
+  if (stream_parse(ctx, XML_STATUS_OK) == XML_STATUS_ERROR)
+    return ctx->errmsg[0] ? -1 : expat_error(ctx, ctx->parser, PART_SHEET);
+  return ctx->failed ? -1 : 0;
+}
+#endif /* CONFIG_EXPAT */
+
+int xlsx_sheet_rows(XLSXCtx *ctx, xlsx_row_cb cb, void *data)
+{
+  XLSXTime t;
+  uint64_t start;
+  int ret;
+
+  if (ctx->sheet_state != SHEET_OPEN) {
+    snprintf(ctx->errmsg, sizeof(ctx->errmsg), "No sheet open for reading");
+    return -1;
+  }
+  ctx->row_cb = cb;
+  ctx->row_data = data;
+  ctx->sheet_state = SHEET_PARSING;
+  stats_start(ctx, &t);
+  start = trace_now();
+#ifdef CONFIG_EXPAT
+  if (ctx->stream)
+    ret = stream_rows(ctx);
+  else
+#endif /* CONFIG_EXPAT */
+  ret = parse_part(ctx, PART_SHEET, ctx->sheet_ptr, ctx->sheet_size);
+  // A streamed sheet is traced piece by piece
+  if (!ctx->stream)
+    trace_stop(part_parse_span[PART_SHEET], start, ctx->sheet_size);
+  stats_stop(ctx, XLSX_PHASE_SHEET_PARSE, &t, ctx->sheet_size);
+  ctx->sheet_state = SHEET_DONE;
+  ctx->row_cb = NULL;
+  return ret;
+}
+
+#ifndef CONFIG_EXPAT
+/*
+** Backends that cannot suspend their parser queue all the rows of the
+** sheet, and xlsx_next_row() pops them.
+*/
+static void queue_row(void *data, const XLSXRow *row)
+{
+  XLSXCtx *ctx = data;
+  XLSXRow *q;
+  const XLSXCell *cell;
+  int i;
+
+  if (grow_int(ctx, XLSX_MEM_ROWS, (void **) &ctx->q_rows, &ctx->q_rows_cap, ctx->q_rows_num + 1, sizeof(XLSXRow)) ||
+      grow_int(ctx, XLSX_MEM_ROWS, (void **) &ctx->q_cells, &ctx->q_cells_cap, ctx->q_cells_num + row->num_cells, sizeof(XLSXCell)) ||
+      grow(ctx, XLSX_MEM_ROWS, (void **) &ctx->q_offs, &ctx->q_offs_cap, ctx->q_cells_num + row->num_cells, sizeof(size_t)))
+    return;
+  q = &ctx->q_rows[ctx->q_rows_num++];
+  q->row = row->row;
+  q->num_cells = row->num_cells;
+  q->cells = NULL;
+  q->span = row->span;
+  for (i = 0; i < row->num_cells; i++) {
+    cell = &row->cells[i];
+    ctx->q_cells[ctx->q_cells_num] = *cell;
+    if (cell->type == XLSX_CELL_SHARED)
+      ctx->q_offs[ctx->q_cells_num] = (size_t) -1;
+    else {
+      if (grow(ctx, XLSX_MEM_ROWS, (void **) &ctx->q_text, &ctx->q_cap, ctx->q_len + cell->len, 1))
+        return;
+      memcpy(ctx->q_text + ctx->q_len, cell->ptr, cell->len);
+      ctx->q_offs[ctx->q_cells_num] = ctx->q_len;
+      ctx->q_len += cell->len;
+    }
+    ctx->q_cells_num++;
+  }
+}
+#endif /* Not(CONFIG_EXPAT) */
+
+const XLSXRow *xlsx_next_row(XLSXCtx *ctx)
+{
+#ifdef CONFIG_EXPAT
+  enum XML_Status status;
+  XLSXTime t;
+
+  stats_start(ctx, &t);
+  if (ctx->sheet_state == SHEET_OPEN) {
+    ctx->row_cb = NULL;
+    ctx->xml_depth = 0;
+    ctx->collect = COLLECT_NONE;
+    if (!expat_create(ctx, PART_SHEET)) {
+      ctx->sheet_state = SHEET_DONE;
+      return NULL;
+    }
+    ctx->sheet_state = SHEET_PARSING;
+    if (ctx->stream)
+      status = stream_parse(ctx, XML_STATUS_OK);
+    else
+      status = XML_Parse(ctx->parser, ctx->sheet_ptr, ctx->sheet_size, -1);
+  }
+  else if (ctx->sheet_state == SHEET_PARSING) {
+    expat_ctx = ctx;
+    status = XML_ResumeParser(ctx->parser);
+    if (ctx->stream)
+      status = stream_parse(ctx, status);
+  }
+  else
+    return NULL;
+  // The size of the sheet is accounted once, when it has been parsed to the end
+  stats_stop(ctx, XLSX_PHASE_SHEET_PARSE, &t, (status == XML_STATUS_SUSPENDED) ? 0 : ctx->sheet_size);
+  if (status == XML_STATUS_SUSPENDED)
+    return &ctx->row;
+  if ((status == XML_STATUS_ERROR) && !ctx->errmsg[0])
+    expat_error(ctx, ctx->parser, PART_SHEET);
+  ctx->sheet_state = SHEET_DONE;
+  return NULL;
+#else
+  XLSXRow *q;
+  int i, first;
+
+  if (ctx->sheet_state == SHEET_OPEN) {
+    if (xlsx_sheet_rows(ctx, queue_row, ctx))
+      return NULL;
+    ctx->q_next = 0;
+  }
+  if (ctx->q_next >= ctx->q_rows_num)
+    return NULL;
+  // Cells of the queued rows are back to back in q_cells
+  for (first = 0, i = 0; i < ctx->q_next; i++)
+    first += ctx->q_rows[i].num_cells;
+  q = &ctx->q_rows[ctx->q_next++];
+  q->cells = ctx->q_cells + first;
+  for (i = 0; i < q->num_cells; i++)
+    if (ctx->q_offs[first + i] != (size_t) -1)
+      q->cells[i].ptr = ctx->q_text + ctx->q_offs[first + i];
+  return q;
+#endif /* CONFIG_EXPAT */
+}
+
+int xlsx_sheet_progress(XLSXCtx *ctx, XLSXProgress *progress)
+{
+#ifdef CONFIG_EXPAT
+  XML_Index index;
+#endif /* CONFIG_EXPAT */
+
+  memset(progress, 0, sizeof(XLSXProgress));
+  if (ctx->sheet_state == SHEET_NONE)
+    return -1;
+  progress->size = ctx->sheet_size;
+  progress->comp_size = progress->comp_read = ctx->part_comp_size;
+#ifdef CONFIG_EXPAT
+  if (ctx->stream)
+    progress->comp_read -= ctx->stream_left + ctx->stream_in_len;
+  if ((ctx->sheet_state == SHEET_PARSING) && ((index = XML_GetCurrentByteIndex(ctx->parser)) > 0))
+    progress->parsed = (uint64_t) index;
+#endif /* CONFIG_EXPAT */
+#ifdef CONFIG_PARSIFAL
+  // What Parsifal has read, a buffer ahead of what it has parsed
+  if (ctx->sheet_state == SHEET_PARSING)
+    progress->parsed = (const char *) ctx->sheet_cur_ptr - ctx->sheet_ptr;
+#endif /* CONFIG_PARSIFAL */
+  if (ctx->sheet_state == SHEET_DONE)
+    progress->parsed = progress->size;
+  return 0;
+}
+
+void xlsx_sheet_dimension(XLSXCtx *ctx, int *rows, int *cols)
+{
+  *rows = ctx->sheet_num_rows;
+  *cols = ctx->sheet_num_cols;
+}
+
+int xlsx_shared_count(XLSXCtx *ctx)
+{
+  return ctx->shrdstr_num;
+}
+
+const char *xlsx_shared_string(XLSXCtx *ctx, int index, int *len)
+{
+  if ((index < 0) || (index >= ctx->shrdstr_num)) {
+    *len = 0;
+    return NULL;
+  }
+  *len = ctx->shrdstr_offs[index + 1] - ctx->shrdstr_offs[index];
+  return ctx->shrdstr_buff + ctx->shrdstr_offs[index];
+}
+
+/*
+** Export to the Arrow C Data Interface.
+** The rows of a batch are first gathered as a list of cells, then laid out
+** column by column. Dictionary columns share one dictionary array, that
+** points at the shared strings arena and its offsets, which already have
+** the layout of an Arrow utf8 array.
+*/
+static void *arrow_alloc(XLSXCtx *ctx, ArrowPriv *priv, size_t size)
+{
+  void *p;
+
+  p = calloc(1, size ? size : 1);
+  if (!p) {
+    snprintf(ctx->errmsg, sizeof(ctx->errmsg), "Out of memory");
+    return NULL;
+  }
+  priv->mem[priv->num++] = p;
+  return p;
+}
+
+static void arrow_release_array(struct ArrowArray *array)
+{
+  ArrowPriv *priv = array->private_data;
+  int i;
+
+  for (i = 0; i < array->n_children; i++)
+    if (array->children[i]->release)
+      array->children[i]->release(array->children[i]);
+  if (array->dictionary && array->dictionary->release)
+    array->dictionary->release(array->dictionary);
+  for (i = 0; i < priv->num; i++)
+    free(priv->mem[i]);
+  free(priv);
+  array->release = NULL;
+}
+
+static void arrow_release_schema(struct ArrowSchema *schema)
+{
+  ArrowPriv *priv = schema->private_data;
+  int i;
+
+  for (i = 0; i < schema->n_children; i++)
+    if (schema->children[i]->release)
+      schema->children[i]->release(schema->children[i]);
+  if (schema->dictionary && schema->dictionary->release)
+    schema->dictionary->release(schema->dictionary);
+  for (i = 0; i < priv->num; i++)
+    free(priv->mem[i]);
+  free(priv);
+  schema->release = NULL;
+}
+
+static ArrowPriv *arrow_priv(XLSXCtx *ctx)
+{
+  ArrowPriv *priv;
+
+  priv = calloc(1, sizeof(ArrowPriv));
+  if (!priv)
+    snprintf(ctx->errmsg, sizeof(ctx->errmsg), "Out of memory");
+  return priv;
+}
+
+static int arrow_schema(XLSXCtx *ctx, struct ArrowSchema *schema)
+{
+  static const char *formats[] = { "i", "g", "u" };
+  struct ArrowSchema **children, *child, *dict;
+  ArrowPriv *priv;
+  char *name;
+  int i;
+
+  memset(schema, 0, sizeof(*schema));
+  if (!(priv = arrow_priv(ctx)))
+    return -1;
+  schema->format = "+s";
+  schema->name = "";
+  schema->release = arrow_release_schema;
+  schema->private_data = priv;
+  children = arrow_alloc(ctx, priv, ctx->arrow_cols * sizeof(struct ArrowSchema *));
+  child = arrow_alloc(ctx, priv, ctx->arrow_cols * sizeof(struct ArrowSchema));
+  if (!children || !child)
+    goto fail;
+  schema->children = children;
+  for (i = 0; i < ctx->arrow_cols; i++) {
+    children[i] = &child[i];
+    if (!(child[i].private_data = arrow_priv(ctx)))
+      goto fail;
+    child[i].release = arrow_release_schema;
+    schema->n_children = i + 1;
+    child[i].format = formats[ctx->arrow_kinds[i]];
+    // The schema may outlive the sheet, and so the names of its columns
+    if (!(name = arrow_alloc(ctx, child[i].private_data, strlen(ctx->arrow_names[i]) + 1)))
+      goto fail;
+    strcpy(name, ctx->arrow_names[i]);
+    child[i].name = name;
+    child[i].flags = ARROW_FLAG_NULLABLE;
+    if (ctx->arrow_kinds[i] == ARROW_DICT) {
+      dict = arrow_alloc(ctx, child[i].private_data, sizeof(struct ArrowSchema));
+      if (!dict || !(dict->private_data = arrow_priv(ctx)))
+        goto fail;
+      dict->format = "u";
+      dict->name = "";
+      dict->release = arrow_release_schema;
+      child[i].dictionary = dict;
+    }
+  }
+  return 0;
+
+fail:
+  arrow_release_schema(schema);
+  return -1;
+}
+
+/*
+** Name the columns up to cols, from the header row or else from their
+** letters. Columns already named keep their name.
+*/
+static int arrow_names(XLSXCtx *ctx, const XLSXRow *header, int cols)
+{
+  const XLSXCell *cell;
+  char **names, name[8];
+  int i, n, col;
+
+  if (cols > ctx->arrow_cols) {
+    names = realloc(ctx->arrow_names, cols * sizeof(char *));
+    if (!names)
+      return -1;
+    memset(names + ctx->arrow_cols, 0, (cols - ctx->arrow_cols) * sizeof(char *));
+    ctx->arrow_names = names;
+    ctx->arrow_cols = cols;
+  }
+  for (i = 0; header && (i < header->num_cells); i++) {
+    cell = &header->cells[i];
+    if ((cell->col < 1) || (cell->col > ctx->arrow_cols) || ctx->arrow_names[cell->col - 1])
+      continue;
+    ctx->arrow_names[cell->col - 1] = malloc(cell->len + 1);
+    if (!ctx->arrow_names[cell->col - 1])
+      return -1;
+    memcpy(ctx->arrow_names[cell->col - 1], cell->ptr, cell->len);
+    ctx->arrow_names[cell->col - 1][cell->len] = 0;
+  }
+  for (i = 0; i < ctx->arrow_cols; i++) {
+    if (ctx->arrow_names[i])
+      continue;
+    n = sizeof(name) - 1;
+    name[n] = 0;
+    for (col = i + 1; (col > 0) && (n > 0); col = (col - 1) / 26)
+      name[--n] = 'A' + (col - 1) % 26;
+    ctx->arrow_names[i] = strdup(name + n);
+    if (!ctx->arrow_names[i])
+      return -1;
+  }
+  return 0;
+}
+
+/*
+** Type of each column, from the cells of the first batch.
+*/
+static int arrow_kinds(XLSXCtx *ctx)
+{
+  uint8 *seen;
+  int i, c;
+
+  ctx->arrow_kinds = malloc(ctx->arrow_cols);
+  seen = calloc(ctx->arrow_cols, 1);
+  if (!ctx->arrow_kinds || !seen) {
+    free(seen);
+    return -1;
+  }
+  // Bit 0: some shared string, bit 1: some number, bit 2: some other value
+  for (i = 0; i < ctx->arrow_cells_num; i++) {
+    c = ctx->arrow_cells[i].col - 1;
+    if (ctx->arrow_cells[i].type == XLSX_CELL_SHARED)
+      seen[c] |= 1;
+    else if ((ctx->arrow_cells[i].type == XLSX_CELL_NUMBER) || (ctx->arrow_cells[i].type == XLSX_CELL_DATE))
+      seen[c] |= 2;
+    else
+      seen[c] |= 4;
+  }
+  for (c = 0; c < ctx->arrow_cols; c++)
+    ctx->arrow_kinds[c] = (seen[c] == 1) ? ARROW_DICT : (seen[c] == 2) ? ARROW_FLOAT64 : ARROW_UTF8;
+  free(seen);
+  return 0;
+}
+
+/*
+** Gather up to max_rows rows into arrow_cells. The rows that the sheet
+** leaves out are gathered as null rows, so that the rows of the batches
+** follow the rows of the sheet. Returns the number of rows.
+*/
+static int arrow_gather(XLSXCtx *ctx, int max_rows, const XLSXRow **header)
+{
+  const XLSXRow *row;
+  const XLSXCell *cell;
+  ArrowCell *acell;
+  int n, i, gap;
+
+  ctx->arrow_cells_num = 0;
+  ctx->arrow_text_len = 0;
+  for (n = 0; n < max_rows; ) {
+    row = ctx->arrow_pending;
+    if (!row && !(row = xlsx_next_row(ctx)))
+      break;
+    ctx->arrow_pending = NULL;
+    if (header && !*header) {
+      // Names are taken from the header row before it is overwritten by the next one
+      *header = row;
+      ctx->arrow_last_row = row->row;
+      if (arrow_names(ctx, row, row->num_cells ? row->cells[row->num_cells - 1].col : 0))
+        return -1;
+      continue;
+    }
+    gap = row->row - ctx->arrow_last_row - 1;
+    if (gap > 0) {
+      // Null rows have no cells, the row stays valid until the next one is read
+      if (gap > max_rows - n)
+        gap = max_rows - n;
+      n += gap;
+      ctx->arrow_last_row += gap;
+      ctx->arrow_pending = row;
+      continue;
+    }
+    ctx->arrow_last_row = row->row;
+    if (grow_int(ctx, XLSX_MEM_ROWS, (void **) &ctx->arrow_cells, &ctx->arrow_cells_cap, ctx->arrow_cells_num + row->num_cells, sizeof(ArrowCell)))
+      return -1;
+    for (i = 0; i < row->num_cells; i++) {
+      cell = &row->cells[i];
+      if (cell->col < 1)
+        continue;
+      acell = &ctx->arrow_cells[ctx->arrow_cells_num++];
+      acell->row = n;
+      acell->col = cell->col;
+      acell->type = cell->type;
+      acell->index = cell->index;
+      acell->len = cell->len;
+      acell->off = ctx->arrow_text_len;
+      if (cell->type != XLSX_CELL_SHARED) {
+        if (grow(ctx, XLSX_MEM_ROWS, (void **) &ctx->arrow_text, &ctx->arrow_text_cap, ctx->arrow_text_len + cell->len, 1))
+          return -1;
+        memcpy(ctx->arrow_text + ctx->arrow_text_len, cell->ptr, cell->len);
+        ctx->arrow_text_len += cell->len;
+      }
+    }
+    n++;
+  }
+  return (ctx->failed || ((ctx->sheet_state == SHEET_DONE) && ctx->errmsg[0])) ? -1 : n;
+}
+
+/*
+** Lay out column col of the batch in child. Cells of a row are in column
+** order, and rows in batch order, so each column is filled sequentially.
+*/
+static int arrow_column(XLSXCtx *ctx, int col, int num_rows, struct ArrowArray *child)
+{
+  static const char empty[1];
+  ArrowPriv *priv;
+  const ArrowCell *acell;
+  const char *text;
+  const void **buffers;
+  struct ArrowArray *dict;
+  uint8 *valid;
+  int32_t *ints = NULL;
+  double *dbls = NULL;
+  char *data = NULL, *end, num[64];
+  size_t data_len;
+  int i, r, last, kind;
+
+  kind = ctx->arrow_kinds[col - 1];
+  priv = arrow_priv(ctx);
+  if (!priv)
+    return -1;
+  child->length = num_rows;
+  child->null_count = num_rows;
+  child->n_buffers = (kind == ARROW_UTF8) ? 3 : 2;
+  child->release = arrow_release_array;
+  child->private_data = priv;
+  buffers = arrow_alloc(ctx, priv, 3 * sizeof(void *));
+  valid = arrow_alloc(ctx, priv, (num_rows + 7) / 8);
+  if (!buffers || !valid)
+    return -1;
+  child->buffers = buffers;
+  buffers[0] = valid;
+  data_len = 0;
+  if (kind == ARROW_UTF8) {
+    for (i = 0; i < ctx->arrow_cells_num; i++)
+      if (ctx->arrow_cells[i].col == col)
+        data_len += ctx->arrow_cells[i].type == XLSX_CELL_SHARED
+          ? (size_t) (ctx->shrdstr_offs[ctx->arrow_cells[i].index + 1] - ctx->shrdstr_offs[ctx->arrow_cells[i].index])
+          : (size_t) ctx->arrow_cells[i].len;
+    if (data_len > 0x7fffffff) {
+      snprintf(ctx->errmsg, sizeof(ctx->errmsg), "Column %s: more than 2 GB of text in a batch", ctx->arrow_names[col - 1]);
+      return -1;
+    }
+    buffers[1] = ints = arrow_alloc(ctx, priv, (num_rows + 1) * sizeof(int32_t));
+    buffers[2] = data = arrow_alloc(ctx, priv, data_len);
+    if (!ints || !data)
+      return -1;
+  }
+  else if (kind == ARROW_DICT) {
+    buffers[1] = ints = arrow_alloc(ctx, priv, num_rows * sizeof(int32_t));
+    dict = arrow_alloc(ctx, priv, sizeof(struct ArrowArray));
+    if (!ints || !dict || !(dict->private_data = arrow_priv(ctx)))
+      return -1;
+    // The dictionary is the shared strings table, as it is
+    dict->length = ctx->shrdstr_num;
+    dict->n_buffers = 3;
+    dict->release = arrow_release_array;
+    child->dictionary = dict;
+    if (!(dict->buffers = arrow_alloc(ctx, dict->private_data, 3 * sizeof(void *))))
+      return -1;
+    dict->buffers[1] = ctx->shrdstr_offs;
+    dict->buffers[2] = ctx->shrdstr_buff ? ctx->shrdstr_buff : empty;
+  }
+  else {
+    buffers[1] = dbls = arrow_alloc(ctx, priv, num_rows * sizeof(double));
+    if (!dbls)
+      return -1;
+  }
+  data_len = 0;
+  last = 0;
+  for (i = 0; i < ctx->arrow_cells_num; i++) {
+    acell = &ctx->arrow_cells[i];
+    if (acell->col != col)
+      continue;
+    r = acell->row;
+    if (kind == ARROW_DICT) {
+      if (acell->type != XLSX_CELL_SHARED)
+        goto mismatch;
+      if (acell->index >= ctx->shrdstr_num)
+        continue;
+      ints[r] = acell->index;
+    }
+    else if (kind == ARROW_FLOAT64) {
+      if ((acell->type != XLSX_CELL_NUMBER) && (acell->type != XLSX_CELL_DATE))
+        goto mismatch;
+      if (!acell->len)
+        continue;
+      if (acell->len >= (int) sizeof(num))
+        goto mismatch;
+      memcpy(num, ctx->arrow_text + acell->off, acell->len);
+      num[acell->len] = 0;
+      dbls[r] = strtod(num, &end);
+      if (*end)
+        goto mismatch;
+    }
+    else {
+      for (; last <= r; last++)
+        ints[last] = (int32_t) data_len;
+      if (acell->type == XLSX_CELL_SHARED) {
+        if (acell->index >= ctx->shrdstr_num)
+          continue;
+        text = ctx->shrdstr_buff + ctx->shrdstr_offs[acell->index];
+        memcpy(data + data_len, text, ctx->shrdstr_offs[acell->index + 1] - ctx->shrdstr_offs[acell->index]);
+        data_len += ctx->shrdstr_offs[acell->index + 1] - ctx->shrdstr_offs[acell->index];
+      }
+      else {
+        memcpy(data + data_len, ctx->arrow_text + acell->off, acell->len);
+        data_len += acell->len;
+      }
+    }
+    valid[r >> 3] |= 1 << (r & 7);
+    child->null_count--;
+  }
+  if (kind == ARROW_UTF8) {
+    for (; last <= num_rows; last++)
+      ints[last] = (int32_t) data_len;
+    if (!data_len)
+      buffers[2] = empty;
+  }
+  return 0;
+
+mismatch:
+  snprintf(ctx->errmsg, sizeof(ctx->errmsg), "Column %s: value of batch row %d does not fit the type of the column",
+           ctx->arrow_names[col - 1], acell->row + 1);
+  return -1;
+}
+
+int xlsx_arrow_batch(XLSXCtx *ctx, int max_rows, int flags, struct ArrowArray *array, struct ArrowSchema *schema)
+{
+  const XLSXRow *header;
+  struct ArrowArray **children, *child;
+  ArrowPriv *priv;
+  int num_rows, i, first, cols;
+
+  memset(array, 0, sizeof(*array));
+  ctx->errmsg[0] = 0;
+  first = !ctx->arrow_kinds;
+  header = NULL;
+  num_rows = arrow_gather(ctx, max_rows, (first && (flags & XLSX_ARROW_HEADER)) ? &header : NULL);
+  if (num_rows < 0)
+    return -1;
+  if (first) {
+    // The columns are those of the <dimension ref>, widened to every cell of the batch
+    cols = ctx->sheet_num_cols;
+    for (i = 0; i < ctx->arrow_cells_num; i++)
+      if (ctx->arrow_cells[i].col > cols)
+        cols = ctx->arrow_cells[i].col;
+    if (arrow_names(ctx, NULL, cols) || arrow_kinds(ctx)) {
+      snprintf(ctx->errmsg, sizeof(ctx->errmsg), "Out of memory");
+      return -1;
+    }
+  }
+  for (i = 0; i < ctx->arrow_cells_num; i++)
+    if (ctx->arrow_cells[i].col > ctx->arrow_cols) {
+      snprintf(ctx->errmsg, sizeof(ctx->errmsg), "Cell of batch row %d beyond the %d columns of the first batch",
+               ctx->arrow_cells[i].row + 1, ctx->arrow_cols);
+      return -1;
+    }
+  if (!num_rows) {
+    if (schema)
+      memset(schema, 0, sizeof(*schema));
+    return 0;
+  }
+  if (schema && arrow_schema(ctx, schema))
+    return -1;
+
+  if (!(priv = arrow_priv(ctx)))
+    goto fail;
+  array->length = num_rows;
+  array->n_buffers = 1;
+  array->release = arrow_release_array;
+  array->private_data = priv;
+  array->buffers = arrow_alloc(ctx, priv, sizeof(void *));
+  children = arrow_alloc(ctx, priv, ctx->arrow_cols * sizeof(struct ArrowArray *));
+  child = arrow_alloc(ctx, priv, ctx->arrow_cols * sizeof(struct ArrowArray));
+  if (!array->buffers || !children || !child)
+    goto fail;
+  array->children = children;
+  for (i = 0; i < ctx->arrow_cols; i++) {
+    children[i] = &child[i];
+    array->n_children = i + 1;
+    if (arrow_column(ctx, i + 1, num_rows, &child[i]))
+      goto fail;
+  }
+  return num_rows;
+
+fail:
+  if (array->release)
+    array->release(array);
+  if (schema && schema->release)
+    schema->release(schema);
+  return -1;
+}
+
+const XLSXStats *xlsx_stats(XLSXCtx *ctx)
+{
+  return &ctx->stats;
+}
+
+const XLSXMemory *xlsx_memory(XLSXCtx *ctx)
+{
+  return &ctx->memory;
+}
+
+void xlsx_set_max_memory(XLSXCtx *ctx, size_t max_memory)
+{
+  ctx->max_memory = max_memory;
+}
+
+void xlsx_set_trace(xlsx_trace_cb cb, void *data)
+{
+  trace_cb = cb;
+  trace_data = data;
+}
+
+const char *xlsx_errmsg(XLSXCtx *ctx)
+{
+  return ctx->errmsg;
+}
+
+void xlsx_close(XLSXCtx *ctx)
+{
+  if (!ctx)
+    return;
+  workbook_reset(ctx);
+  perf_close(ctx);
+  arena_free(ctx);
+  free_buf(ctx->sheet_ptr, ctx->sheet_cap, ctx->sheet_huge);
+  free(ctx->zip_buff);
+  free_buf(ctx->shrdstr_buff, ctx->shrdstr_cap, ctx->shrdstr_huge);
+  free(ctx->shrdstr_offs);
+  free(ctx->styles);
+  free(ctx->numfmts);
+  free(ctx->row.cells);
+  free(ctx->row_buff);
+  free(ctx->arrow_cells);
+  free(ctx->arrow_text);
+#ifndef CONFIG_EXPAT
+  free(ctx->q_rows);
+  free(ctx->q_cells);
+  free(ctx->q_offs);
+  free(ctx->q_text);
+#endif /* Not(CONFIG_EXPAT) */
+  free(ctx);
+}
@@ -0,0 +1,377 @@
+/*****************************************************************
+ NAME:
+   cxlsx - read Excel 2007 files row by row
+
+ USAGE:
+   XLSXCtx *ctx = xlsx_open("input.xlsx", 0);
+   const XLSXRow *row;
+
+   if (ctx && !xlsx_sheet_open(ctx, 1))
+     while ((row = xlsx_next_row(ctx)))
+       for (i = 0; i < row->num_cells; i++)
+         use row->cells[i].ptr, row->cells[i].len, row->cells[i].type;
+   xlsx_close(ctx);
+
+ COMPILATION:
+   cc -DCONFIG_EXPAT -c cxlsx.c
+   (or -DCONFIG_MXML, or -DCONFIG_PARSIFAL, as for cxlsx_to_csv)
+
+** Copyright (C) 2015 Victor Paesa
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+*****************************************************************/
+
+#ifndef CXLSX_H
+#define CXLSX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+** An open workbook, and the sheet being read from it
+*/
+typedef struct XLSXCtx XLSXCtx;
+
+/*
+** Flags for xlsx_open()
+*/
+#define XLSX_DATES 0x01  /* Read xl/styles.xml, and report date styled numbers as XLSX_CELL_DATE */
+#define XLSX_STATS 0x02  /* Measure the time spent in each phase, see xlsx_stats() */
+#define XLSX_PERF  0x04  /* With XLSX_STATS, also count hardware events in each phase (Linux only) */
+#define XLSX_HUGEPAGES 0x08  /* Back buffers of 2 MB or more with huge pages (Linux only) */
+
+/*
+** Type of a cell value
+*/
+enum {
+  XLSX_CELL_NUMBER,      /* Number (no t, or t="n"), as written in <v> */
+  XLSX_CELL_SHARED,      /* Shared string (t="s"), the index is in XLSXCell.index */
+  XLSX_CELL_STRING,      /* String of a formula (t="str"), or any other value, as written in <v> */
+  XLSX_CELL_DATE,        /* Number with a date or time style, see xlsx_format_date() */
+  XLSX_CELL_INLINE,      /* Inline string (t="inlineStr"), the text of its <is> */
+  XLSX_CELL_BOOL,        /* Boolean (t="b"), "0" or "1" */
+  XLSX_CELL_ERROR,       /* Error (t="e"), such as #N/A or #DIV/0! */
+  XLSX_CELL_TYPES
+};
+
+/*
+** A view of a cell value. It points into the internal buffers of the
+** XLSXCtx, is not NUL terminated, and is valid until the next row is read.
+*/
+typedef struct XLSXCell XLSXCell;
+struct XLSXCell {
+  const char *ptr;
+  int         len;
+  int         type;      /* XLSX_CELL_NUMBER, XLSX_CELL_SHARED, ... */
+  int         col;       /* Column number, 1 for A */
+  int         index;     /* Index of the shared string for XLSX_CELL_SHARED */
+  int         style;     /* Style index, "s" attribute of the cell */
+};
+
+/*
+** A row: its cells with a value, in column order. Empty cells are not listed.
+*/
+typedef struct XLSXRow XLSXRow;
+struct XLSXRow {
+  int         row;       /* Row number, 1 for the first one */
+  int         num_cells;
+  XLSXCell   *cells;
+  int         span;      /* Last column of the spans attribute of <row>, 0 without it */
+};
+
+typedef void (*xlsx_row_cb)(void *data, const XLSXRow *row);
+
+/*
+** Open a workbook and read its shared strings. Returns NULL on failure.
+*/
+XLSXCtx *xlsx_open(const char *filename, int flags);
+
+/*
+** Close the workbook of ctx and open another one in its place. The memory
+** of ctx (shared strings arena, inflate buffers, slabs of the allocations of
+** miniz and Expat, row buffers) is kept, so that reading many workbooks in
+** turn runs at steady state.
+** Returns 0 on success, -1 on failure: ctx then holds no workbook, and may
+** be reopened again or closed.
+*/
+int xlsx_reopen(XLSXCtx *ctx, const char *filename, int flags);
+
+/*
+** Same as xlsx_open() and xlsx_reopen(), for a workbook already in memory,
+** e.g. read from a pipe. buf is not copied, and must stay valid until the
+** workbook is closed or reopened.
+*/
+XLSXCtx *xlsx_open_mem(const void *buf, size_t size, int flags);
+int xlsx_reopen_mem(XLSXCtx *ctx, const void *buf, size_t size, int flags);
+
+/*
+** Open sheet number sheet_id (1 for xl/worksheets/sheet1.xml) for reading.
+** Returns 0 on success, -1 on failure.
+*/
+int xlsx_sheet_open(XLSXCtx *ctx, int sheet_id);
+
+/*
+** Pull the next row of the open sheet, NULL at the end of the sheet or on
+** error (xlsx_errmsg() is then not empty). The Expat backend parses the
+** sheet just up to the end of the row, the other backends parse the whole
+** sheet on the first call.
+*/
+const XLSXRow *xlsx_next_row(XLSXCtx *ctx);
+
+/*
+** Push all the rows of the open sheet to callback cb.
+** Returns 0 on success, -1 on failure.
+*/
+int xlsx_sheet_rows(XLSXCtx *ctx, xlsx_row_cb cb, void *data);
+
+/*
+** Number of rows and columns of the open sheet, from its <dimension ref>.
+** Known once the first row has been read.
+*/
+void xlsx_sheet_dimension(XLSXCtx *ctx, int *rows, int *cols);
+
+typedef struct XLSXProgress XLSXProgress;
+struct XLSXProgress {
+  uint64_t    parsed;    /* Bytes of the XML of the sheet parsed (Mini-XML: 0 until the end) */
+  uint64_t    size;      /* Size of the XML of the sheet */
+  uint64_t    comp_read; /* Compressed bytes of the sheet consumed (all of them, unless streamed) */
+  uint64_t    comp_size; /* Compressed size of the sheet, from the zip central directory */
+};
+
+/*
+** How far the reading of the open sheet has got, to be called on the thread
+** reading it (e.g. from the row callback). Returns 0, or -1 with no sheet open.
+*/
+int xlsx_sheet_progress(XLSXCtx *ctx, XLSXProgress *progress);
+
+/*
+** Shared strings of the workbook
+*/
+int xlsx_shared_count(XLSXCtx *ctx);
+const char *xlsx_shared_string(XLSXCtx *ctx, int index, int *len);
+
+/*
+** Format a XLSX_CELL_DATE value in ISO 8601 (YYYY-MM-DD, HH:MM:SS or
+** YYYY-MM-DDTHH:MM:SS.sss) into dst, which must hold 32 characters.
+** Returns the length of the text, or 0 when the value is not a valid date.
+*/
+int xlsx_format_date(XLSXCtx *ctx, const XLSXCell *cell, char *dst);
+
+/*
+** Arrow C Data Interface, see https://arrow.apache.org/docs/format/CDataInterface.html
+*/
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+  // Array type description
+  const char* format;
+  const char* name;
+  const char* metadata;
+  int64_t flags;
+  int64_t n_children;
+  struct ArrowSchema** children;
+  struct ArrowSchema* dictionary;
+
+  // Release callback
+  void (*release)(struct ArrowSchema*);
+  // Opaque producer-specific data
+  void* private_data;
+};
+
+struct ArrowArray {
+  // Array data description
+  int64_t length;
+  int64_t null_count;
+  int64_t offset;
+  int64_t n_buffers;
+  int64_t n_children;
+  const void** buffers;
+  struct ArrowArray** children;
+  struct ArrowArray* dictionary;
+
+  // Release callback
+  void (*release)(struct ArrowArray*);
+  // Opaque producer-specific data
+  void* private_data;
+};
+
+#endif  // ARROW_C_DATA_INTERFACE
+
+/*
+** Flags for xlsx_arrow_batch()
+*/
+#define XLSX_ARROW_HEADER 0x01  /* The first row of the sheet holds the names of the columns */
+
+/*
+** Read up to max_rows rows of the open sheet into array, a struct array with
+** one child per column, and describe it in schema (schema may be NULL after
+** the first batch, it does not change).
+** The type of each column is chosen from the first batch: columns with only
+** shared strings are dictionary<int32, utf8> whose dictionary is the shared
+** strings table itself (not copied), columns with only numbers are float64
+** (dates are their serial number), other columns are utf8.
+** A later cell that does not fit the type of its column is an error.
+** The empty rows that the sheet leaves out are null rows, so that the
+** batches hold every row of the sheet (after the header row) in order.
+** Returns the number of rows, 0 at the end of the sheet (array and schema
+** are then left released), or -1 on failure.
+** Batches must be released before xlsx_reopen() or xlsx_close(). The
+** schema holds its own copy of the names of the columns, and stays valid
+** until it is released, whatever is opened or closed before.
+*/
+int xlsx_arrow_batch(XLSXCtx *ctx, int max_rows, int flags, struct ArrowArray *array, struct ArrowSchema *schema);
+
+/*
+** Phases of the reading of a workbook, for xlsx_stats()
+*/
+enum {
+  XLSX_PHASE_OPEN,           /* Reading of the zip central directory */
+  XLSX_PHASE_SST_INFLATE,    /* Inflating xl/sharedStrings.xml */
+  XLSX_PHASE_SST_PARSE,
+  XLSX_PHASE_STYLES,         /* Inflating and parsing xl/styles.xml and xl/workbook.xml */
+  XLSX_PHASE_SHEET_INFLATE,
+  XLSX_PHASE_SHEET_PARSE,    /* Includes the time spent in the row callback of xlsx_sheet_rows() */
+  XLSX_PHASES
+};
+
+/*
+** Hardware events counted with XLSX_PERF
+*/
+enum {
+  XLSX_PERF_CYCLES,
+  XLSX_PERF_INSTRUCTIONS,
+  XLSX_PERF_BRANCH_MISSES,
+  XLSX_PERF_L1D_MISSES,      /* L1 data cache read misses */
+  XLSX_PERF_LLC_MISSES,      /* Last level cache read misses */
+  XLSX_PERF_DTLB_MISSES,     /* Data TLB read misses */
+  XLSX_PERF_COUNTERS
+};
+
+typedef struct XLSXPhase XLSXPhase;
+struct XLSXPhase {
+  double      wall;      /* Elapsed seconds */
+  double      cpu;       /* CPU seconds of the calling thread */
+  uint64_t    bytes;     /* Size of the archive for XLSX_PHASE_OPEN, else inflated size of the parts */
+  uint64_t    perf[XLSX_PERF_COUNTERS];  /* Events of the calling thread, with XLSX_PERF */
+};
+
+typedef struct XLSXStats XLSXStats;
+struct XLSXStats {
+  XLSXPhase   phase[XLSX_PHASES];
+  unsigned int perf;     /* Bit (1 << XLSX_PERF_...) set for each event that could be counted */
+};
+
+/*
+** Time spent in each phase since the workbook was opened, all zero unless
+** it was opened with XLSX_STATS.
+** The events of XLSX_PERF are counted on the thread that first measures a
+** phase of ctx, so that ctx should not be used from other threads then.
+*/
+const XLSXStats *xlsx_stats(XLSXCtx *ctx);
+
+/*
+** Read into counters the running totals of the events counted for ctx, so
+** that callers can count their own phases. Returns -1 when there are none.
+*/
+int xlsx_perf_read(XLSXCtx *ctx, uint64_t counters[XLSX_PERF_COUNTERS]);
+
+/*
+** Memory held by an XLSXCtx, by use
+*/
+enum {
+  XLSX_MEM_ZIP,              /* Central directory of the zip archive */
+  XLSX_MEM_INFLATE,          /* Inflated parts, and the read buffer of the inflater */
+  XLSX_MEM_SST,              /* Shared strings */
+  XLSX_MEM_PARSER,           /* Internals of the XML parser (Expat only) */
+  XLSX_MEM_ROWS,             /* Row being read, queued rows, styles and Arrow export */
+  XLSX_MEMS
+};
+
+typedef struct XLSXMemUse XLSXMemUse;
+struct XLSXMemUse {
+  uint64_t    bytes;     /* Allocated now */
+  uint64_t    peak;      /* Highest value of bytes since the workbook was opened */
+  uint64_t    allocs;    /* Allocations and growths since the workbook was opened */
+};
+
+typedef struct XLSXMemory XLSXMemory;
+struct XLSXMemory {
+  XLSXMemUse  use[XLSX_MEMS];
+  XLSXMemUse  total;
+};
+
+/*
+** Memory held by ctx. Buffers are kept from workbook to workbook, so that
+** bytes is not zero after xlsx_reopen().
+*/
+const XLSXMemory *xlsx_memory(XLSXCtx *ctx);
+
+/*
+** Budget of memory for ctx, 0 (the default) for no limit. A sheet that would
+** not fit whole in the budget is inflated and parsed in pieces of 32 KB
+** instead (Expat only, other backends always inflate it whole), its inflating
+** then being accounted in XLSX_PHASE_SHEET_PARSE.
+*/
+void xlsx_set_max_memory(XLSXCtx *ctx, size_t max_memory);
+
+/*
+** Callback of xlsx_set_trace(), called on the reading thread at the end of
+** each span of work: opening the archive, each part or piece of the sheet
+** inflated, and each part or piece of the sheet parsed (pieces only when
+** pushed with xlsx_sheet_rows()). start and end are CLOCK_MONOTONIC
+** nanoseconds, bytes the inflated bytes covered; name is a static string.
+*/
+typedef void (*xlsx_trace_cb)(void *data, const char *name, uint64_t start, uint64_t end, uint64_t bytes);
+
+/*
+** Trace the work of every XLSXCtx of the process to cb, NULL to stop.
+** Must be set while no workbook is being read.
+*/
+void xlsx_set_trace(xlsx_trace_cb cb, void *data);
+
+/*
+** Instruction sets of the kernels (CRC-32 of the parts inflated, scanning of
+** CSV fields) that are built in several variants and chosen at startup by
+** what the CPU runs, capped by the environment variable CXLSX_CPU (scalar,
+** sse4.2, avx2 or avx512). Only x86 built with GCC or Clang has more than
+** XLSX_CPU_SCALAR.
+*/
+enum { XLSX_CPU_SCALAR, XLSX_CPU_SSE42, XLSX_CPU_AVX2, XLSX_CPU_AVX512 };
+
+int xlsx_cpu_level(void);
+const char *xlsx_cpu_name(int level);
+
+/*
+** Last error message of ctx
+*/
+const char *xlsx_errmsg(XLSXCtx *ctx);
+
+void xlsx_close(XLSXCtx *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CXLSX_H */
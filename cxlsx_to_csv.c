@@ -3,16 +3,19 @@
    cxlsx_to_csv - convert Excel 2007 files to .CSV
 
  USAGE:
-   cxlsx_to_csv -if input.xlsx [-sh sheet_id] [-of output.csv]
+   cxlsx_to_csv -if input.xlsx [-sh sheet_id] [-of output.csv] [-gz level] [-gzj threads]
+                [-format csv|jsonl] [-dict output.dict.csv] [-dates]
+   cxlsx_to_csv -batch list.txt -outdir DIR [-j workers] [-sh sheet_id] [-gz level] ...
+   cxlsx_to_csv -serve socket [-j workers] [-gz level] [-dates] ...
   
  COMPILATION:
-   cc -DCONFIG_EXPAT -o cxlsx_to_csv cxlsx_to_csv.c -l expat
+   cc -DCONFIG_EXPAT -o cxlsx_to_csv cxlsx_to_csv.c cxlsx.c -l expat -lpthread
    or
-   cc -DCONFIG_MXML -o cxlsx_to_csv cxlsx_to_csv.c -l mxml
+   cc -DCONFIG_MXML -o cxlsx_to_csv cxlsx_to_csv.c cxlsx.c -l mxml -lpthread
    or
-   cc -DCONFIG_PARSIFAL -o cxlsx_to_csv cxlsx_to_csv.c -lparsifal
+   cc -DCONFIG_PARSIFAL -o cxlsx_to_csv cxlsx_to_csv.c cxlsx.c -lparsifal -lpthread
    or (to benchmark the time used by decompressing step)
-   cc -o cxlsx_to_csv cxlsx_to_csv.c
+   cc -o cxlsx_to_csv cxlsx_to_csv.c cxlsx.c -lpthread
    
  Must be used with Expat compiled for UTF-8 output.
 
@@ -34,8 +37,8 @@
 
 *****************************************************************/
 
-#include <ctype.h>
 #include <stdlib.h>
+#define MINIZ_HEADER_FILE_ONLY
 #include "miniz.c"
 
 typedef unsigned char uint8;
@@ -44,197 +47,1018 @@ typedef unsigned int uint;
 
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "cxlsx.h"
 
-#ifdef CONFIG_PARSIFAL
-#include "libparsifal/parsifal.h"
-#endif /* CONFIG_PARSIFAL */
-
-#ifdef CONFIG_MXML
-#include <mxml.h>
-#endif /* CONFIG_MXML */
-
-#ifdef CONFIG_EXPAT
-#include <expat.h>
-
-#if defined(__amigaos__) && defined(__USE_INLINE__)
-#include <proto/expat.h>
-#endif
-
-#ifdef XML_LARGE_SIZE
-#if defined(XML_USE_MSC_EXTENSIONS) && _MSC_VER < 1400
-#define XML_FMT_INT_MOD "I64"
-#else
-#define XML_FMT_INT_MOD "ll"
-#endif
+#ifndef _WIN32
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #else
-#define XML_FMT_INT_MOD "l"
-#endif
-#endif /* CONFIG_EXPAT */
+#include <fcntl.h>
+#include <io.h>
+#endif /* Not(_WIN32) */
+
+// Kernels in several variants, as in cxlsx.c
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define XLSX_X86_DISPATCH
+#include <immintrin.h>
+#define XLSX_TARGET(isa) __attribute__((target(isa)))
+#endif /* x86 && __GNUC__ */
 
 static char *usage_str = "\n\
 NAME:\n\
 cxlsx_to_csv - convert Excel 2007 files to .CSV\n\
 \n\
 SYNOPSIS:\n\
-cxlsx_to_csv -if input.xlsx [-sh sheet_id] [-of output.csv]\n\
-    input.xlsx        input spreadsheet in Excel 2007 format (Office Open XML)\n\
+cxlsx_to_csv -if input.xlsx [-sh sheet_id] [-of output.csv] [-gz level] [-gzj threads]\n\
+             [-format csv|jsonl] [-dict output.dict.csv] [-dates] [-stats|-stats-json]\n\
+             [-perf-counters] [-max-memory bytes] [-trace trace.json] [-progress]\n\
+             [-hugepages]\n\
+cxlsx_to_csv -batch list.txt -outdir DIR [-j workers] [-sh sheet_id] [-gz level]\n\
+             [-gzj threads] [-format csv|jsonl] [-dates] [-stats|-stats-json]\n\
+             [-perf-counters] [-max-memory bytes] [-trace trace.json] [-progress]\n\
+             [-hugepages]\n\
+cxlsx_to_csv -serve socket [-j workers] [-gz level] [-gzj threads] [-dates]\n\
+             [-max-memory bytes] [-hugepages]\n\
+    input.xlsx        input spreadsheet in Excel 2007 format (Office Open XML),\n\
+                      or - to read it from STDIN (it is then held in memory)\n\
     sheet_id        name of the sheet within the workbook (default is first one)\n\
     output.csv        output CSV file (default is STDOUT)\n\
+                      if its name ends in .gz, output is compressed with gzip\n\
+    level             gzip compression level 1..9 (default is 6), also forces\n\
+                      gzip compression when writing to STDOUT\n\
+    threads           number of threads compressing blocks of output in parallel\n\
+                      (default is 1, a single compressing thread)\n\
+    -format jsonl     output one JSON object per row, keyed by the values of the\n\
+                      first row; numeric cells are not quoted, empty cells omitted\n\
+    output.dict.csv   output shared strings as their index number, and write the\n\
+                      index and value of those used by the sheet to this CSV file\n\
+    -dates            output cells with a date or time number format in ISO 8601\n\
+                      (YYYY-MM-DD, HH:MM:SS or YYYY-MM-DDTHH:MM:SS)\n\
+    -stats            print to STDERR the wall and CPU time, bytes and MB/s of\n\
+                      each phase (sheet_parse includes formatting the output),\n\
+                      the memory in use, peak and allocations by subsystem,\n\
+                      and the counts of shared strings, rows and cells by type\n\
+    -stats-json       same as -stats, as one JSON object per input file\n\
+    -perf-counters    add to -stats (implied) the cycles, IPC, and branch, L1d,\n\
+                      LLC and dTLB misses per byte of each phase (Linux only)\n\
+    bytes             budget of memory of each workbook (K, M or G may follow);\n\
+                      sheets that would not fit whole are inflated and parsed\n\
+                      in pieces (Expat only)\n\
+    trace.json        write to this file the spans of each thread (open,\n\
+                      inflate and parse of each part, flush of output blocks,\n\
+                      deflate and write of gzip blocks) as Chrome trace events\n\
+    -progress         print to STDERR every second the rows, XML and compressed\n\
+                      bytes of the sheet read so far, MB/s and time left\n\
+    -hugepages        back the inflated sheet, the shared strings and the\n\
+                      buffer of the parser with 2 MB pages when they reach that\n\
+                      size, and add to -stats the huge pages in use (Linux only)\n\
+    list.txt          file with the names of the Excel files to convert, one\n\
+                      per line; each one is written to DIR as name.csv (or\n\
+                      name.jsonl, with .gz appended for gzip output), or\n\
+                      name-2.csv, name-3.csv... when an earlier file of the\n\
+                      list has the same name\n\
+    workers           number of files converted in parallel (default is 1)\n\
+    socket            path of a Unix domain socket where conversions are served,\n\
+                      one per connection; the request is a line of tab separated\n\
+                      fields: input.xlsx [sheet_id [csv|jsonl [first_row [last_row]]]]\n\
+                      and the reply 'OK', the output and a last line 'OK' (or\n\
+                      'ERR message' if it failed partway), or 'ERR message'\n\
 \n\
 CAVEATS:\n\
 Separator in output CSV is comma.\n\
 ";
 
-// https://support.office.com/en-us/article/Excel-specifications-and-limits-1672b34d-7043-467e-8e27-269d656771c3&usg=AFQjCNHniIQ4KTIFQZ6efVfpDtETwU9Cmw
-// Total number of characters that an Excel cell can contain: 32,767
-#define BUFFSIZE 40960
-
-/*
-** An object used to parse XML content of XLSX
-*/
-typedef struct XLSXCtx XLSXCtx;
-struct XLSXCtx {
-  FILE  *outf;
-  int    xml_depth;      /* Current dept while parsing the XML tree */
-  char **shrdstr_array;
-  int    shrdstr_num, shrdstr_cnt;
-  int    sheet_num_rows, sheet_num_cols;
-  int    current_row, current_col, expected_col;
-  int    lookup_v;
-#ifdef CONFIG_PARSIFAL
-  XMLCH *sheet_cur_ptr;
-  XMLCH *sheet_end_ptr;
-#endif /* CONFIG_PARSIFAL */
-#ifndef CONFIG_MXML
-  int    shrdstr_tv;     /* Flag to look for a shared string when inside a <t> or <v> element */
-  char  *shrdstr_tv_val; /* Value of a shared string when inside a <t> element in xl/sharedStrings.xml */
-                         /* or Index of a shared string when inside a <v> element in xl/worksheets/sheet1.xml */
-  char   shrdstr_buff[BUFFSIZE];
-#endif /* Not(CONFIG_MXML) = CONFIG_EXPAT || CONFIG_PARSIFAL */
+/*
+** Buffered output.
+** Output is assembled into blocks of OUTBUFSIZE bytes. Full blocks are either
+** written to a plain FILE, or handed over to a background thread that deflates
+** them with the tdefl encoder in miniz.c and writes them as a gzip stream.
+** For gzip output two blocks are used: the parser fills one of them while the
+** compressing thread deflates the other.
+*/
+#define OUTBUFSIZE (256*1024)
+
+/*
+** With several compressing threads (-gzj), blocks are deflated independently
+** on a pool of threads, in the way of pigz. Each block is primed with the last
+** GZ_DICT_SIZE bytes of the previous one, so that matches can still reach back
+** into it, and ends with a sync flush, so that the deflated blocks can simply
+** be concatenated into a single gzip member. A writer thread writes them in
+** order, and combines their CRC-32 for the gzip trailer.
+*/
+#define GZ_DICT_SIZE 32768
+
+enum { GZ_FREE, GZ_QUEUED, GZ_DEFLATING, GZ_DEFLATED };
+
+typedef struct GZBlock GZBlock;
+struct GZBlock {
+  char     *in;                 /* Uncompressed data, OUTBUFSIZE bytes */
+  size_t    in_len;
+  char      dict[GZ_DICT_SIZE]; /* Tail of the previous blocks */
+  size_t    dict_len;
+  uint8    *zout;               /* Deflated data */
+  size_t    zout_len, zout_cap;
+  mz_ulong  crc;                /* CRC-32 of the uncompressed data */
+  int       last;               /* Flag for the final block of the stream */
+  int       state;
+};
+
+typedef struct GZWorker GZWorker;
+struct GZWorker {
+  struct XLSXOut   *out;
+  pthread_t         thread;
+  tdefl_compressor *comp;
+  GZBlock          *blk;        /* Block being deflated, NULL while priming */
+};
+
+typedef struct XLSXOut XLSXOut;
+struct XLSXOut {
+  char  *ptr;            /* Next free byte in the current block */
+  char  *end;            /* End of the current block */
+  char  *blk[2];         /* Output blocks (plain output only uses blk[0]) */
+  int    cur;            /* Index of the block being filled */
+  FILE  *f;
+  int    gz;             /* Flag for gzip compressed output */
+  int    gz_level;       /* Compression level 1..9 */
+  pthread_t         gz_thread;
+  pthread_mutex_t   gz_mutex;
+  pthread_cond_t    gz_cond;
+  tdefl_compressor *gz_comp;
+  const char       *gz_pend;     /* Block waiting to be deflated, NULL when the thread is idle */
+  size_t            gz_pend_len;
+  int               gz_finish;   /* Set when there are no more blocks to deflate */
+  int               gz_error;
+  int               error;       /* Flag set when the output could not be written */
+  mz_uint64         written;     /* Bytes of plain output handed over before the current block */
+  int               stats;       /* Flag to measure the time spent writing, for -stats */
+  double            st_wall, st_cpu;
+  mz_uint64         st_bytes;
+  XLSXCtx          *st_perf_ctx; /* Workbook whose hardware counters are read, for --perf-counters */
+  uint64_t          st_perf[XLSX_PERF_COUNTERS];
+  mz_uint64         st_mem, st_mem_allocs;  /* Bytes of the blocks and compressors in use, and allocations made */
+  mz_ulong          gz_crc;      /* CRC-32 and size of the uncompressed data, for the gzip trailer */
+  mz_uint32         gz_isize;
+  int               gz_threads;  /* Number of compressing threads, more than 1 for block-parallel mode */
+  GZWorker         *gz_workers;
+  GZBlock          *gz_blks;     /* Ring of blocks, indexed by sequence number modulo gz_nblks */
+  int               gz_nblks;
+  unsigned int      gz_fill_seq, gz_job_seq, gz_write_seq;
+  pthread_t         gz_writer;
+};
+
+
+enum { FORMAT_CSV, FORMAT_JSONL };
+
+/*
+** Progress of a conversion (--progress). The parsing thread counts rows, and
+** every PROGRESS_ROWS rows publishes how far it has got into the sheet; a
+** reporting thread prints it every PROGRESS_INTERVAL seconds, so that a
+** stuck conversion keeps reporting too.
+*/
+#define PROGRESS_ROWS     16384
+#define PROGRESS_INTERVAL 1
+
+typedef struct Progress Progress;
+struct Progress {
+  pthread_t       thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t  cond;
+  int             done;          /* Flag set when the conversion is over */
+  const char     *input;
+  struct timespec start;
+  mz_uint64       rows;          /* Counted by the parsing thread */
+  mz_uint64       pub_rows;      /* Published under mutex, with pub */
+  XLSXProgress    pub;
+};
+
+/*
+** Width of the CSV rows of a sheet, see width_row()
+*/
+#define WIDTH_ROWS  1024
+#define WIDTH_BYTES (1 << 20)
+#define WIDTH_GAP_BYTES 65536
+
+typedef struct WidthRun WidthRun;
+struct WidthRun {
+  size_t first;          /* Index of the first row written with cols columns */
+  int    cols;
+};
+
+typedef struct Width Width;
+struct Width {
+  int       cols;        /* Columns of the rows written */
+  int       ahead;       /* -1 before the first row, 1 while rows are held to find cols, 0 after */
+  XLSXRow  *rows;        /* Rows held, with their cells back to back in cells */
+  size_t    rows_num, rows_cap;
+  XLSXCell *cells;
+  size_t    cells_num, cells_cap;
+  size_t   *offs;        /* Offset of the value of each cell held in text, (size_t) -1 for shared strings */
+  size_t    offs_cap;
+  char     *text;
+  size_t    text_len, text_cap;
+  size_t    rows_out;    /* Rows written */
+  int       next_row;    /* Number of the row written next, rows missing before it are written empty */
+  char     *gap;         /* Block of gap_rows empty rows of gap_cols columns, see width_gap() */
+  size_t    gap_rows, gap_cap;
+  int       gap_cols;
+  int       widen;       /* Flag set when the rows written can be widened in the output file */
+  uint32_t *lens;        /* Length of each row written, when they can be widened */
+  size_t    lens_cap;
+  mz_uint64 row_start;   /* Offset in the output of the row being written */
+  WidthRun *runs;        /* Columns of the rows written, when they can be widened */
+  size_t    runs_num, runs_cap;
+  int       short_row;   /* Row wider than those written before it, when they can't be widened */
+};
+
+/*
+** State of the conversion of a sheet into CSV or JSONL
+*/
+typedef struct XLSXConv XLSXConv;
+struct XLSXConv {
+  XLSXOut  out;
+  XLSXCtx *xlsx;
+  int    format;         /* FORMAT_CSV or FORMAT_JSONL */
+  int    json_header;    /* Flag set while reading the header row, for JSONL output */
+  char **json_keys;      /* JSON escaped '"key":' prefix of each column, from the header row */
+  int    json_keys_num;
+  int    dict;           /* Flag to output shared strings as their index, and list them in a dictionary file */
+  uint8 *shrdstr_used;   /* Flags of the shared strings referenced by the sheet, for the dictionary file */
+  uint8 *shrdstr_escape; /* SHARED_ of each shared string, see shared_escape() */
+  int    shrdstr_num;
+  int    dates;          /* Flag to output date and time cells in ISO 8601 */
+  int    sheet_id;       /* Sheet to convert, 1 for the first one */
+  int    gz, gz_level, gz_threads;
+  int    first_row, last_row;  /* Range of rows to output, last_row 0 for all of them */
+  char  *in_buff;        /* Workbook read from STDIN (-if -) */
+  size_t in_cap;
+  int    stats;          /* STATS_NONE, STATS_TEXT or STATS_JSON */
+  int    perf;           /* Flag to count hardware events in each phase, for --perf-counters */
+  int    hugepages;      /* Flag to back the big buffers with huge pages, for --hugepages */
+  size_t max_memory;     /* Budget of memory of the workbook, 0 for none */
+  int    progress;       /* Flag to report the progress of each conversion on STDERR, for --progress */
+  Progress pg;
+  Width  width;          /* Width of the CSV rows */
+  mz_uint64 st_rows, st_cells[XLSX_CELL_TYPES];  /* Rows read, and cells by XLSX_CELL_ type */
+};
+
+enum { STATS_NONE, STATS_TEXT, STATS_JSON };
+
+#ifdef _MSC_VER
+#define XLSX_THREAD_LOCAL __declspec(thread)
+#else
+#define XLSX_THREAD_LOCAL __thread
+#endif
+
+/*
+** Trace of the work of every thread (--trace), written at the end as Chrome
+** trace events, for chrome://tracing or Perfetto. Each thread records its
+** spans, its own and those of the library, into a ring of its own that keeps
+** the last TRACE_EVENTS of them, so that recording takes no lock. A ring is
+** handed to the next thread of the same name once its thread is done with it,
+** and the rings are only read once all threads have been joined.
+*/
+#define TRACE_EVENTS 65536
+
+typedef struct TraceEvent TraceEvent;
+struct TraceEvent {
+  const char *name;      /* Static string */
+  uint64_t    start, end;    /* CLOCK_MONOTONIC nanoseconds */
+  uint64_t    bytes;
+};
+
+typedef struct TraceRing TraceRing;
+struct TraceRing {
+  TraceRing  *next;
+  int         tid;
+  int         busy;      /* Flag set while a thread records into the ring */
+  char        name[32];
+  uint64_t    count;     /* Spans recorded, of which the last TRACE_EVENTS are kept */
+  TraceEvent  events[TRACE_EVENTS];
+};
+
+static int trace_on;
+static uint64_t trace_epoch;
+static TraceRing *trace_rings;
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static XLSX_THREAD_LOCAL TraceRing *trace_ring;
+
+/*
+** Start of a span, 0 when not tracing
+*/
+static uint64_t trace_clock(void)
+{
+  struct timespec t;
+
+  if (!trace_on)
+    return 0;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+/*
+** Record the spans of the calling thread into the ring named name (and num,
+** if not negative), until trace_thread_exit()
+*/
+static void trace_thread(const char *name, int num)
+{
+  TraceRing *r, **link;
+  char buf[32];
+  int tid;
+
+  if (!trace_on)
+    return;
+  if (num < 0)
+    snprintf(buf, sizeof(buf), "%s", name);
+  else
+    snprintf(buf, sizeof(buf), "%s %d", name, num);
+  pthread_mutex_lock(&trace_mutex);
+  for (link = &trace_rings, tid = 1; *link; link = &(*link)->next, tid++)
+    if (!(*link)->busy && !strcmp((*link)->name, buf))
+      break;
+  r = *link;
+  if (!r) {
+    // Rings are appended, so that thread ids follow the order of creation
+    r = *link = calloc(1, sizeof(TraceRing));
+    if (!r) {
+      fprintf(stderr, "Couldn't allocate memory for trace\n");
+      exit(-1);
+    }
+    r->tid = tid;
+    memcpy(r->name, buf, sizeof(buf));
+  }
+  r->busy = 1;
+  pthread_mutex_unlock(&trace_mutex);
+  trace_ring = r;
+}
+
+static void trace_thread_exit(void)
+{
+  if (!trace_ring)
+    return;
+  pthread_mutex_lock(&trace_mutex);
+  trace_ring->busy = 0;
+  pthread_mutex_unlock(&trace_mutex);
+  trace_ring = NULL;
+}
+
+static void trace_record(const char *name, uint64_t start, uint64_t end, uint64_t bytes)
+{
+  TraceEvent *e;
+
+  if (!trace_ring)
+    trace_thread("thread", -1);
+  e = &trace_ring->events[trace_ring->count++ % TRACE_EVENTS];
+  e->name = name;
+  e->start = start;
+  e->end = end;
+  e->bytes = bytes;
+}
+
+/*
+** End a span started at start, of bytes bytes
+*/
+static void trace_span(const char *name, uint64_t start, uint64_t bytes)
+{
+  if (trace_on)
+    trace_record(name, start, trace_clock(), bytes);
+}
+
+/*
+** Spans of the library, recorded on the thread reading the workbook
+*/
+static void trace_lib(void *data, const char *name, uint64_t start, uint64_t end, uint64_t bytes)
+{
+  (void) data;
+  trace_record(name, start, end, bytes);
+}
+
+static void trace_start(void)
+{
+  trace_on = 1;
+  trace_epoch = trace_clock();
+  xlsx_set_trace(trace_lib, NULL);
+  trace_thread("main", -1);
+}
+
+/*
+** Write the rings to filename, oldest span first, with timestamps in
+** microseconds since trace_start(). Returns 0 on success, -1 on failure.
+*/
+static int trace_write(const char *filename)
+{
+  TraceRing *r;
+  TraceEvent *e;
+  uint64_t i, first;
+  FILE *f;
+  int ret;
+
+  xlsx_set_trace(NULL, NULL);
+  f = fopen(filename, "w");
+  if (!f) {
+    fprintf(stderr, "Couldn't open trace file '%s' .\n", filename);
+    return -1;
+  }
+  fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"cxlsx_to_csv\"}}");
+  for (r = trace_rings; r; r = r->next) {
+    first = (r->count > TRACE_EVENTS) ? r->count - TRACE_EVENTS : 0;
+    fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"", r->tid, r->name);
+    if (first)
+      fprintf(f, ",\"dropped\":%llu", (unsigned long long) first);
+    fprintf(f, "}}");
+    for (i = first; i < r->count; i++) {
+      e = &r->events[i % TRACE_EVENTS];
+      fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"cxlsx\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"bytes\":%llu}}",
+              e->name, r->tid, (e->start - trace_epoch) / 1e3, (e->end - e->start) / 1e3, (unsigned long long) e->bytes);
+    }
+  }
+  fprintf(f, "\n]}\n");
+  ret = ferror(f) ? -1 : 0;
+  if (fclose(f))
+    ret = -1;
+  if (ret)
+    fprintf(stderr, "Couldn't write trace file '%s' .\n", filename);
+  return ret;
+}
+
+/*
+** Flag the compressed output as failed: the compressor, its workers and the
+** writer may fail at the same time, so the flag is set under gz_mutex
+*/
+static void gz_fail(XLSXOut *out)
+{
+  pthread_mutex_lock(&out->gz_mutex);
+  out->gz_error = 1;
+  pthread_mutex_unlock(&out->gz_mutex);
+}
+
+static mz_bool gz_put_buf(const void *buf, int len, void *data)
+{
+  XLSXOut *out = data;
+
+  return fwrite(buf, 1, len, out->f) == (size_t) len;
+}
+
+static void *gz_thread_main(void *data)
+{
+  XLSXOut *out = data;
+  const char *buf;
+  size_t len;
+  uint64_t start;
+  uint8 trailer[8];
+  int i;
+
+  trace_thread("gzip", -1);
+  pthread_mutex_lock(&out->gz_mutex);
+  for (;;) {
+    while (!out->gz_pend && !out->gz_finish)
+      pthread_cond_wait(&out->gz_cond, &out->gz_mutex);
+    if (!out->gz_pend)
+      break;
+    buf = out->gz_pend;
+    len = out->gz_pend_len;
+    pthread_mutex_unlock(&out->gz_mutex);
+    start = trace_clock();
+    out->gz_crc = mz_crc32(out->gz_crc, (const mz_uint8 *) buf, len);
+    out->gz_isize += (mz_uint32) len;
+    if (tdefl_compress_buffer(out->gz_comp, buf, len, TDEFL_NO_FLUSH) != TDEFL_STATUS_OKAY)
+      gz_fail(out);
+    trace_span("deflate", start, len);
+    pthread_mutex_lock(&out->gz_mutex);
+    out->gz_pend = NULL;
+    pthread_cond_broadcast(&out->gz_cond);
+  }
+  pthread_mutex_unlock(&out->gz_mutex);
+  start = trace_clock();
+  if (tdefl_compress_buffer(out->gz_comp, NULL, 0, TDEFL_FINISH) != TDEFL_STATUS_DONE)
+    gz_fail(out);
+  for (i = 0; i < 4; i++) {
+    trailer[i]   = (uint8) (out->gz_crc >> (8 * i));
+    trailer[i+4] = (uint8) (out->gz_isize >> (8 * i));
+  }
+  if (fwrite(trailer, 1, 8, out->f) != 8)
+    gz_fail(out);
+  trace_span("deflate", start, 0);
+  trace_thread_exit();
+  return NULL;
+}
+
+/*
+** Compute the CRC-32 of two concatenated buffers out of the CRC-32 of each
+** one, and the length of the second one (as crc32_combine() in zlib).
+*/
+static mz_ulong gf2_matrix_times(const mz_ulong *mat, mz_ulong vec)
+{
+  mz_ulong sum = 0;
+
+  while (vec) {
+    if (vec & 1)
+      sum ^= *mat;
+    vec >>= 1;
+    mat++;
+  }
+  return sum;
+}
+
+static void gf2_matrix_square(mz_ulong *square, const mz_ulong *mat)
+{
+  int n;
+
+  for (n = 0; n < 32; n++)
+    square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+static mz_ulong gz_crc32_combine(mz_ulong crc1, mz_ulong crc2, size_t len2)
+{
+  int n;
+  mz_ulong row;
+  mz_ulong even[32];    /* even-power-of-two zeros operator */
+  mz_ulong odd[32];     /* odd-power-of-two zeros operator */
+
+  if (!len2)
+    return crc1;
+  odd[0] = 0xedb88320UL;  /* CRC-32 polynomial */
+  row = 1;
+  for (n = 1; n < 32; n++) {
+    odd[n] = row;
+    row <<= 1;
+  }
+  gf2_matrix_square(even, odd);  /* put operator for two zero bits in even */
+  gf2_matrix_square(odd, even);  /* put operator for four zero bits in odd */
+  do {
+    gf2_matrix_square(even, odd);
+    if (len2 & 1)
+      crc1 = gf2_matrix_times(even, crc1);
+    len2 >>= 1;
+    if (!len2)
+      break;
+    gf2_matrix_square(odd, even);
+    if (len2 & 1)
+      crc1 = gf2_matrix_times(odd, crc1);
+    len2 >>= 1;
+  } while (len2);
+  return crc1 ^ crc2;
+}
+
+static mz_bool gzp_put_buf(const void *buf, int len, void *data)
+{
+  GZWorker *w = data;
+  GZBlock *b = w->blk;
+  uint8 *zout;
+  size_t cap;
+
+  if (!b)
+    return MZ_TRUE;   /* Output of the dictionary priming is discarded */
+  if (b->zout_len + len > b->zout_cap) {
+    // On failure the block keeps its buffer, and tdefl fails the deflate
+    cap = 2 * (b->zout_len + len);
+    zout = realloc(b->zout, cap);
+    if (!zout)
+      return MZ_FALSE;
+    b->zout = zout;
+    b->zout_cap = cap;
+  }
+  memcpy(b->zout + b->zout_len, buf, len);
+  b->zout_len += len;
+  return MZ_TRUE;
+}
+
+static void *gzp_worker_main(void *data)
+{
+  GZWorker *w = data;
+  XLSXOut *out = w->out;
+  GZBlock *b;
+  tdefl_status status;
+  uint64_t start;
+
+  trace_thread("gzip worker", (int) (w - out->gz_workers) + 1);
+  for (;;) {
+    pthread_mutex_lock(&out->gz_mutex);
+    for (;;) {
+      b = &out->gz_blks[out->gz_job_seq % out->gz_nblks];
+      if ((b->state == GZ_QUEUED) || out->gz_finish)
+        break;
+      pthread_cond_wait(&out->gz_cond, &out->gz_mutex);
+    }
+    if (b->state != GZ_QUEUED) {
+      pthread_mutex_unlock(&out->gz_mutex);
+      trace_thread_exit();
+      return NULL;
+    }
+    b->state = GZ_DEFLATING;
+    out->gz_job_seq++;
+    pthread_mutex_unlock(&out->gz_mutex);
+
+    start = trace_clock();
+    tdefl_init(w->comp, gzp_put_buf, w,
+               tdefl_create_comp_flags_from_zip_params(out->gz_level, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY));
+    if (b->dict_len) {
+      // The sync flush leaves the bit stream byte aligned, so the block starts on a fresh byte
+      w->blk = NULL;
+      tdefl_compress_buffer(w->comp, b->dict, b->dict_len, TDEFL_SYNC_FLUSH);
+    }
+    w->blk = b;
+    b->zout_len = 0;
+    status = tdefl_compress_buffer(w->comp, b->in, b->in_len, b->last ? TDEFL_FINISH : TDEFL_SYNC_FLUSH);
+    if (status != (b->last ? TDEFL_STATUS_DONE : TDEFL_STATUS_OKAY))
+      gz_fail(out);
+    b->crc = mz_crc32(MZ_CRC32_INIT, (const mz_uint8 *) b->in, b->in_len);
+    trace_span("deflate", start, b->in_len);
+
+    pthread_mutex_lock(&out->gz_mutex);
+    b->state = GZ_DEFLATED;
+    pthread_cond_broadcast(&out->gz_cond);
+    pthread_mutex_unlock(&out->gz_mutex);
+  }
+}
+
+static void *gzp_writer_main(void *data)
+{
+  XLSXOut *out = data;
+  GZBlock *b;
+  uint64_t start;
+  uint8 trailer[8];
+  int i, last;
+
+  trace_thread("gzip writer", -1);
+  do {
+    pthread_mutex_lock(&out->gz_mutex);
+    b = &out->gz_blks[out->gz_write_seq % out->gz_nblks];
+    while (b->state != GZ_DEFLATED)
+      pthread_cond_wait(&out->gz_cond, &out->gz_mutex);
+    pthread_mutex_unlock(&out->gz_mutex);
+
+    start = trace_clock();
+    if (fwrite(b->zout, 1, b->zout_len, out->f) != b->zout_len)
+      gz_fail(out);
+    out->gz_crc = gz_crc32_combine(out->gz_crc, b->crc, b->in_len);
+    out->gz_isize += (mz_uint32) b->in_len;
+    last = b->last;
+    trace_span("write", start, b->zout_len);
+
+    pthread_mutex_lock(&out->gz_mutex);
+    b->state = GZ_FREE;
+    out->gz_write_seq++;
+    pthread_cond_broadcast(&out->gz_cond);
+    pthread_mutex_unlock(&out->gz_mutex);
+  } while (!last);
+
+  for (i = 0; i < 4; i++) {
+    trailer[i]   = (uint8) (out->gz_crc >> (8 * i));
+    trailer[i+4] = (uint8) (out->gz_isize >> (8 * i));
+  }
+  if (fwrite(trailer, 1, 8, out->f) != 8)
+    gz_fail(out);
+  trace_thread_exit();
+  return NULL;
+}
+
+/*
+** Allocate size bytes for the output, accounted for -stats
+*/
+static void *out_alloc(XLSXOut *out, size_t size)
+{
+  void *p;
+
+  p = calloc(1, size);
+  if (!p) {
+    fprintf(stderr, "Couldn't allocate memory for output\n");
+    exit(-1);
+  }
+  out->st_mem += size;
+  out->st_mem_allocs++;
+  return p;
+}
+
+static void gzp_open(XLSXOut *out)
+{
+  int i;
+
+  out->gz_nblks = 2 * out->gz_threads + 2;
+  out->gz_blks = out_alloc(out, out->gz_nblks * sizeof(GZBlock));
+  out->gz_workers = out_alloc(out, out->gz_threads * sizeof(GZWorker));
+  for (i = 0; i < out->gz_nblks; i++)
+    out->gz_blks[i].in = out_alloc(out, OUTBUFSIZE);
+  out->gz_fill_seq = out->gz_job_seq = out->gz_write_seq = 0;
+  out->ptr = out->gz_blks[0].in;
+  out->end = out->ptr + OUTBUFSIZE;
+  for (i = 0; i < out->gz_threads; i++) {
+    out->gz_workers[i].out = out;
+    out->gz_workers[i].comp = out_alloc(out, sizeof(tdefl_compressor));
+    if (pthread_create(&out->gz_workers[i].thread, NULL, gzp_worker_main, &out->gz_workers[i])) {
+      fprintf(stderr, "Couldn't start compressing thread\n");
+      exit(-1);
+    }
+  }
+  if (pthread_create(&out->gz_writer, NULL, gzp_writer_main, out)) {
+    fprintf(stderr, "Couldn't start compressing thread\n");
+    exit(-1);
+  }
+}
+
+/*
+** Queue the block being filled, and continue in the next one of the ring once
+** it has been written out. Its dictionary is the tail of the queued block.
+*/
+static void gzp_submit(XLSXOut *out, int last)
+{
+  GZBlock *b, *next;
+  size_t keep;
+
+  b = &out->gz_blks[out->gz_fill_seq % out->gz_nblks];
+  b->in_len = out->ptr - b->in;
+  b->last = last;
+  if (!last) {
+    next = &out->gz_blks[(out->gz_fill_seq + 1) % out->gz_nblks];
+    pthread_mutex_lock(&out->gz_mutex);
+    while (next->state != GZ_FREE)
+      pthread_cond_wait(&out->gz_cond, &out->gz_mutex);
+    pthread_mutex_unlock(&out->gz_mutex);
+    if (b->in_len >= GZ_DICT_SIZE) {
+      memcpy(next->dict, b->in + b->in_len - GZ_DICT_SIZE, GZ_DICT_SIZE);
+      next->dict_len = GZ_DICT_SIZE;
+    }
+    else {
+      keep = (b->dict_len < GZ_DICT_SIZE - b->in_len) ? b->dict_len : GZ_DICT_SIZE - b->in_len;
+      memcpy(next->dict, b->dict + b->dict_len - keep, keep);
+      memcpy(next->dict + keep, b->in, b->in_len);
+      next->dict_len = keep + b->in_len;
+    }
+  }
+  pthread_mutex_lock(&out->gz_mutex);
+  b->state = GZ_QUEUED;
+  if (last)
+    out->gz_finish = 1;
+  pthread_cond_broadcast(&out->gz_cond);
+  pthread_mutex_unlock(&out->gz_mutex);
+  if (!last) {
+    out->gz_fill_seq++;
+    out->ptr = next->in;
+    out->end = out->ptr + OUTBUFSIZE;
+  }
+}
+
+static void gzp_close(XLSXOut *out)
+{
+  int i;
+
+  gzp_submit(out, 1);
+  pthread_join(out->gz_writer, NULL);
+  for (i = 0; i < out->gz_threads; i++) {
+    pthread_join(out->gz_workers[i].thread, NULL);
+    free(out->gz_workers[i].comp);
+  }
+  for (i = 0; i < out->gz_nblks; i++) {
+    // Deflated data grows on the compressing threads, and is accounted here
+    out->st_mem += out->gz_blks[i].zout_cap;
+    free(out->gz_blks[i].in);
+    free(out->gz_blks[i].zout);
+  }
+  free(out->gz_workers);
+  free(out->gz_blks);
+}
+
+static void out_open(XLSXOut *out, FILE *f, int gz, int gz_level, int gz_threads)
+{
+  // gzip header: magic, deflate method, no flags, no mtime, no extra flags, Unix OS
+  static const uint8 gz_header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+
+  out->f = f;
+  out->gz = gz;
+  out->gz_level = gz_level;
+  out->gz_threads = gz ? gz_threads : 1;
+  out->cur = 0;
+  out->gz_pend = NULL;
+  out->gz_finish = 0;
+  out->gz_error = 0;
+  out->error = 0;
+  out->written = 0;
+  out->st_wall = out->st_cpu = 0;
+  out->st_bytes = 0;
+  memset(out->st_perf, 0, sizeof(out->st_perf));
+  out->st_mem = out->st_mem_allocs = 0;
+  out->gz_crc = MZ_CRC32_INIT;
+  out->gz_isize = 0;
+  if (gz && (fwrite(gz_header, 1, sizeof(gz_header), f) != sizeof(gz_header)))
+    out->error = 1;
+  pthread_mutex_init(&out->gz_mutex, NULL);
+  pthread_cond_init(&out->gz_cond, NULL);
+  if (out->gz_threads > 1) {
+    gzp_open(out);
+    return;
+  }
+  // Blocks and compressor are kept by out_close(), for the next file
+  if (!out->blk[0])
+    out->blk[0] = out_alloc(out, OUTBUFSIZE);
+  if (gz && !out->blk[1])
+    out->blk[1] = out_alloc(out, OUTBUFSIZE);
+  out->st_mem = gz ? 2 * OUTBUFSIZE : OUTBUFSIZE;
+  out->ptr = out->blk[0];
+  out->end = out->blk[0] + OUTBUFSIZE;
+  if (!gz)
+    return;
+
+  if (!out->gz_comp)
+    out->gz_comp = out_alloc(out, sizeof(tdefl_compressor));
+  out->st_mem += sizeof(tdefl_compressor);
+  // Negative window bits make tdefl emit raw deflate data, with no zlib header
+  tdefl_init(out->gz_comp, gz_put_buf, out,
+             tdefl_create_comp_flags_from_zip_params(gz_level, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY));
+  if (pthread_create(&out->gz_thread, NULL, gz_thread_main, out)) {
+    fprintf(stderr, "Couldn't start compressing thread\n");
+    exit(-1);
+  }
+}
+
+/*
+** Hand over the current block: write it, or queue it for the compressing
+** thread and continue in the other block once that thread is idle.
+*/
+static void out_flush_block(XLSXOut *out)
+{
+  size_t len;
+
+  if (out->gz_threads > 1) {
+    gzp_submit(out, 0);
+    return;
+  }
+  len = out->ptr - out->blk[out->cur];
+  if (!out->gz) {
+    out->written += len;
+    // After a write error the rest of the output is discarded, and out_close() fails
+    if (len && !out->error && (fwrite(out->blk[0], 1, len, out->f) != len))
+      out->error = 1;
+    out->ptr = out->blk[0];
+    return;
+  }
+  if (!len)
+    return;
+  pthread_mutex_lock(&out->gz_mutex);
+  while (out->gz_pend)
+    pthread_cond_wait(&out->gz_cond, &out->gz_mutex);
+  out->gz_pend = out->blk[out->cur];
+  out->gz_pend_len = len;
+  pthread_cond_broadcast(&out->gz_cond);
+  pthread_mutex_unlock(&out->gz_mutex);
+  out->cur ^= 1;
+  out->ptr = out->blk[out->cur];
+  out->end = out->ptr + OUTBUFSIZE;
+}
+
+static int out_close_block(XLSXOut *out)
+{
+  if (out->gz_threads > 1)
+    gzp_close(out);
+  else {
+    out_flush_block(out);
+    if (out->gz) {
+      pthread_mutex_lock(&out->gz_mutex);
+      out->gz_finish = 1;
+      pthread_cond_broadcast(&out->gz_cond);
+      pthread_mutex_unlock(&out->gz_mutex);
+      pthread_join(out->gz_thread, NULL);
+    }
+  }
+  // The threads are joined, so gz_error is read without the lock
+  pthread_mutex_destroy(&out->gz_mutex);
+  pthread_cond_destroy(&out->gz_cond);
+  if (out->gz_error) {
+    fprintf(stderr, "Couldn't compress output file\n");
+    return -1;
+  }
+  if (fflush(out->f) || out->error) {
+    fprintf(stderr, "Couldn't write output file\n");
+    return -1;
+  }
+  return 0;
+}
+
+/*
+** Time spent in the output, for -stats
+*/
+typedef struct OutTime OutTime;
+struct OutTime {
+  struct timespec wall, cpu;
+  uint64_t perf[XLSX_PERF_COUNTERS];
 };
 
+static void out_time_start(XLSXOut *out, OutTime *t)
+{
+  clock_gettime(CLOCK_MONOTONIC, &t->wall);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t->cpu);
+  if (out->st_perf_ctx && xlsx_perf_read(out->st_perf_ctx, t->perf))
+    memset(t->perf, 0, sizeof(t->perf));
+  out->st_bytes += OUTBUFSIZE - (out->end - out->ptr);
+}
+
+static void out_time_stop(XLSXOut *out, const OutTime *t)
+{
+  struct timespec wall, cpu;
+  uint64_t perf[XLSX_PERF_COUNTERS];
+  int i;
+
+  if (out->st_perf_ctx && !xlsx_perf_read(out->st_perf_ctx, perf))
+    for (i = 0; i < XLSX_PERF_COUNTERS; i++)
+      out->st_perf[i] += perf[i] - t->perf[i];
+  clock_gettime(CLOCK_MONOTONIC, &wall);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+  out->st_wall += (wall.tv_sec - t->wall.tv_sec) + (wall.tv_nsec - t->wall.tv_nsec) * 1e-9;
+  out->st_cpu += (cpu.tv_sec - t->cpu.tv_sec) + (cpu.tv_nsec - t->cpu.tv_nsec) * 1e-9;
+}
+
+static void out_flush(XLSXOut *out)
+{
+  OutTime t;
+  uint64_t start;
+  size_t len;
+
+  // Handing over a block includes waiting for the compressing threads
+  start = trace_clock();
+  len = OUTBUFSIZE - (out->end - out->ptr);
+  if (!out->stats)
+    out_flush_block(out);
+  else {
+    out_time_start(out, &t);
+    out_flush_block(out);
+    out_time_stop(out, &t);
+  }
+  trace_span("flush", start, len);
+}
+
+/*
+** Flush the output. Returns 0 on success, -1 if it could not be written.
+*/
+static int out_close(XLSXOut *out)
+{
+  OutTime t;
+  uint64_t start;
+  size_t len;
+  int ret;
 
-/*  
-    XLSX files are zip files which contain several xml files with data:
- _rels/.rels
- docProps/app.xml
- docProps/core.xml
- xl/_rels/workbook.xml.rels
- xl/sharedStrings.xml
- xl/worksheets/sheet2.xml
- xl/worksheets/sheet1.xml
- xl/styles.xml
- xl/workbook.xml
- [Content_Types].xml
-
-  The name of each sheet is in xl/workbook.xml
-  The individual sheets are kept in xl/worksheets/sheet1.xml
-  To save on space, Microsoft stores all the character literal values in one common xl/sharedStrings.xml dictionary file. The individual cell value found for this string in the actual sheet1.xml file is just an index into this dictionary.
-  OLEDB created xlsx use inline strings instead of shared ones.
-  Some brief tutorial: http://openxmldeveloper.org/files/1928/download.aspx
-  Dates are stored as day number since 1900/01/01.
-  Time portion of the date is stored as a fraction of a day, so it has to be multiplied by 60*60*24 (86400) to get the actual number os seconds.
-  Microsoft does not store empty cells or rows in xl/worksheets/sheet1.xml, so any gaps between values have to be taken care by the code.
-  To figure out the number of skipped columns one need to be able to figure out the distance between, say, cell "AB67" and "C67". The way columns are named: A through Z, then AA through AZ, then AAA through AAZ, etc., suggests that we may assume they are using a base-26 system and therefore use a simple conversion method from a base-26 to the decimal system and then use subtraction to find out the number of commas between columns.
-    
--------------------------------------------------------------------------
-xl/sharedStrings.xml has in "sst:uniqueCount" a count of the number of unique strings
-unzip -c 3x2.xlsx xl/sharedStrings.xml | tidy -indent -xml
--------------------------------------------------------------------------
-<sst count="9" uniqueCount="5">
-  <si>
-    <t>Col1</t>
-  </si>
-  <si>
-    <t>Col2</t>
-  </si>
-  <si>
-    <t>Col3</t>
-  </si>
-  <si>
-    <t>a</t>
-  </si>
-  <si>
-    <t>b</t>
-  </si>
-  <si>
-    <t>c</t>
-  </si>
-</sst>
--------------------------------------------------------------------------
-
--------------------------------------------------------------------------
-xl/worksheets/sheet1.xml has in "dimension:ref" the enclosing range of cells used
-unzip -c 3x2.xlsx xl/worksheets/sheet1.xml | tidy -indent -xml
--------------------------------------------------------------------------
-<worksheet>
-  <dimension ref="A1:C3" />
-  <sheetData>
-    <row r="1" spans="1:3">
-      <c r="A1" t="s">
-        <v>0</v>
-      </c>
-      <c r="B1" t="s">
-        <v>1</v>
-      </c>
-      <c r="C1" t="s">
-        <v>27.344</v>
-      </c>
-    </row>
-    <row r="2" spans="1:3">
-      <c r="A2" t="s">
-        <v>3</v>
-      </c>
-      <c r="B2" s="1">
-        <v>42283</v>
-      </c>
-      <c r="C2" t="s">
-        <v>3</v>
-      </c>
-    </row>
-    <row r="3">
-      <c r="A3" t="inlineStr">
-        <is>
-          <t>some value</t>
-        </is>
-      </c>
-      <c r="B4" t="inlineStr">
-        <is>
-          <t>some other value</t>
-        </is>
-      </c>
-      <c r="C4" t="inlineStr">
-        <is>
-          <t>yet some value</t>
-        </is>
-      </c>
-    </row>
-  </sheetData>
-</worksheet>
--------------------------------------------------------------------------
-
--------------------------------------------------------------------------
-xl/styles.xml
--------------------------------------------------------------------------
-<styleSheet>
-  <numFmts count="10">
-    <numFmt numFmtId="164" formatCode="GENERAL" />
-    <numFmt numFmtId="165" formatCode="DD/MM/YY" />
-    <numFmt numFmtId="166" formatCode="DD/MM/YYYY" />
-    <numFmt numFmtId="167" formatCode="D&quot; de &quot;MMM&quot; de &quot;YY" />
-    <numFmt numFmtId="168" formatCode="D&quot; de &quot;MMM&quot; de &quot;YYYY" />
-    <numFmt numFmtId="169" formatCode="DDDD, MMMM\ DD&quot;, &quot;YYYY" />
-    <numFmt numFmtId="170" formatCode="YYYY\-MM\-DD" />
-    <numFmt numFmtId="171" formatCode="YYYY\-MM\-DD" />
-    <numFmt numFmtId="172" formatCode="DDDD, D\ MMMM\ YYYY" />
-    <numFmt numFmtId="173" formatCode="YYYY\-MM\-DD\ HH:MM:SS.SSS" />
-  </numFmts>
-</styleSheet>
--------------------------------------------------------------------------
+  start = trace_clock();
+  len = OUTBUFSIZE - (out->end - out->ptr);
+  if (!out->stats)
+    ret = out_close_block(out);
+  else {
+    out_time_start(out, &t);
+    ret = out_close_block(out);
+    out_time_stop(out, &t);
+  }
+  trace_span("close", start, len);
+  return ret;
+}
 
+/*
+** Free the blocks and compressor kept by out_close()
+*/
+static void out_free(XLSXOut *out)
+{
+  free(out->gz_comp);
+  free(out->blk[1]);
+  free(out->blk[0]);
+  out->gz_comp = NULL;
+  out->blk[0] = out->blk[1] = NULL;
+}
 
+static inline void out_putc(XLSXOut *out, char c)
+{
+  if (out->ptr == out->end)
+    out_flush(out);
+  *out->ptr++ = c;
+}
 
+/*
+** Offset in the plain output of the next byte written
 */
+static inline mz_uint64 out_tell(const XLSXOut *out)
+{
+  return out->written + (out->ptr - out->blk[out->cur]);
+}
+
+static inline void out_write(XLSXOut *out, const char *s, size_t len)
+{
+  size_t n;
+
+  while (len) {
+    if (out->ptr == out->end)
+      out_flush(out);
+    n = out->end - out->ptr;
+    if (n > len)
+      n = len;
+    memcpy(out->ptr, s, n);
+    out->ptr += n;
+    s += n;
+    len -= n;
+  }
+}
 
 /* CSV escaping:
   If a cell value contains a comma or a line feed, the entire value has to be enclosed in doublequotes.
@@ -269,507 +1093,1800 @@ static const char needCsvQuote[] = {
 };
 
 /*
-** Output a single term of CSV.  Actually, colSeparator is used for
-** the separator, which may or may not be a comma.  "" is
-** the null value.  Strings are quoted if necessary.  The separator
-** is only issued if bSep is true.
+** Offset of the first of the len characters at z that needs quoting for CSV,
+** with separator sep, or len when none does. The variants for wider vectors
+** are chosen at startup, by xlsx_cpu_level(): each one compares a vector of
+** characters at once against the ones of needCsvQuote, that are those below
+** '!' (signed, so also those from 0x80 up), '"', '\'', DEL and sep.
+*/
+static int csv_scan_scalar(const char *z, int len, char sep)
+{
+  int i;
+
+  for (i=0; i<len; i++) {
+    if (needCsvQuote[((unsigned char*)z)[i]] || (z[i]==sep))
+      break;
+  }
+  return i;
+}
+
+#ifdef XLSX_X86_DISPATCH
+XLSX_TARGET("sse4.2")
+static inline int csv_scan_sse42(const char *z, int len, char sep)
+{
+  const __m128i lt = _mm_set1_epi8('!'), dq = _mm_set1_epi8('"'), sq = _mm_set1_epi8('\'');
+  const __m128i del = _mm_set1_epi8(0x7f), sp = _mm_set1_epi8(sep);
+  __m128i x;
+  int i, m;
+
+  for (i = 0; i + 16 <= len; i += 16) {
+    x = _mm_loadu_si128((const __m128i *) (z + i));
+    m = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmplt_epi8(x, lt), _mm_cmpeq_epi8(x, dq)),
+                                       _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, sq), _mm_cmpeq_epi8(x, del)),
+                                                    _mm_cmpeq_epi8(x, sp))));
+    if (m)
+      return i + __builtin_ctz(m);
+  }
+  return i + csv_scan_scalar(z + i, len - i, sep);
+}
+
+XLSX_TARGET("avx2")
+static int csv_scan_avx2(const char *z, int len, char sep)
+{
+  const __m256i lt = _mm256_set1_epi8('!'), dq = _mm256_set1_epi8('"'), sq = _mm256_set1_epi8('\'');
+  const __m256i del = _mm256_set1_epi8(0x7f), sp = _mm256_set1_epi8(sep);
+  __m256i x;
+  int i, m;
+
+  for (i = 0; i + 32 <= len; i += 32) {
+    x = _mm256_loadu_si256((const __m256i *) (z + i));
+    m = _mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(_mm256_cmpgt_epi8(lt, x), _mm256_cmpeq_epi8(x, dq)),
+                                             _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x, sq), _mm256_cmpeq_epi8(x, del)),
+                                                             _mm256_cmpeq_epi8(x, sp))));
+    if (m)
+      return i + __builtin_ctz(m);
+  }
+  return i + csv_scan_sse42(z + i, len - i, sep);
+}
+
+// Masked loads do not touch the characters past len, so that short fields take a single compare too
+XLSX_TARGET("avx512f,avx512bw")
+static int csv_scan_avx512(const char *z, int len, char sep)
+{
+  const __m512i lt = _mm512_set1_epi8('!'), dq = _mm512_set1_epi8('"'), sq = _mm512_set1_epi8('\'');
+  const __m512i del = _mm512_set1_epi8(0x7f), sp = _mm512_set1_epi8(sep);
+  __mmask64 k, m;
+  __m512i x;
+  int i;
+
+  for (i = 0; i < len; i += 64) {
+    k = (len - i >= 64) ? ~(__mmask64) 0 : ((__mmask64) 1 << (len - i)) - 1;
+    x = _mm512_maskz_loadu_epi8(k, z + i);
+    m = _mm512_mask_cmplt_epi8_mask(k, x, lt) | _mm512_mask_cmpeq_epi8_mask(k, x, dq) |
+        _mm512_mask_cmpeq_epi8_mask(k, x, sq) | _mm512_mask_cmpeq_epi8_mask(k, x, del) |
+        _mm512_mask_cmpeq_epi8_mask(k, x, sp);
+    if (m)
+      return i + __builtin_ctzll(m);
+  }
+  return len;
+}
+#endif /* XLSX_X86_DISPATCH */
+
+static int (*csv_scan)(const char *z, int len, char sep) = csv_scan_scalar;
+
+static void csv_scan_select(int level)
+{
+  switch (level) {
+#ifdef XLSX_X86_DISPATCH
+    case XLSX_CPU_AVX512: csv_scan = csv_scan_avx512; break;
+    case XLSX_CPU_AVX2:   csv_scan = csv_scan_avx2; break;
+    case XLSX_CPU_SSE42:  csv_scan = csv_scan_sse42; break;
+#endif /* XLSX_X86_DISPATCH */
+    default:              csv_scan = csv_scan_scalar; break;
+  }
+}
+
+#ifdef __GNUC__
+__attribute__((constructor))
+static void csv_scan_dispatch(void)
+{
+  csv_scan_select(xlsx_cpu_level());
+}
+#endif /* __GNUC__ */
+
+/*
+** Output a single term of CSV, the len characters at z.  Actually,
+** colSeparator is used for the separator, which may or may not be a
+** comma.  "" is the null value.  Strings are quoted if necessary.
+** The separator is only issued if bSep is true.
+*/
+static inline void output_csv_quoted(XLSXOut *out, const char *z, int len)
+{
+  int i;
+
+  out_putc(out, '"');
+  for (i=0; i<len; i++) {
+    if (z[i]=='"')
+      out_putc(out, '"');
+    out_putc(out, z[i]);
+  }
+  out_putc(out, '"');
+}
+
+static inline void output_csv(XLSXOut *out, const char colSeparator, const char *z, int len, int bSep)
+{
+  if (csv_scan(z, len, colSeparator)<len) {
+    output_csv_quoted(out, z, len);
+  } else {
+    out_write(out, z, len);
+  }
+  if (bSep) {
+    out_putc(out, colSeparator);
+  }
+}
+
+/*
+** If a character is identified by a 1 in the following array, then it
+** must be escaped inside a JSON string.
+*/
+static const char needJsonEscape[] = {
+  1, 1, 1, 1, 1, 1, 1, 1,   1, 1, 1, 1, 1, 1, 1, 1,   
+  1, 1, 1, 1, 1, 1, 1, 1,   1, 1, 1, 1, 1, 1, 1, 1,   
+  0, 0, 1, 0, 0, 0, 0, 0,   0, 0, 0, 0, 0, 0, 0, 0, 
+  0, 0, 0, 0, 0, 0, 0, 0,   0, 0, 0, 0, 0, 0, 0, 0, 
+  0, 0, 0, 0, 0, 0, 0, 0,   0, 0, 0, 0, 0, 0, 0, 0, 
+  0, 0, 0, 0, 0, 0, 0, 0,   0, 0, 0, 0, 1, 0, 0, 0, 
+  0, 0, 0, 0, 0, 0, 0, 0,   0, 0, 0, 0, 0, 0, 0, 0, 
+  0, 0, 0, 0, 0, 0, 0, 0,   0, 0, 0, 0, 0, 0, 0, 0, 
+  0, 0, 0, 0, 0, 0, 0, 0,   0, 0, 0, 0, 0, 0, 0, 0,   
+  0, 0, 0, 0, 0, 0, 0, 0,   0, 0, 0, 0, 0, 0, 0, 0,   
+  0, 0, 0, 0, 0, 0, 0, 0,   0, 0, 0, 0, 0, 0, 0, 0,   
+  0, 0, 0, 0, 0, 0, 0, 0,   0, 0, 0, 0, 0, 0, 0, 0,   
+  0, 0, 0, 0, 0, 0, 0, 0,   0, 0, 0, 0, 0, 0, 0, 0,   
+  0, 0, 0, 0, 0, 0, 0, 0,   0, 0, 0, 0, 0, 0, 0, 0,   
+  0, 0, 0, 0, 0, 0, 0, 0,   0, 0, 0, 0, 0, 0, 0, 0,   
+  0, 0, 0, 0, 0, 0, 0, 0,   0, 0, 0, 0, 0, 0, 0, 0,   
+};
+
+/*
+** Write into dst the JSON escape sequence of character c, and return its length.
+*/
+static inline int json_escape_char(char *dst, unsigned char c)
+{
+  static const char hex[] = "0123456789abcdef";
+
+  dst[0] = '\\';
+  switch (c) {
+    case '"':  dst[1] = '"';  return 2;
+    case '\\': dst[1] = '\\'; return 2;
+    case '\n': dst[1] = 'n';  return 2;
+    case '\r': dst[1] = 'r';  return 2;
+    case '\t': dst[1] = 't';  return 2;
+    case '\b': dst[1] = 'b';  return 2;
+    case '\f': dst[1] = 'f';  return 2;
+  }
+  memcpy(dst + 1, "u00", 3);
+  dst[4] = hex[c >> 4];
+  dst[5] = hex[c & 15];
+  return 6;
+}
+
+/*
+** Output the len characters at z as a quoted JSON string. Runs of characters
+** that need no escaping are written at once.
+*/
+static inline void output_json_str(XLSXOut *out, const char *z, int len)
+{
+  const char *p, *end = z + len;
+  char esc[6];
+
+  out_putc(out, '"');
+  for (;;) {
+    for (p = z; (p < end) && !needJsonEscape[*(unsigned char *) p]; p++)
+      ;
+    out_write(out, z, p - z);
+    if (p == end)
+      break;
+    out_write(out, esc, json_escape_char(esc, *(unsigned char *) p));
+    z = p + 1;
+  }
+  out_putc(out, '"');
+}
+
+/*
+** Set the '"key":' prefix of a column, JSON escaped once for all the rows.
+*/
+static void json_set_key(XLSXConv *conv, int col, const char *z, int len)
+{
+  char *key, *dst;
+  int n;
+
+  if (col >= conv->json_keys_num) {
+    n = (col + 1 > 2 * conv->json_keys_num) ? col + 1 : 2 * conv->json_keys_num;
+    conv->json_keys = realloc(conv->json_keys, sizeof(char *) * n);
+    if (!conv->json_keys) {
+      fprintf(stderr, "Couldn't allocate memory for JSON keys\n");
+      exit(-1);
+    }
+    memset(conv->json_keys + conv->json_keys_num, 0, sizeof(char *) * (n - conv->json_keys_num));
+    conv->json_keys_num = n;
+  }
+  key = malloc(6 * len + 4);
+  if (!key) {
+    fprintf(stderr, "Couldn't allocate memory for JSON keys\n");
+    exit(-1);
+  }
+  dst = key;
+  *dst++ = '"';
+  for (; len--; z++) {
+    if (needJsonEscape[*(unsigned char *) z])
+      dst += json_escape_char(dst, *(unsigned char *) z);
+    else
+      *dst++ = *z;
+  }
+  memcpy(dst, "\":", 3);
+  free(conv->json_keys[col]);
+  conv->json_keys[col] = key;
+}
+
+/*
+** Get the '"key":' prefix of a column. Columns that had no value in the
+** header row are keyed by their name (A, B, ..., AA, ...).
+*/
+static const char *json_get_key(XLSXConv *conv, int col)
+{
+  char name[8];
+  int i, n;
+
+  if ((col >= conv->json_keys_num) || !conv->json_keys[col]) {
+    i = sizeof(name) - 1;
+    name[i] = 0;
+    for (n = col; (n > 0) && (i > 0); n = (n - 1) / 26)
+      name[--i] = 'A' + (n - 1) % 26;
+    json_set_key(conv, col, name + i, sizeof(name) - 1 - i);
+  }
+  return conv->json_keys[col];
+}
+
+/*
+** Whether the shared string of cell needs quoting for CSV, or escaping for
+** JSON: it is scanned on its first use only, sheets repeating their strings.
+*/
+enum { SHARED_UNKNOWN, SHARED_PLAIN, SHARED_ESCAPE };
+
+static inline int shared_escape(XLSXConv *conv, const XLSXCell *cell)
+{
+  uint8 *f;
+  int i;
+
+  if (cell->index >= conv->shrdstr_num)
+    return 0;
+  f = &conv->shrdstr_escape[cell->index];
+  if (*f == SHARED_UNKNOWN) {
+    if (conv->format == FORMAT_CSV)
+      i = csv_scan(cell->ptr, cell->len, ',');
+    else
+      for (i = 0; (i < cell->len) && !needJsonEscape[(unsigned char) cell->ptr[i]]; i++)
+        ;
+    *f = (i < cell->len) ? SHARED_ESCAPE : SHARED_PLAIN;
+  }
+  return *f == SHARED_ESCAPE;
+}
+
+/*
+** Output of rows, pushed by xlsx_sheet_rows(), each cell by its type
+*/
+static inline void emit_csv(XLSXConv *conv, const XLSXRow *row, int num_cols)
+{
+  const XLSXCell *cell;
+  char date[32], index[16];
+  int i, j, n, expected_col;
+
+  expected_col = 1;
+  for (i = 0; i < row->num_cells; i++) {
+    cell = &row->cells[i];
+    for (j = expected_col; (j<cell->col)&&(j<num_cols); j++)
+      out_putc(&conv->out, ',');
+    expected_col = cell->col+1;
+    switch (cell->type) {
+      case XLSX_CELL_SHARED:
+        if (conv->dict) {
+          // In dictionary mode the index itself is output, digits never need quoting
+          if (cell->index < conv->shrdstr_num)
+            conv->shrdstr_used[cell->index] = 1;
+          out_write(&conv->out, index, sprintf(index, "%d", cell->index));
+        }
+        else if (shared_escape(conv, cell))
+          output_csv_quoted(&conv->out, cell->ptr, cell->len);
+        else
+          out_write(&conv->out, cell->ptr, cell->len);
+        break;
+      case XLSX_CELL_DATE:
+        if (conv->dates && (n = xlsx_format_date(conv->xlsx, cell, date))) {
+          out_write(&conv->out, date, n);
+          break;
+        }
+        // Fall through - without -dates, as a number
+      case XLSX_CELL_NUMBER:
+        // Digits, '.', '-', '+' and 'E' never need quoting
+        out_write(&conv->out, cell->ptr, cell->len);
+        break;
+      case XLSX_CELL_BOOL:
+        if (cell->len)
+          out_write(&conv->out, (*cell->ptr == '0') ? "FALSE" : "TRUE", (*cell->ptr == '0') ? 5 : 4);
+        break;
+      default:
+        output_csv(&conv->out, ',', cell->ptr, cell->len, 0);
+        break;
+    }
+    if (cell->col < num_cols)
+      out_putc(&conv->out, ',');
+  }
+  for (j = expected_col; j<num_cols; j++)
+    out_putc(&conv->out, ',');
+  out_write(&conv->out, "\r\x0A", 2);
+  // TODO: Check if \r\x0A portable between Windows & UNIX
+}
+
+static inline void emit_jsonl(XLSXConv *conv, const XLSXRow *row)
+{
+  const XLSXCell *cell;
+  const char *key;
+  char date[32], index[16];
+  int i, n, len;
+
+  if (conv->json_header) {
+    // Keys are the text of the header cells, as the CSV output shows them
+    for (i = 0; i < row->num_cells; i++) {
+      cell = &row->cells[i];
+      key = cell->ptr;
+      len = cell->len;
+      switch (cell->type) {
+        case XLSX_CELL_DATE:
+          if (conv->dates && (n = xlsx_format_date(conv->xlsx, cell, date))) {
+            key = date;
+            len = n;
+          }
+          break;
+        case XLSX_CELL_BOOL:
+          if (cell->len) {
+            key = (*cell->ptr == '0') ? "FALSE" : "TRUE";
+            len = (*cell->ptr == '0') ? 5 : 4;
+          }
+          break;
+      }
+      json_set_key(conv, cell->col, key, len);
+    }
+    conv->json_header = 0;
+    return;
+  }
+  out_putc(&conv->out, '{');
+  for (i = 0; i < row->num_cells; i++) {
+    cell = &row->cells[i];
+    if (i)
+      out_putc(&conv->out, ',');
+    key = json_get_key(conv, cell->col);
+    out_write(&conv->out, key, strlen(key));
+    switch (cell->type) {
+      case XLSX_CELL_SHARED:
+        if (conv->dict) {
+          if (cell->index < conv->shrdstr_num)
+            conv->shrdstr_used[cell->index] = 1;
+          out_write(&conv->out, index, sprintf(index, "%d", cell->index));
+        }
+        else if (shared_escape(conv, cell))
+          output_json_str(&conv->out, cell->ptr, cell->len);
+        else {
+          out_putc(&conv->out, '"');
+          out_write(&conv->out, cell->ptr, cell->len);
+          out_putc(&conv->out, '"');
+        }
+        break;
+      case XLSX_CELL_DATE:
+        if (conv->dates && (n = xlsx_format_date(conv->xlsx, cell, date))) {
+          output_json_str(&conv->out, date, n);
+          break;
+        }
+        // Fall through - without -dates, as a number
+      case XLSX_CELL_NUMBER:
+        if (cell->len)
+          out_write(&conv->out, cell->ptr, cell->len);
+        else
+          out_write(&conv->out, "\"\"", 2);
+        break;
+      case XLSX_CELL_BOOL:
+        if (cell->len)
+          out_write(&conv->out, (*cell->ptr == '0') ? "false" : "true", (*cell->ptr == '0') ? 5 : 4);
+        else
+          out_write(&conv->out, "\"\"", 2);
+        break;
+      default:
+        output_json_str(&conv->out, cell->ptr, cell->len);
+        break;
+    }
+  }
+  out_write(&conv->out, "}\n", 2);
+}
+
+/*
+** Width of the CSV rows.
+** It is the one of the <dimension ref> of the sheet. Without it, the rows are
+** held in a compact copy, their cells and the text of their values (as the
+** library queues the rows it pulls), until WIDTH_ROWS rows or WIDTH_BYTES of
+** text are held: the widest of them, by its cells or its spans attribute, sets
+** the width, and they are written before the rest are streamed.
+** A row found wider later widens the rows written from it on. When the output
+** is a plain file open for reading too, the length of every row written is
+** kept, and once the sheet is done width_widen() inserts the commas missing
+** from the narrower rows, in place. Other outputs keep them narrower, with a
+** warning.
+*/
+static void *width_grow(void *p, size_t *cap, size_t need, size_t size)
+{
+  if (need <= *cap)
+    return p;
+  *cap = *cap ? 2 * *cap : 256;
+  if (*cap < need)
+    *cap = need;
+  if (!(p = realloc(p, *cap * size))) {
+    fprintf(stderr, "Couldn't allocate memory for rows\n");
+    exit(-1);
+  }
+  return p;
+}
+
+static inline int row_width(const XLSXRow *row)
+{
+  int n;
+
+  // Cells are in column order
+  n = row->num_cells ? row->cells[row->num_cells - 1].col : 0;
+  return (row->span > n) ? row->span : n;
+}
+
+/*
+** Commas of a CSV row of cols columns, an empty row has none
+*/
+static inline int width_commas(int cols)
+{
+  return cols ? cols - 1 : 0;
+}
+
+static void width_reset(XLSXConv *conv, FILE *outf)
+{
+  Width *w = &conv->width;
+#ifndef _WIN32
+  struct stat st;
+#endif /* Not(_WIN32) */
+
+  w->cols = 0;
+  w->ahead = -1;
+  w->rows_num = w->cells_num = 0;
+  w->text_len = 0;
+  w->rows_out = 0;
+  w->next_row = (conv->first_row > 1) ? conv->first_row : 1;
+  w->row_start = 0;
+  w->runs_num = 0;
+  w->short_row = 0;
+  w->widen = 0;
+#ifndef _WIN32
+  // The rows are widened in place, in an empty file open for reading and writing
+  w->widen = (conv->format == FORMAT_CSV) && !conv->gz &&
+             !fstat(fileno(outf), &st) && S_ISREG(st.st_mode) && !st.st_size &&
+             ((fcntl(fileno(outf), F_GETFL) & O_ACCMODE) == O_RDWR);
+#endif /* Not(_WIN32) */
+}
+
+static void width_free(Width *w)
+{
+  free(w->rows);
+  free(w->cells);
+  free(w->offs);
+  free(w->text);
+  free(w->gap);
+  free(w->lens);
+  free(w->runs);
+}
+
+/*
+** Start a run of rows of the current width, if they may be widened later
+*/
+static inline void width_run(Width *w)
+{
+  if (!w->widen || (w->runs_num && (w->runs[w->runs_num - 1].cols == w->cols)))
+    return;
+  w->runs = width_grow(w->runs, &w->runs_cap, w->runs_num + 1, sizeof(WidthRun));
+  w->runs[w->runs_num].first = w->rows_out;
+  w->runs[w->runs_num++].cols = w->cols;
+}
+
+/*
+** Write n empty rows, for the rows that Excel leaves out of the sheet. They
+** are copied from a block of empty rows built once for the width, so that
+** a gap of thousands of rows takes a few memcpy.
+*/
+static void width_gap(XLSXConv *conv, int n)
+{
+  Width *w = &conv->width;
+  size_t len, i, k;
+
+  len = width_commas(w->cols) + 2;
+  if (!w->gap_rows || (w->gap_cols != w->cols)) {
+    w->gap_rows = (len < WIDTH_GAP_BYTES) ? WIDTH_GAP_BYTES / len : 1;
+    w->gap = width_grow(w->gap, &w->gap_cap, w->gap_rows * len, 1);
+    w->gap_cols = w->cols;
+    memset(w->gap, ',', w->gap_rows * len);
+    for (i = 0; i < w->gap_rows; i++)
+      memcpy(w->gap + (i + 1) * len - 2, "\r\x0A", 2);
+  }
+  width_run(w);
+  if (w->widen) {
+    w->lens = width_grow(w->lens, &w->lens_cap, w->rows_out + n, sizeof(uint32_t));
+    for (i = 0; i < (size_t) n; i++)
+      w->lens[w->rows_out + i] = (uint32_t) len;
+    w->row_start += (mz_uint64) n * len;
+  }
+  w->rows_out += n;
+  while (n > 0) {
+    k = ((size_t) n < w->gap_rows) ? (size_t) n : w->gap_rows;
+    out_write(&conv->out, w->gap, k * len);
+    n -= (int) k;
+  }
+}
+
+static void width_write(XLSXConv *conv, const XLSXRow *row)
+{
+  Width *w = &conv->width;
+  mz_uint64 end;
+  int n;
+
+  if (row->row > w->next_row)
+    width_gap(conv, row->row - w->next_row);
+  w->next_row = row->row + 1;
+  n = row_width(row);
+  if (n > w->cols) {
+    if (w->rows_out && !w->widen && !w->short_row)
+      w->short_row = row->row;
+    w->cols = n;
+  }
+  width_run(w);
+  emit_csv(conv, row, w->cols);
+  if (w->widen) {
+    w->lens = width_grow(w->lens, &w->lens_cap, w->rows_out + 1, sizeof(uint32_t));
+    end = out_tell(&conv->out);
+    w->lens[w->rows_out] = (uint32_t) (end - w->row_start);
+    w->row_start = end;
+  }
+  w->rows_out++;
+}
+
+static void width_hold(XLSXConv *conv, const XLSXRow *row)
+{
+  Width *w = &conv->width;
+  const XLSXCell *cell;
+  XLSXRow *h;
+  int i;
+
+  w->rows = width_grow(w->rows, &w->rows_cap, w->rows_num + 1, sizeof(XLSXRow));
+  w->cells = width_grow(w->cells, &w->cells_cap, w->cells_num + row->num_cells, sizeof(XLSXCell));
+  w->offs = width_grow(w->offs, &w->offs_cap, w->cells_num + row->num_cells, sizeof(size_t));
+  h = &w->rows[w->rows_num++];
+  *h = *row;
+  h->cells = NULL;
+  for (i = 0; i < row->num_cells; i++) {
+    cell = &row->cells[i];
+    w->cells[w->cells_num] = *cell;
+    // Shared strings stay where they are until the workbook is closed
+    if (cell->type == XLSX_CELL_SHARED)
+      w->offs[w->cells_num] = (size_t) -1;
+    else {
+      w->text = width_grow(w->text, &w->text_cap, w->text_len + cell->len, 1);
+      if (cell->len)
+        memcpy(w->text + w->text_len, cell->ptr, cell->len);
+      w->offs[w->cells_num] = w->text_len;
+      w->text_len += cell->len;
+    }
+    w->cells_num++;
+  }
+  if (row_width(row) > w->cols)
+    w->cols = row_width(row);
+}
+
+static void width_release(XLSXConv *conv)
+{
+  Width *w = &conv->width;
+  XLSXRow *h;
+  size_t i, first;
+  int j;
+
+  w->ahead = 0;
+  for (first = 0, i = 0; i < w->rows_num; i++) {
+    h = &w->rows[i];
+    h->cells = w->cells + first;
+    for (j = 0; j < h->num_cells; j++)
+      if (w->offs[first + j] != (size_t) -1)
+        h->cells[j].ptr = w->text + w->offs[first + j];
+    first += h->num_cells;
+    width_write(conv, h);
+  }
+  w->rows_num = w->cells_num = 0;
+  w->text_len = 0;
+}
+
+static void width_row(XLSXConv *conv, const XLSXRow *row)
+{
+  Width *w = &conv->width;
+  int num_rows;
+
+  if (w->ahead < 0) {
+    // The <dimension ref> is known once the first row has been read
+    xlsx_sheet_dimension(conv->xlsx, &num_rows, &w->cols);
+    w->ahead = !w->cols;
+  }
+  if (!w->ahead) {
+    width_write(conv, row);
+    return;
+  }
+  width_hold(conv, row);
+  if ((w->rows_num >= WIDTH_ROWS) || (w->text_len >= WIDTH_BYTES))
+    width_release(conv);
+}
+
+/*
+** Widen the rows written narrower than the last ones. From the end of the
+** file, each row moves up by the commas missing from the rows before it, and
+** gets its own missing commas before its CRLF, so that every byte is moved
+** once. Returns 0 on success, -1 on failure.
+*/
+static int width_widen(XLSXConv *conv, FILE *f)
+{
+#ifndef _WIN32
+  Width *w = &conv->width;
+  struct stat st;
+  mz_uint64 pad, end, size, len;
+  size_t i, n;
+  char *map;
+  int fd, r;
+
+  pad = 0;
+  for (i = 0; i < w->runs_num; i++) {
+    n = ((i + 1 < w->runs_num) ? w->runs[i + 1].first : w->rows_out) - w->runs[i].first;
+    pad += (mz_uint64) n * (width_commas(w->cols) - width_commas(w->runs[i].cols));
+  }
+  if (!pad)
+    return 0;
+  fd = fileno(f);
+  if (fstat(fd, &st))
+    return -1;
+  end = st.st_size;
+  size = end + pad;
+  if (ftruncate(fd, size))
+    return -1;
+  map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+    return -1;
+  r = w->runs_num - 1;
+  for (i = w->rows_out; pad && i--; ) {
+    while (w->runs[r].first > i)
+      r--;
+    n = width_commas(w->cols) - width_commas(w->runs[r].cols);
+    len = w->lens[i];
+    memmove(map + end - 2 + pad, map + end - 2, 2);
+    pad -= n;
+    memset(map + end - 2 + pad, ',', n);
+    memmove(map + end - len + pad, map + end - len, len - 2);
+    end -= len;
+  }
+  if (munmap(map, size) || fseek(f, 0, SEEK_END))
+    return -1;
+  return 0;
+#else
+  return -1;
+#endif /* Not(_WIN32) */
+}
+
+static void progress_publish(XLSXConv *conv)
+{
+  XLSXProgress p;
+
+  xlsx_sheet_progress(conv->xlsx, &p);
+  pthread_mutex_lock(&conv->pg.mutex);
+  conv->pg.pub = p;
+  conv->pg.pub_rows = conv->pg.rows;
+  pthread_mutex_unlock(&conv->pg.mutex);
+}
+
+static void emit_row(void *data, const XLSXRow *row)
+{
+  XLSXConv *conv = data;
+  int i;
+
+  if (conv->stats) {
+    conv->st_rows++;
+    for (i = 0; i < row->num_cells; i++)
+      conv->st_cells[row->cells[i].type]++;
+  }
+  if (conv->progress && !(++conv->pg.rows % PROGRESS_ROWS))
+    progress_publish(conv);
+  // The JSONL header row is read even when out of the range of rows
+  if (((row->row < conv->first_row) || (conv->last_row && (row->row > conv->last_row))) && !conv->json_header)
+    return;
+  if (conv->format == FORMAT_CSV)
+    width_row(conv, row);
+  else
+    emit_jsonl(conv, row);
+}
+
+/*
+** Write the index and value of the shared strings used by the sheet.
+*/
+static void write_dict(XLSXConv *conv, const char *filename)
+{
+  XLSXOut out;
+  FILE *f;
+  char index[16];
+  const char *z;
+  size_t len;
+  int i, gz, n;
+
+  len = strlen(filename);
+  gz = (len > 3) && !strcmp(filename + len - 3, ".gz");
+  f = fopen(filename, gz ? "wb" : "w");
+  if (!f) {
+    fprintf(stderr, "Couldn't open dictionary file '%s' .\n", filename);
+    exit(-1);
+  }
+  memset(&out, 0, sizeof(out));
+  out_open(&out, f, gz, MZ_DEFAULT_LEVEL, 1);
+  for (i = 0; i < xlsx_shared_count(conv->xlsx); i++) {
+    if (!conv->shrdstr_used[i])
+      continue;
+    z = xlsx_shared_string(conv->xlsx, i, &n);
+    out_write(&out, index, sprintf(index, "%d,", i));
+    output_csv(&out, ',', z, n, 0);
+    out_write(&out, "\r\x0A", 2);
+  }
+  if (out_close(&out))
+    exit(-1);
+  out_free(&out);
+  fclose(f);
+}
+
+/*
+** Peak resident set size of the whole process in KB, 0 when unknown
+*/
+static long peak_rss_kb(void)
+{
+#ifndef _WIN32
+  struct rusage ru;
+
+  if (getrusage(RUSAGE_SELF, &ru))
+    return 0;
+#ifdef __APPLE__
+  return ru.ru_maxrss / 1024;
+#else
+  return ru.ru_maxrss;
+#endif /* __APPLE__ */
+#else
+  return 0;
+#endif /* Not(_WIN32) */
+}
+
+/*
+** Anonymous memory of the whole process backed by transparent huge pages in
+** KB, -1 when unknown (the kernel tells it from Linux 4.14)
+*/
+static long anon_huge_kb(void)
+{
+#ifdef __linux__
+  FILE *f = fopen("/proc/self/smaps_rollup", "r");
+  char line[256];
+  long kb = -1;
+
+  if (!f)
+    return -1;
+  while (fgets(line, sizeof(line), f))
+    if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1)
+      break;
+  fclose(f);
+  return kb;
+#else
+  return -1;
+#endif /* __linux__ */
+}
+
+/*
+** Print to STDERR the time spent in each phase of the conversion of input,
+** as text or as one JSON object, in a single write so that the reports of
+** the workers of -batch do not mix.
+*/
+static void print_stats(XLSXConv *conv, const char *input)
+{
+  static const char *names[] = { "open", "sst_inflate", "sst_parse", "styles", "sheet_inflate", "sheet_parse", "output" };
+  static const char *perf_names[] = { "cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses", "dtlb_misses" };
+  static const char *mem_names[] = { "zip", "inflate", "sst", "parser", "rows", "output", "total" };
+  const XLSXStats *st = xlsx_stats(conv->xlsx);
+  const XLSXMemory *mem = xlsx_memory(conv->xlsx);
+  XLSXMemUse mems[XLSX_MEMS + 2];
+  double wall[XLSX_PHASES + 1], cpu[XLSX_PHASES + 1];
+  mz_uint64 bytes[XLSX_PHASES + 1];
+  const uint64_t *perf[XLSX_PHASES + 1];
+  char buf[8192], name[1024], *p, *end = buf + sizeof(buf);
+  int i, j, n;
+
+  for (i = 0; i < XLSX_PHASES; i++) {
+    wall[i] = st->phase[i].wall;
+    cpu[i] = st->phase[i].cpu;
+    bytes[i] = st->phase[i].bytes;
+    perf[i] = st->phase[i].perf;
+  }
+  wall[i] = conv->out.st_wall;
+  cpu[i] = conv->out.st_cpu;
+  bytes[i] = conv->out.st_bytes;
+  perf[i] = conv->out.st_perf;
+  // Memory of the library by use, then the output blocks, and the total of both
+  for (i = 0; i < XLSX_MEMS; i++)
+    mems[i] = mem->use[i];
+  mems[i].bytes = mems[i].peak = conv->out.st_mem;
+  mems[i].allocs = conv->out.st_mem_allocs;
+  mems[i+1].bytes = mem->total.bytes + mems[i].bytes;
+  mems[i+1].peak = mem->total.peak + mems[i].peak;
+  mems[i+1].allocs = mem->total.allocs + mems[i].allocs;
+  p = buf;
+  if (conv->stats == STATS_TEXT) {
+    p += snprintf(p, end - p, "%s:\n  %-14s %10s %10s %12s %10s\n", input, "phase", "wall s", "cpu s", "bytes", "MB/s");
+    for (i = 0; i <= XLSX_PHASES; i++)
+      p += snprintf(p, end - p, "  %-14s %10.6f %10.6f %12llu %10.1f\n", names[i], wall[i], cpu[i],
+                    (unsigned long long) bytes[i], (wall[i] > 0) ? bytes[i] / wall[i] / 1e6 : 0.0);
+    if (conv->perf && !st->perf)
+      p += snprintf(p, end - p, "  hardware counters are not available\n");
+    else if (conv->perf) {
+      // IPC, and events per byte of the phase; '-' for events the CPU does not count
+      p += snprintf(p, end - p, "  %-14s %14s %6s %12s %12s %12s %12s\n", "phase", "cycles", "IPC",
+                    "br-miss/B", "L1d-miss/B", "LLC-miss/B", "dTLB-miss/B");
+      for (i = 0; i <= XLSX_PHASES; i++) {
+        p += snprintf(p, end - p, "  %-14s", names[i]);
+        if (st->perf & (1u << XLSX_PERF_CYCLES))
+          p += snprintf(p, end - p, " %14llu", (unsigned long long) perf[i][XLSX_PERF_CYCLES]);
+        else
+          p += snprintf(p, end - p, " %14s", "-");
+        if ((st->perf & (1u << XLSX_PERF_CYCLES)) && (st->perf & (1u << XLSX_PERF_INSTRUCTIONS)))
+          p += snprintf(p, end - p, " %6.2f", perf[i][XLSX_PERF_CYCLES] ?
+                        (double) perf[i][XLSX_PERF_INSTRUCTIONS] / perf[i][XLSX_PERF_CYCLES] : 0.0);
+        else
+          p += snprintf(p, end - p, " %6s", "-");
+        for (j = XLSX_PERF_BRANCH_MISSES; j < XLSX_PERF_COUNTERS; j++)
+          if (st->perf & (1u << j))
+            p += snprintf(p, end - p, " %12.4f", bytes[i] ? (double) perf[i][j] / bytes[i] : 0.0);
+          else
+            p += snprintf(p, end - p, " %12s", "-");
+        p += snprintf(p, end - p, "\n");
+      }
+    }
+    p += snprintf(p, end - p, "  %-14s %12s %12s %10s\n", "memory", "bytes", "peak", "allocs");
+    for (i = 0; i < XLSX_MEMS + 2; i++)
+      p += snprintf(p, end - p, "  %-14s %12llu %12llu %10llu\n", mem_names[i], (unsigned long long) mems[i].bytes,
+                    (unsigned long long) mems[i].peak, (unsigned long long) mems[i].allocs);
+    p += snprintf(p, end - p, "  peak RSS of the process %ld KB, kernels for %s\n", peak_rss_kb(),
+                  xlsx_cpu_name(xlsx_cpu_level()));
+    if (conv->hugepages)
+      p += snprintf(p, end - p, "  huge pages of the process %ld KB\n", anon_huge_kb());
+    p += snprintf(p, end - p, "  shared strings %d, rows %llu, cells %llu number, %llu shared string, %llu string, %llu date,\n"
+                  "  %llu inline string, %llu boolean, %llu error\n",
+                  xlsx_shared_count(conv->xlsx), (unsigned long long) conv->st_rows,
+                  (unsigned long long) conv->st_cells[XLSX_CELL_NUMBER], (unsigned long long) conv->st_cells[XLSX_CELL_SHARED],
+                  (unsigned long long) conv->st_cells[XLSX_CELL_STRING], (unsigned long long) conv->st_cells[XLSX_CELL_DATE],
+                  (unsigned long long) conv->st_cells[XLSX_CELL_INLINE], (unsigned long long) conv->st_cells[XLSX_CELL_BOOL],
+                  (unsigned long long) conv->st_cells[XLSX_CELL_ERROR]);
+  }
+  else {
+    for (i = 0, n = 0; input[i] && (n < (int) sizeof(name) - 7); i++)
+      if (needJsonEscape[(unsigned char) input[i]])
+        n += json_escape_char(name + n, (unsigned char) input[i]);
+      else
+        name[n++] = input[i];
+    p += snprintf(p, end - p, "{\"file\":\"%.*s\"", n, name);
+    for (i = 0; i <= XLSX_PHASES; i++) {
+      p += snprintf(p, end - p, ",\"%s\":{\"wall\":%.6f,\"cpu\":%.6f,\"bytes\":%llu,\"mbps\":%.1f", names[i], wall[i], cpu[i],
+                    (unsigned long long) bytes[i], (wall[i] > 0) ? bytes[i] / wall[i] / 1e6 : 0.0);
+      // Events the CPU does not count are left out
+      for (j = 0; j < XLSX_PERF_COUNTERS; j++)
+        if (conv->perf && (st->perf & (1u << j)))
+          p += snprintf(p, end - p, ",\"%s\":%llu", perf_names[j], (unsigned long long) perf[i][j]);
+      p += snprintf(p, end - p, "}");
+    }
+    if (conv->perf && !st->perf)
+      p += snprintf(p, end - p, ",\"perf_counters\":false");
+    p += snprintf(p, end - p, ",\"memory\":{");
+    for (i = 0; i < XLSX_MEMS + 2; i++)
+      p += snprintf(p, end - p, "%s\"%s\":{\"bytes\":%llu,\"peak\":%llu,\"allocs\":%llu}", i ? "," : "", mem_names[i],
+                    (unsigned long long) mems[i].bytes, (unsigned long long) mems[i].peak, (unsigned long long) mems[i].allocs);
+    p += snprintf(p, end - p, ",\"peak_rss_kb\":%ld", peak_rss_kb());
+    if (conv->hugepages)
+      p += snprintf(p, end - p, ",\"huge_pages_kb\":%ld", anon_huge_kb());
+    p += snprintf(p, end - p, "},\"cpu\":\"%s\"", xlsx_cpu_name(xlsx_cpu_level()));
+    p += snprintf(p, end - p, ",\"shared_strings\":%d,\"rows\":%llu,\"cells\":{\"number\":%llu,\"shared\":%llu,\"string\":%llu,\"date\":%llu,"
+                  "\"inline\":%llu,\"bool\":%llu,\"error\":%llu}}\n",
+                  xlsx_shared_count(conv->xlsx), (unsigned long long) conv->st_rows,
+                  (unsigned long long) conv->st_cells[XLSX_CELL_NUMBER], (unsigned long long) conv->st_cells[XLSX_CELL_SHARED],
+                  (unsigned long long) conv->st_cells[XLSX_CELL_STRING], (unsigned long long) conv->st_cells[XLSX_CELL_DATE],
+                  (unsigned long long) conv->st_cells[XLSX_CELL_INLINE], (unsigned long long) conv->st_cells[XLSX_CELL_BOOL],
+                  (unsigned long long) conv->st_cells[XLSX_CELL_ERROR]);
+  }
+  fputs(buf, stderr);
+}
+
+/*
+** Print a line of progress: rows, XML of the sheet parsed, compressed bytes of
+** the sheet consumed, throughput of the XML and time left at that pace
+*/
+static void progress_print(Progress *pg, const XLSXProgress *p, mz_uint64 rows, int done)
+{
+  struct timespec now;
+  double secs, rate;
+  char eta[32];
+  long left;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  secs = (now.tv_sec - pg->start.tv_sec) + (now.tv_nsec - pg->start.tv_nsec) * 1e-9;
+  rate = (secs > 0) ? p->parsed / secs : 0;
+  if (done)
+    snprintf(eta, sizeof(eta), "done in %.1f s", secs);
+  else if ((rate > 0) && (p->size >= p->parsed)) {
+    left = (long) ((p->size - p->parsed) / rate);
+    snprintf(eta, sizeof(eta), "ETA %ld:%02ld:%02ld", left / 3600, (left / 60) % 60, left % 60);
+  }
+  else
+    snprintf(eta, sizeof(eta), "ETA -");
+  fprintf(stderr, "%s: %llu rows, %.1f of %.1f MB XML (%.0f%%), %.1f of %.1f MB compressed, %.1f MB/s, %s\n",
+          pg->input, (unsigned long long) rows, p->parsed / 1e6, p->size / 1e6,
+          p->size ? 100.0 * p->parsed / p->size : 100.0, p->comp_read / 1e6, p->comp_size / 1e6, rate / 1e6, eta);
+}
+
+static void *progress_main(void *data)
+{
+  Progress *pg = data;
+  struct timespec until;
+  XLSXProgress p;
+  mz_uint64 rows;
+
+  pthread_mutex_lock(&pg->mutex);
+  for (;;) {
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += PROGRESS_INTERVAL;
+    while (!pg->done && (pthread_cond_timedwait(&pg->cond, &pg->mutex, &until) == 0))
+      ;
+    if (pg->done)
+      break;
+    p = pg->pub;
+    rows = pg->pub_rows;
+    pthread_mutex_unlock(&pg->mutex);
+    progress_print(pg, &p, rows, 0);
+    pthread_mutex_lock(&pg->mutex);
+  }
+  pthread_mutex_unlock(&pg->mutex);
+  return NULL;
+}
+
+static void progress_start(XLSXConv *conv, const char *input)
+{
+  Progress *pg = &conv->pg;
+
+  pg->done = 0;
+  pg->input = input;
+  pg->rows = pg->pub_rows = 0;
+  clock_gettime(CLOCK_MONOTONIC, &pg->start);
+  pthread_mutex_init(&pg->mutex, NULL);
+  pthread_cond_init(&pg->cond, NULL);
+  xlsx_sheet_progress(conv->xlsx, &pg->pub);
+  if (pthread_create(&pg->thread, NULL, progress_main, pg)) {
+    fprintf(stderr, "Couldn't start progress thread\n");
+    exit(-1);
+  }
+}
+
+/*
+** Stop the reporting thread, and print the final line
+*/
+static void progress_stop(XLSXConv *conv)
+{
+  Progress *pg = &conv->pg;
+  XLSXProgress p;
+
+  pthread_mutex_lock(&pg->mutex);
+  pg->done = 1;
+  pthread_cond_broadcast(&pg->cond);
+  pthread_mutex_unlock(&pg->mutex);
+  pthread_join(pg->thread, NULL);
+  pthread_mutex_destroy(&pg->mutex);
+  pthread_cond_destroy(&pg->cond);
+  xlsx_sheet_progress(conv->xlsx, &p);
+  progress_print(pg, &p, pg->rows, 1);
+}
+
+/*
+** Open input into conv->xlsx, reusing the XLSXCtx of the previous file if any.
+** Returns 0 on success, -1 on failure.
+*/
+static int convert_open(XLSXConv *conv, const char *input)
+{
+  size_t len, n;
+  int flags;
+
+  flags = (conv->dates ? XLSX_DATES : 0) | (conv->stats ? XLSX_STATS : 0) | (conv->perf ? XLSX_PERF : 0) |
+          (conv->hugepages ? XLSX_HUGEPAGES : 0);
+
+  if (!strcmp(input, "-")) {
+    // STDIN may be a pipe, that miniz cannot seek: the whole workbook is read into memory
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+#endif /* _WIN32 */
+    len = 0;
+    do {
+      if ((len == conv->in_cap) &&
+          !(conv->in_buff = realloc(conv->in_buff, conv->in_cap = conv->in_cap ? 2 * conv->in_cap : OUTBUFSIZE))) {
+        fprintf(stderr, "Couldn't allocate memory for input\n");
+        exit(-1);
+      }
+      n = fread(conv->in_buff + len, 1, conv->in_cap - len, stdin);
+      len += n;
+    } while (n);
+    if (ferror(stdin)) {
+      fprintf(stderr, "Error: could not read STDIN .\n");
+      return -1;
+    }
+    if (!conv->xlsx)
+      conv->xlsx = xlsx_open_mem(conv->in_buff, len, flags);
+    else if (xlsx_reopen_mem(conv->xlsx, conv->in_buff, len, flags)) {
+      fprintf(stderr, "%s\n", xlsx_errmsg(conv->xlsx));
+      fprintf(stderr, "Error: could not read STDIN .\n");
+      return -1;
+    }
+    if (!conv->xlsx) {
+      fprintf(stderr, "Error: could not read STDIN .\n");
+      return -1;
+    }
+    xlsx_set_max_memory(conv->xlsx, conv->max_memory);
+    return 0;
+  }
+  // Open the workbook, and load its shared strings
+  if (!conv->xlsx)
+    conv->xlsx = xlsx_open(input, flags);
+  else if (xlsx_reopen(conv->xlsx, input, flags)) {
+    fprintf(stderr, "%s\n", xlsx_errmsg(conv->xlsx));
+    fprintf(stderr, "Error: could not read '%s' .\n", input);
+    return -1;
+  }
+  if (!conv->xlsx) {
+    fprintf(stderr, "Error: could not read '%s' .\n", input);
+    return -1;
+  }
+  xlsx_set_max_memory(conv->xlsx, conv->max_memory);
+  return 0;
+}
+
+/*
+** Convert the sheet open in conv->xlsx into outf, and write
+** the dictionary file when asked. The per-file state of conv is reset, but
+** its arrays and output blocks are kept for the next file.
+** Returns 0 on success, -1 on failure.
 */
-static inline void output_csv(FILE *out, const char colSeparator, const char *z, int bSep)
+static int convert_sheet(XLSXConv *conv, const char *input, FILE *outf, const char *dict_file)
 {
-  if (z==0) {
-    //fprintf(out,"%s","");
-  } else{
-    int i;
-    for(i=0; z[i]; i++){
-      if (needCsvQuote[((unsigned char*)z)[i]] || (z[i]==colSeparator)) {
-        i = 0;
-        break;
-      }
-    }
-    if (i==0) {
-      putc('"', out);
-      for (i=0; z[i]; i++) {
-        if (z[i]=='"')
-          putc('"', out);
-        putc(z[i], out);
-      }
-      putc('"', out);
-    } else {
-      fprintf(out, "%s", z);
+  const XLSXRow *row;
+  int i, ret;
+
+  for (i = 0; i < conv->json_keys_num; i++) {
+    free(conv->json_keys[i]);
+    conv->json_keys[i] = NULL;
+  }
+  conv->json_header = (conv->format == FORMAT_JSONL);
+  conv->shrdstr_num = xlsx_shared_count(conv->xlsx);
+  conv->shrdstr_escape = realloc(conv->shrdstr_escape, conv->shrdstr_num + 1);
+  if (!conv->shrdstr_escape) {
+    fprintf(stderr, "Couldn't allocate memory for shared strings\n");
+    exit(-1);
+  }
+  memset(conv->shrdstr_escape, SHARED_UNKNOWN, conv->shrdstr_num + 1);
+  if (conv->dict) {
+    conv->shrdstr_used = realloc(conv->shrdstr_used, xlsx_shared_count(conv->xlsx) + 1);
+    if (!conv->shrdstr_used) {
+      fprintf(stderr, "Couldn't allocate memory for dictionary\n");
+      exit(-1);
     }
+    memset(conv->shrdstr_used, 0, xlsx_shared_count(conv->xlsx) + 1);
   }
-  if (bSep) {
-    putc(colSeparator, out);
+
+  conv->st_rows = 0;
+  memset(conv->st_cells, 0, sizeof(conv->st_cells));
+
+  // Process xl/worksheets/sheet1.xml row by row
+  conv->out.stats = (conv->stats != STATS_NONE);
+  conv->out.st_perf_ctx = conv->perf ? conv->xlsx : NULL;
+  out_open(&conv->out, outf, conv->gz, conv->gz_level, conv->gz_threads);
+  width_reset(conv, outf);
+  if (conv->progress)
+    progress_start(conv, input);
+  if (!conv->last_row)
+    ret = xlsx_sheet_rows(conv->xlsx, emit_row, conv);
+  else {
+    // Rows are pulled, so that parsing stops after the last one asked for
+    while ((row = xlsx_next_row(conv->xlsx)) && (row->row <= conv->last_row))
+      emit_row(conv, row);
+    ret = (!row && xlsx_errmsg(conv->xlsx)[0]) ? -1 : 0;
+  }
+  // Rows of a sheet shorter than the window of rows held to find the width
+  if (conv->width.ahead > 0)
+    width_release(conv);
+  if (ret)
+    fprintf(stderr, "%s: %s\n", input, xlsx_errmsg(conv->xlsx));
+  if (out_close(&conv->out))
+    ret = -1;
+  if (!ret && conv->width.widen && width_widen(conv, outf)) {
+    fprintf(stderr, "%s: Couldn't widen the rows of the output file\n", input);
+    ret = -1;
   }
+  if (!ret && conv->width.short_row)
+    fprintf(stderr, "%s: Rows before row %d have fewer columns than it\n", input, conv->width.short_row);
+  if (conv->progress)
+    progress_stop(conv);
+  if (!ret && dict_file)
+    write_dict(conv, dict_file);
+  if (!ret && conv->stats)
+    print_stats(conv, input);
+  return ret;
 }
 
-static inline void excelcolrow(char *string, int *outcol, int *outrow)
+static int convert_file(XLSXConv *conv, const char *input, FILE *outf, const char *dict_file)
 {
-  int i, col, base;
+  if (convert_open(conv, input))
+    return -1;
+  if (xlsx_sheet_open(conv->xlsx, conv->sheet_id)) {
+    fprintf(stderr, "%s: %s\n", input, xlsx_errmsg(conv->xlsx));
+    return -1;
+  }
+  return convert_sheet(conv, input, outf, dict_file);
+}
 
-  col = 0;
-  base = 1;
-  for (i = 0; i < strlen(string); i++) {
-    if (isalpha(string[i])) {
-      col = col * 26 + ((toupper(string[i])) - 'A' + 1);
-    }
-    else
+/*
+** Batch mode (-batch).
+** The workbooks of the list are sized from the uncompressed sizes of their
+** zip central directory, sorted largest first and dealt round robin into one
+** deque per worker. A worker takes the largest workbook left at the head of
+** its own deque, and when it runs dry steals the smallest one from the tail
+** of another deque, so that the long tail of small files evens out the load.
+** Each worker keeps its XLSXConv, with its XLSXCtx and output blocks, across
+** all its files.
+*/
+typedef struct BatchJob BatchJob;
+struct BatchJob {
+  char     *input;
+  char     *output;      /* Output file, see batch_names() */
+  int       dup;         /* Number of workbooks before it in the list with the same output name */
+  mz_uint64 size;        /* Uncompressed size of the workbook */
+};
+
+typedef struct BatchDeque BatchDeque;
+struct BatchDeque {
+  pthread_mutex_t mutex;
+  int  *jobs;            /* Index of the jobs, largest first */
+  int   head, tail;
+};
+
+typedef struct Batch Batch;
+struct Batch {
+  BatchJob   *jobs;
+  int         num_jobs;
+  BatchDeque *deques;
+  int         num_workers;
+  XLSXConv   *proto;       /* Options of the conversion, copied by each worker */
+  const char *outdir;
+  pthread_mutex_t mutex;
+  int         next_job;    /* Next job to size */
+  int         failed;      /* Number of workbooks that could not be converted */
+};
+
+typedef struct BatchWorker BatchWorker;
+struct BatchWorker {
+  Batch    *batch;
+  int       id;
+  pthread_t thread;
+};
+
+static void *batch_size_main(void *data)
+{
+  Batch *batch = data;
+  mz_zip_archive zip;
+  mz_zip_archive_file_stat stat;
+  BatchJob *job;
+  mz_uint i;
+
+  for (;;) {
+    pthread_mutex_lock(&batch->mutex);
+    job = (batch->next_job < batch->num_jobs) ? &batch->jobs[batch->next_job++] : NULL;
+    pthread_mutex_unlock(&batch->mutex);
+    if (!job)
       break;
+    // Unreadable workbooks are left with size 0, their error shows up when converted
+    memset(&zip, 0, sizeof(zip));
+    if (!mz_zip_reader_init_file(&zip, job->input, 0))
+      continue;
+    for (i = 0; i < mz_zip_reader_get_num_files(&zip); i++)
+      if (mz_zip_reader_file_stat(&zip, i, &stat))
+        job->size += stat.m_uncomp_size;
+    mz_zip_reader_end(&zip);
   }
-  *outcol = col;
-  *outrow = atoi(string + i);
-  return;
+  return NULL;
 }
 
-static inline void rangecolrow(char *string, int *outcol, int *outrow)
+static int batch_cmp(const void *a, const void *b)
 {
-  int col, row;
-  char *coloninstr;
+  const BatchJob *ja = a, *jb = b;
 
-  coloninstr = strchr(string, ':');
-  if (coloninstr) {
-    string = coloninstr + 1;
-    //fprintf(stderr, "rangecolrow: %s \n", string);
-  }
-  excelcolrow(string, &col, &row);
-  *outcol = col;
-  *outrow = row;
+  return (ja->size < jb->size) ? 1 : (ja->size > jb->size) ? -1 : 0;
 }
 
-#ifdef CONFIG_EXPAT
-static void XMLCALL StartSharedStrings(void *data, const char *el, const char **attr)
+/*
+** Next job of worker id, from its own deque or stolen from another one.
+** Returns -1 when all the deques are empty.
+*/
+static int batch_take(Batch *batch, int id)
 {
-  int i;
-  XLSXCtx *ctx = data;
-  
-  if ((ctx->xml_depth == 0) && (!strcmp(el, "sst"))) {
-    for (i = 0; attr[i]; i += 2) {
-      if (!strcmp(attr[i], "uniqueCount")) {
-        //fprintf(stderr, " %s='%s'\n", attr[i], attr[i + 1]);
-        ctx->shrdstr_cnt = atoi(attr[i + 1]);
-        ctx->shrdstr_array = calloc(sizeof(char *), ctx->shrdstr_cnt);
-      }
-    }
-  }
-  if (((ctx->xml_depth == 2)||(ctx->xml_depth == 3)) && (!strcmp(el, "t"))) {
-    ctx->shrdstr_tv = 1;
-    ctx->shrdstr_tv_val = ctx->shrdstr_buff;
-    *(ctx->shrdstr_tv_val) = 0;
+  BatchDeque *dq;
+  int i, job;
+
+  for (i = 0; i < batch->num_workers; i++) {
+    dq = &batch->deques[(id + i) % batch->num_workers];
+    job = -1;
+    pthread_mutex_lock(&dq->mutex);
+    if (dq->head < dq->tail)
+      job = i ? dq->jobs[--dq->tail] : dq->jobs[dq->head++];
+    pthread_mutex_unlock(&dq->mutex);
+    if (job >= 0)
+      return job;
   }
-  ctx->xml_depth++;
+  return -1;
 }
 
-static void XMLCALL EndSharedStrings(void *data, const char *el)
+/*
+** Output file of a workbook: its name within outdir, with the extension of
+** the output format, and a -dup suffix when dup is more than 1.
+*/
+static char *batch_output_name(Batch *batch, const char *input, int dup)
 {
-  XLSXCtx *ctx = data;
+  const char *base, *p, *ext;
+  char *name, suffix[16];
+  size_t len;
 
-  ctx->xml_depth--;
-  // "t" at depth 3 are due to multiple styles in cell, and then we need to concat the substrings
-  if (((ctx->xml_depth == 2)||(ctx->xml_depth == 3)) && (!strcmp(el, "t"))) {
-    ctx->shrdstr_tv = 0;
-    if (ctx->shrdstr_array[ctx->shrdstr_num]) {
-      int prevl, currl;
-      char *p;
-      prevl = strlen(ctx->shrdstr_array[ctx->shrdstr_num]);
-      currl = strlen(ctx->shrdstr_buff);
-      p = malloc(sizeof(char) * (prevl + currl + 1));
-      memcpy(p, ctx->shrdstr_array[ctx->shrdstr_num], prevl);
-      memcpy(p + prevl, ctx->shrdstr_buff, currl);
-      p[prevl + currl + 1] = 0;
-      free(ctx->shrdstr_array[ctx->shrdstr_num]);
-      ctx->shrdstr_array[ctx->shrdstr_num] = p;
-    }
-    else
-      ctx->shrdstr_array[ctx->shrdstr_num] = strdup(ctx->shrdstr_buff);
+  for (base = p = input; *p; p++)
+    if ((*p == '/') || (*p == '\\'))
+      base = p + 1;
+  len = strlen(base);
+  if ((len > 5) && !strcmp(base + len - 5, ".xlsx"))
+    len -= 5;
+  ext = (batch->proto->format == FORMAT_JSONL) ? ".jsonl" : ".csv";
+  suffix[0] = 0;
+  if (dup > 1)
+    sprintf(suffix, "-%d", dup);
+  name = malloc(strlen(batch->outdir) + len + strlen(suffix) + strlen(ext) + 5);
+  if (!name) {
+    fprintf(stderr, "Couldn't allocate memory for output file name\n");
+    exit(-1);
   }
-  if ((ctx->xml_depth == 1) && (!strcmp(el, "si")))
-    ctx->shrdstr_num++;
+  sprintf(name, "%s/%.*s%s%s%s", batch->outdir, (int) len, base, suffix, ext, batch->proto->gz ? ".gz" : "");
+  return name;
 }
 
-static void XMLCALL ChrHndlr(void *data, const char *s, int len)
+static int batch_name_cmp(const void *a, const void *b)
 {
-  char *src;
-  XLSXCtx *ctx = data;
+  const BatchJob *ja = *(const BatchJob **) a, *jb = *(const BatchJob **) b;
+  int cmp;
 
-  if (ctx->shrdstr_tv) {
-    src = (char *) s;
-    while (len) {
-      *(ctx->shrdstr_tv_val)++ = *src++;
-      len--;
-    }
-    *(ctx->shrdstr_tv_val) = 0;
-  }
+  cmp = strcmp(ja->output, jb->output);
+  return cmp ? cmp : (ja < jb) ? -1 : (ja > jb);
 }
 
-static void XMLCALL StartSheet(void *data, const char *el, const char **attr)
+/*
+** Name the output file of each workbook before any is written. Workbooks of
+** the same name in different directories would overwrite each other's
+** output: the first one in the list keeps the name, the next ones get a -2,
+** -3... suffix, until no two outputs share a name.
+*/
+static void batch_names(Batch *batch)
 {
-  int i, j;
-  XLSXCtx *ctx = data;
+  BatchJob **sorted;
+  int i, g, dups;
 
-  if ((ctx->xml_depth == 1) && (!strcmp(el, "dimension"))) {
-    for (i = 0; attr[i]; i += 2) {
-      if (!strcmp(attr[i], "ref")) {
-        //fprintf(stderr, "dimension %s='%s'\n", attr[i], attr[i + 1]);
-        rangecolrow((char *) attr[i + 1], &(ctx->sheet_num_cols), &(ctx->sheet_num_rows));
-        //fprintf(stderr, "cols: %d  rows: %d\n", ctx->sheet_num_cols, ctx->sheet_num_rows);
-      }
-    }
+  sorted = malloc((batch->num_jobs + 1) * sizeof(BatchJob *));
+  if (!sorted) {
+    fprintf(stderr, "Couldn't allocate memory for batch list\n");
+    exit(-1);
   }
-  if ((ctx->xml_depth == 2) && (!strcmp(el, "row"))) {
-    for (i = 0; attr[i]; i += 2) {
-      // (!strcmp(attr[i], "r")
-      if ((*attr[i] == 'r') && attr[i][1] == '\0') {
-        //fprintf(stderr, "row %s='%s'\n", attr[i], attr[i + 1]);
-        ctx->expected_col = 1;
-      }
-    }
+  for (i = 0; i < batch->num_jobs; i++) {
+    batch->jobs[i].output = batch_output_name(batch, batch->jobs[i].input, 1);
+    sorted[i] = &batch->jobs[i];
   }
-  if ((ctx->xml_depth == 3) && (!strcmp(el, "c"))) {
-    ctx->lookup_v = 0;
-    for (i = 0; attr[i]; i += 2) {
-      if (!strcmp(attr[i], "r")) {
-        //fprintf(stderr, "c %s='%s'\n", attr[i], attr[i + 1]);
-        excelcolrow((char *) attr[i + 1], &(ctx->current_col), &(ctx->current_row));
-        for (j = ctx->expected_col; (j<ctx->current_col)&&(j<ctx->sheet_num_cols); j++)
-          putc(',', ctx->outf);
-        ctx->expected_col = ctx->current_col+1;
-      }
-      else if (!strcmp(attr[i], "t")) {
-        //fprintf(stderr, "c %s='%s'\n", attr[i], attr[i + 1]);
-        if (*attr[i + 1] == 's') {
-          ctx->lookup_v = -1;
-        }
-        //fprintf(stderr, "cols: %d  rows: %d\n", ctx->sheet_num_cols, ctx->sheet_num_rows);
+  do {
+    // Equal names end up next to each other, in the order of the list
+    qsort(sorted, batch->num_jobs, sizeof(BatchJob *), batch_name_cmp);
+    for (dups = 0, g = 0, i = 1; i < batch->num_jobs; i++) {
+      if (strcmp(sorted[g]->output, sorted[i]->output)) {
+        g = i;
+        continue;
       }
+      free(sorted[i]->output);
+      sorted[i]->dup += i - g;
+      sorted[i]->output = batch_output_name(batch, sorted[i]->input, sorted[i]->dup + 1);
+      dups++;
     }
-  }
-  if ((ctx->xml_depth == 4) && (*el == 'v') && (el[1] == '\0')) {
-    ctx->shrdstr_tv = 1;
-    ctx->shrdstr_tv_val = ctx->shrdstr_buff;
-    *(ctx->shrdstr_tv_val) = 0;
-  }
-  ctx->xml_depth++;
+  } while (dups);
+  free(sorted);
+  for (i = 0; i < batch->num_jobs; i++)
+    if (batch->jobs[i].dup)
+      fprintf(stderr, "Output of '%s' is '%s', its name is taken\n", batch->jobs[i].input, batch->jobs[i].output);
 }
 
-static void XMLCALL EndSheet(void *data, const char *el)
+static void *batch_worker_main(void *data)
 {
-  int j;
-  XLSXCtx *ctx = data;
+  BatchWorker *w = data;
+  Batch *batch = w->batch;
+  XLSXConv conv;
+  FILE *f;
+  const char *name;
+  uint64_t start;
+  int job, failed, i;
 
-  ctx->xml_depth--;
-  if ((ctx->xml_depth == 4) && (*el == 'v') && (el[1] == '\0')) {
-    ctx->shrdstr_tv = 0;
-    if (ctx->lookup_v) {
-      //fprintf(stderr, "v %s\n", ctx->shrdstr_array[atoi(ctx->shrdstr_buff)]);
-      output_csv(ctx->outf, ',', ctx->shrdstr_array[atoi(ctx->shrdstr_buff)], (ctx->current_col < ctx->sheet_num_cols));
+  trace_thread("batch worker", w->id + 1);
+  conv = *batch->proto;
+  failed = 0;
+  while ((job = batch_take(batch, w->id)) >= 0) {
+    start = trace_clock();
+    name = batch->jobs[job].output;
+    f = fopen(name, conv.gz ? "wb" : "w+");
+    if (!f) {
+      fprintf(stderr, "Couldn't open output file '%s' .\n", name);
+      failed++;
     }
     else {
-      //fprintf(stderr, "v %s\n", ctx->shrdstr_buff);
-      output_csv(ctx->outf, ',', ctx->shrdstr_buff, (ctx->current_col < ctx->sheet_num_cols));
+      if (convert_file(&conv, batch->jobs[job].input, f, NULL)) {
+        // No half converted output is left behind
+        fclose(f);
+        remove(name);
+        failed++;
+      }
+      else
+        fclose(f);
     }
+    trace_span("convert", start, batch->jobs[job].size);
   }
-  if ((ctx->xml_depth == 2) && (!strcmp(el, "row"))) {
-    for (j = ctx->expected_col; j<ctx->sheet_num_cols; j++)
-      putc(',', ctx->outf);
-    fprintf(ctx->outf, "\r\x0A");
-    // TODO: Check if \r\x0A portable between Windows & UNIX
-  }
+  for (i = 0; i < conv.json_keys_num; i++)
+    free(conv.json_keys[i]);
+  free(conv.json_keys);
+  free(conv.shrdstr_used);
+  free(conv.shrdstr_escape);
+  width_free(&conv.width);
+  out_free(&conv.out);
+  xlsx_close(conv.xlsx);
+  pthread_mutex_lock(&batch->mutex);
+  batch->failed += failed;
+  pthread_mutex_unlock(&batch->mutex);
+  trace_thread_exit();
+  return NULL;
 }
-#endif /* CONFIG_EXPAT */
 
-#ifdef CONFIG_MXML
-static void SharedStrings(mxml_node_t *node, mxml_sax_event_t event, void *data)
+/*
+** Convert each workbook listed in list_file, one per line, into outdir.
+** Returns the number of workbooks that could not be converted.
+*/
+static int batch_convert(XLSXConv *proto, const char *list_file, const char *outdir, int num_workers)
 {
-  const char *el, *uniqueCount, *value;
-  XLSXCtx *ctx = data;
-  
-  if (event == MXML_SAX_ELEMENT_OPEN) {
-    if (ctx->xml_depth == 0) {
-      el = mxmlGetElement(node);
-      if (!strcmp(el, "sst")) {
-        uniqueCount = mxmlElementGetAttr(node, "uniqueCount");
-        if (uniqueCount) {
-          //fprintf(stderr, " uniqueCount='%s'\n", uniqueCount);
-          ctx->shrdstr_cnt = atoi(uniqueCount);
-          ctx->shrdstr_array = malloc(sizeof(char *) * ctx->shrdstr_cnt);
-        }
-      }
+  Batch batch;
+  BatchWorker *workers;
+  FILE *f;
+  char line[4096];
+  size_t len;
+  int i, cap;
+
+  memset(&batch, 0, sizeof(batch));
+  batch.proto = proto;
+  batch.outdir = outdir;
+  f = fopen(list_file, "r");
+  if (!f) {
+    fprintf(stderr, "Couldn't open batch list '%s' .\n", list_file);
+    exit(-1);
+  }
+  cap = 0;
+  while (fgets(line, sizeof(line), f)) {
+    len = strlen(line);
+    while (len && ((line[len - 1] == '\n') || (line[len - 1] == '\r')))
+      line[--len] = 0;
+    if (!len)
+      continue;
+    if (batch.num_jobs == cap) {
+      cap = cap ? 2 * cap : 256;
+      batch.jobs = realloc(batch.jobs, cap * sizeof(BatchJob));
     }
-    ctx->xml_depth++;
-    //fprintf(stderr, "shared strings '%s' %d\n", el, ctx->xml_depth);
-  }
-  else if (event == MXML_SAX_DATA) {
-    if (ctx->xml_depth == 3) {
-      el = mxmlGetElement(mxmlGetParent(node));
-      if (!strcmp(el, "t")) {
-        value = mxmlGetOpaque(mxmlGetParent(node));
-        //fprintf(stderr, " shrStr[%d]='%s'\n", ctx->shrdstr_num, value);
-        ctx->shrdstr_array[ctx->shrdstr_num] = strdup(value);
-        ctx->shrdstr_num++;
-      }
+    if (!batch.jobs || !(batch.jobs[batch.num_jobs].input = strdup(line))) {
+      fprintf(stderr, "Couldn't allocate memory for batch list\n");
+      exit(-1);
     }
+    batch.jobs[batch.num_jobs].output = NULL;
+    batch.jobs[batch.num_jobs].dup = 0;
+    batch.jobs[batch.num_jobs++].size = 0;
   }
-  else if (event == MXML_SAX_ELEMENT_CLOSE) {
-    ctx->xml_depth--;
+  fclose(f);
+  batch_names(&batch);
+  if (num_workers > batch.num_jobs)
+    num_workers = batch.num_jobs ? batch.num_jobs : 1;
+  batch.num_workers = num_workers;
+  workers = calloc(num_workers, sizeof(BatchWorker));
+  batch.deques = calloc(num_workers, sizeof(BatchDeque));
+  if (!workers || !batch.deques) {
+    fprintf(stderr, "Couldn't allocate memory for batch workers\n");
+    exit(-1);
   }
-}
+  pthread_mutex_init(&batch.mutex, NULL);
 
-static void Sheet(mxml_node_t *node, mxml_sax_event_t event, void *data)
-{
-  int i, j;
-  const char *el, *ref, *r, *t, *value;
-  XLSXCtx *ctx = data;
-
-  if (event == MXML_SAX_ELEMENT_OPEN) {
-    el = mxmlGetElement(node);
-    if ((ctx->xml_depth == 1) && (!strcmp(el, "dimension"))) {
-      ref = mxmlElementGetAttr(node, "ref");
-      if (ref) {
-        rangecolrow((char *)ref, &(ctx->sheet_num_cols), &(ctx->sheet_num_rows));
-        //fprintf(stderr, " dimension ref='%s'\n", ref);
-        //fprintf(stderr, "cols: %d  rows: %d\n", ctx->sheet_num_cols, ctx->sheet_num_rows);
-      }
-    }
-    if ((ctx->xml_depth == 2) && (!strcmp(el, "row"))) {
-      r = mxmlElementGetAttr(node, "r");
-      if (r) {
-        //fprintf(stderr, "row r='%s'\n", r);
-        ctx->expected_col = 1;
-      }
+  // Size the workbooks, then deal them largest first
+  for (i = 0; i < num_workers; i++)
+    if (pthread_create(&workers[i].thread, NULL, batch_size_main, &batch)) {
+      fprintf(stderr, "Couldn't create batch thread\n");
+      exit(-1);
     }
-    if ((ctx->xml_depth == 3) && (!strcmp(el, "c"))) {
-      ctx->lookup_v = 0;
-      r = mxmlElementGetAttr(node, "r");
-      if (r) {
-        //fprintf(stderr, "c r='%s'\n", r);
-        excelcolrow((char *)r, &(ctx->current_col), &(ctx->current_row));
-        for (j = ctx->expected_col; (j<ctx->current_col)&&(j<ctx->sheet_num_cols); j++)
-          putc(',', ctx->outf);
-        ctx->expected_col = ctx->current_col+1;
-      }
-      t = mxmlElementGetAttr(node, "t");
-      if (t) {
-        //fprintf(stderr, "c t='%s'\n", t);
-        if (*t == 's') {
-          ctx->lookup_v = -1;
-        }
-        //fprintf(stderr, "cols: %d  rows: %d\n", ctx->sheet_num_cols, ctx->sheet_num_rows);
-      }
+  for (i = 0; i < num_workers; i++)
+    pthread_join(workers[i].thread, NULL);
+  qsort(batch.jobs, batch.num_jobs, sizeof(BatchJob), batch_cmp);
+  for (i = 0; i < num_workers; i++) {
+    pthread_mutex_init(&batch.deques[i].mutex, NULL);
+    batch.deques[i].jobs = malloc(((batch.num_jobs / num_workers) + 1) * sizeof(int));
+    if (!batch.deques[i].jobs) {
+      fprintf(stderr, "Couldn't allocate memory for batch workers\n");
+      exit(-1);
     }
-    ctx->xml_depth++;
   }
-  else if (event == MXML_SAX_DATA) {
-    if (ctx->xml_depth == 5) {
-      el = mxmlGetElement(mxmlGetParent(node));
-      if (!strcmp(el, "v")) {
-        value = mxmlGetOpaque(mxmlGetParent(node));
-        if (ctx->lookup_v) {
-          //fprintf(stderr, "v %s\n", ctx->shrdstr_array[atoi(value)]);
-          output_csv(ctx->outf, ',', ctx->shrdstr_array[atoi(value)], (ctx->current_col < ctx->sheet_num_cols));
-        }
-        else {
-          //fprintf(stderr, "v %s\n", value);
-          output_csv(ctx->outf, ',', value, (ctx->current_col < ctx->sheet_num_cols));
-        }
-      }
+  for (i = 0; i < batch.num_jobs; i++)
+    batch.deques[i % num_workers].jobs[batch.deques[i % num_workers].tail++] = i;
+
+  for (i = 0; i < num_workers; i++) {
+    workers[i].batch = &batch;
+    workers[i].id = i;
+    if (pthread_create(&workers[i].thread, NULL, batch_worker_main, &workers[i])) {
+      fprintf(stderr, "Couldn't create batch thread\n");
+      exit(-1);
     }
   }
-  else if (event == MXML_SAX_ELEMENT_CLOSE) {
-    ctx->xml_depth--;
-    if (ctx->xml_depth == 2) {
-      el = mxmlGetElement(node);
-      if (!strcmp(el, "row")) {
-        for (j = ctx->expected_col; j<ctx->sheet_num_cols; j++)
-          putc(',', ctx->outf);
-        fprintf(ctx->outf, "\r\x0A");
-        // TODO: Check if \r\x0A portable between Windows & UNIX
-      }
-    }
+  for (i = 0; i < num_workers; i++)
+    pthread_join(workers[i].thread, NULL);
+
+  for (i = 0; i < num_workers; i++) {
+    pthread_mutex_destroy(&batch.deques[i].mutex);
+    free(batch.deques[i].jobs);
+  }
+  for (i = 0; i < batch.num_jobs; i++) {
+    free(batch.jobs[i].input);
+    free(batch.jobs[i].output);
   }
+  pthread_mutex_destroy(&batch.mutex);
+  free(batch.deques);
+  free(batch.jobs);
+  free(workers);
+  return batch.failed;
 }
-#endif /* CONFIG_MXML */
 
-#ifdef CONFIG_PARSIFAL
-int StartSharedStrings(void *data, const XMLCH *uri, const XMLCH *localName, const XMLCH *el, LPXMLVECTOR atts)
+#ifndef _WIN32
+/*
+** Server mode (-serve).
+** Workers accept connections on a Unix domain socket, one request each:
+** a line of tab separated fields
+**   input.xlsx [sheet_id [csv|jsonl [first_row [last_row]]]]
+** optionally sent along with a file descriptor (SCM_RIGHTS). Without a file
+** descriptor the reply is "OK\n", the output, and a status line once it is
+** complete: "\nOK\n", or "\nERR message\n" when the conversion failed partway
+** (the status is always the last line, after a newline of its own); or just
+** "ERR message\n" when it could not start. With a file descriptor, the output
+** is written to it and the reply "OK\n" or "ERR message\n" comes once it is
+** complete.
+** Open workbooks are kept in an LRU cache keyed by path and mtime, so that
+** further requests on the same workbook skip the zip directory and shared
+** strings. The cached XLSXCtx are also the buffer pool of the workers.
+*/
+#define SERVE_CACHE_SIZE 16
+#define SERVE_REQ_SIZE 4096
+
+typedef struct ServeEntry ServeEntry;
+struct ServeEntry {
+  XLSXCtx *xlsx;
+  char    *path;           /* Workbook open in xlsx, NULL if none */
+  time_t   mtime;
+  unsigned long used;      /* Time of last use, for LRU eviction */
+  int      busy;
+};
+
+typedef struct Serve Serve;
+struct Serve {
+  int         fd;          /* Listening socket */
+  XLSXConv   *proto;       /* Options of the conversion, copied by each worker */
+  ServeEntry *cache;
+  int         cache_num;
+  unsigned long clock;
+  pthread_mutex_t mutex;
+};
+
+/*
+** Take from the cache the entry of path, or else the least recently used
+** free entry, that the caller then reopens.
+*/
+static ServeEntry *serve_take(Serve *serve, const char *path, time_t mtime, int *hit)
 {
+  ServeEntry *e, *lru;
   int i;
-  LPXMLRUNTIMEATT att;
-  XLSXCtx *ctx = data;
-  
-  if ((ctx->xml_depth == 0) && (!strcmp(el, "sst"))) {
-    for (i = 0; i<atts->length; i++) {
-      att = (LPXMLRUNTIMEATT) XMLVector_Get(atts, i);
-      if (!strcmp(att->qname, "uniqueCount")) {
-        //fprintf(stderr, " %s='%s'\n", att->qname, att->value);
-        ctx->shrdstr_cnt = atoi(att->value);
-        ctx->shrdstr_array = malloc(sizeof(char *) * ctx->shrdstr_cnt);
-      }
+
+  pthread_mutex_lock(&serve->mutex);
+  lru = NULL;
+  *hit = 0;
+  for (i = 0; i < serve->cache_num; i++) {
+    e = &serve->cache[i];
+    if (e->busy)
+      continue;
+    if (e->path && (e->mtime == mtime) && !strcmp(e->path, path)) {
+      lru = e;
+      *hit = 1;
+      break;
     }
+    if (!lru || (e->used < lru->used))
+      lru = e;
   }
-  if ((ctx->xml_depth == 2) && (!strcmp(el, "t"))) {
-    ctx->shrdstr_tv = 1;
-    ctx->shrdstr_tv_val = ctx->shrdstr_buff;
-    *(ctx->shrdstr_tv_val) = 0;
-  }
-  ctx->xml_depth++;
-  return 0;
+  // There are more entries than workers, so one of them is always free
+  lru->busy = 1;
+  lru->used = ++serve->clock;
+  pthread_mutex_unlock(&serve->mutex);
+  return lru;
 }
 
-int EndSharedStrings(void *data, const XMLCH *uri, const XMLCH *localName, const XMLCH *el)
+static void serve_give(Serve *serve, ServeEntry *e)
 {
-  XLSXCtx *ctx = data;
+  pthread_mutex_lock(&serve->mutex);
+  e->busy = 0;
+  pthread_mutex_unlock(&serve->mutex);
+}
+
+/*
+** Read the request line of a connection, and the file descriptor sent with it.
+** Returns the number of fields, or -1 on failure.
+*/
+static int serve_read_request(int fd, char *req, char **fields, int *out_fd)
+{
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  union {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } ctl;
+  char *p, *nl;
+  ssize_t n;
+  size_t len;
+  int num;
 
-  ctx->xml_depth--;
-  if ((ctx->xml_depth == 2) && (!strcmp(el, "t"))) {
-    ctx->shrdstr_tv = 0;
-    ctx->shrdstr_array[ctx->shrdstr_num] = strdup(ctx->shrdstr_buff);
-    ctx->shrdstr_num++;
+  *out_fd = -1;
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = req;
+  iov.iov_len = SERVE_REQ_SIZE - 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctl.buf;
+  msg.msg_controllen = sizeof(ctl.buf);
+  n = recvmsg(fd, &msg, 0);
+  if (n <= 0)
+    return -1;
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS))
+      memcpy(out_fd, CMSG_DATA(cmsg), sizeof(int));
+  len = n;
+  req[len] = 0;
+  while (!(nl = strchr(req, '\n')) && (len < SERVE_REQ_SIZE - 1)) {
+    n = read(fd, req + len, SERVE_REQ_SIZE - 1 - len);
+    if (n <= 0)
+      break;
+    len += n;
+    req[len] = 0;
   }
-  return 0;
+  if (!nl)
+    return -1;
+  *nl = 0;
+  if ((nl > req) && (nl[-1] == '\r'))
+    nl[-1] = 0;
+  for (num = 0, p = req; num < 5; num++) {
+    fields[num] = p;
+    if (!(p = strchr(p, '\t'))) {
+      num++;
+      break;
+    }
+    *p++ = 0;
+  }
+  return num;
 }
 
-int ChrHndlr(void *data, const XMLCH *s, int len)
+static void serve_reply(int fd, const char *status, const char *msg)
 {
-  XMLCH *src;
-  XLSXCtx *ctx = data;
+  char line[300];
+  int n;
 
-  if (ctx->shrdstr_tv) {
-    src = (XMLCH *) s;
-    while (len) {
-      *(ctx->shrdstr_tv_val)++ = *src++;
-      len--;
-    }
-    *(ctx->shrdstr_tv_val) = 0;
+  n = snprintf(line, sizeof(line), "%s%s%s\n", status, msg ? " " : "", msg ? msg : "");
+  // A long message is cut, the line still ends with a newline
+  if (n >= (int) sizeof(line)) {
+    n = sizeof(line) - 1;
+    line[n - 1] = '\n';
   }
-  return 0;
+  if (write(fd, line, n) != n)
+    fprintf(stderr, "Couldn't write reply to client\n");
 }
 
-int StartSheet(void *data, const XMLCH *uri, const XMLCH *localName, const XMLCH *el, LPXMLVECTOR atts)
+/*
+** Handle the request of a connection. Errors are reported to the client,
+** and the worker goes on with the next connection.
+*/
+static void serve_request(Serve *serve, XLSXConv *conv, int fd)
 {
-  int i, j;
-  LPXMLRUNTIMEATT att;
-  XLSXCtx *ctx = data;
+  char req[SERVE_REQ_SIZE], *fields[5];
+  const char *err;
+  ServeEntry *e;
+  struct stat st;
+  FILE *f;
+  int num, out_fd, hit, ret;
 
-  if ((ctx->xml_depth == 1) && (!strcmp(el, "dimension"))) {
-    for (i = 0; i<atts->length; i++) {
-      att = (LPXMLRUNTIMEATT) XMLVector_Get(atts, i);
-      if (!strcmp(att->qname, "ref")) {
-        //fprintf(stderr, "dimension %s='%s'\n", att->qname, att->value);
-        rangecolrow((char *) att->value, &(ctx->sheet_num_cols), &(ctx->sheet_num_rows));
-        //fprintf(stderr, "cols: %d  rows: %d\n", ctx->sheet_num_cols, ctx->sheet_num_rows);
-      }
-    }
+  num = serve_read_request(fd, req, fields, &out_fd);
+  if (num < 1) {
+    serve_reply(fd, "ERR", "Bad request");
+    goto done;
   }
-  if ((ctx->xml_depth == 2) && (!strcmp(el, "row"))) {
-    for (i = 0; i<atts->length; i++) {
-      att = (LPXMLRUNTIMEATT) XMLVector_Get(atts, i);
-      if (!strcmp(att->qname, "r")) {
-        //fprintf(stderr, "row %s='%s'\n", att->qname, att->value);
-        ctx->expected_col = 1;
-      }
-    }
+  conv->sheet_id = ((num > 1) && atoi(fields[1])) ? atoi(fields[1]) : 1;
+  conv->format = ((num > 2) && !strcmp(fields[2], "jsonl")) ? FORMAT_JSONL : FORMAT_CSV;
+  if ((num > 2) && fields[2][0] && strcmp(fields[2], "jsonl") && strcmp(fields[2], "csv")) {
+    serve_reply(fd, "ERR", "Unknown output format");
+    goto done;
   }
-  if ((ctx->xml_depth == 3) && (!strcmp(el, "c"))) {
-    ctx->lookup_v = 0;
-    for (i = 0; i<atts->length; i++) {
-      att = (LPXMLRUNTIMEATT) XMLVector_Get(atts, i);
-      if (!strcmp(att->qname, "r")) {
-        //fprintf(stderr, "c %s='%s'\n", att->qname, att->value);
-        excelcolrow((char *) att->value, &(ctx->current_col), &(ctx->current_row));
-        for (j = ctx->expected_col; (j<ctx->current_col)&&(j<ctx->sheet_num_cols); j++)
-          putc(',', ctx->outf);
-        ctx->expected_col = ctx->current_col+1;
-      }
-      else if (!strcmp(att->qname, "t")) {
-        //fprintf(stderr, "c %s='%s'\n", att->qname, att->value);
-        if (*(att->value) == 's') {
-          ctx->lookup_v = -1;
-        }
-        //fprintf(stderr, "cols: %d  rows: %d\n", ctx->sheet_num_cols, ctx->sheet_num_rows);
-      }
-    }
+  conv->first_row = (num > 3) ? atoi(fields[3]) : 0;
+  conv->last_row = (num > 4) ? atoi(fields[4]) : 0;
+  if (stat(fields[0], &st)) {
+    serve_reply(fd, "ERR", "Could not read input file");
+    goto done;
   }
-  if ((ctx->xml_depth == 4) && (*el == 'v') && (el[1] == '\0')) {
-    ctx->shrdstr_tv = 1;
-    ctx->shrdstr_tv_val = ctx->shrdstr_buff;
-    *(ctx->shrdstr_tv_val) = 0;
+
+  e = serve_take(serve, fields[0], st.st_mtime, &hit);
+  conv->xlsx = e->xlsx;
+  ret = 0;
+  if (!hit) {
+    free(e->path);
+    e->path = NULL;
+    ret = convert_open(conv, fields[0]);
+    e->xlsx = conv->xlsx;
+    if (!ret && !(e->path = strdup(fields[0])))
+      ret = -1;
+    e->mtime = st.st_mtime;
   }
-  ctx->xml_depth++;
-  return 0;
+  if (!ret && xlsx_sheet_open(conv->xlsx, conv->sheet_id))
+    ret = -1;
+  f = NULL;
+  if (!ret)
+    f = fdopen((out_fd >= 0) ? dup(out_fd) : dup(fd), conv->gz ? "wb" : "w");
+  if (ret || !f) {
+    err = (conv->xlsx && xlsx_errmsg(conv->xlsx)[0]) ? xlsx_errmsg(conv->xlsx) : "Could not read input file";
+    serve_reply(fd, "ERR", err);
+  }
+  else {
+    if (out_fd < 0)
+      serve_reply(fd, "OK", NULL);
+    ret = convert_sheet(conv, fields[0], f, NULL);
+    if (fclose(f))
+      ret = -1;
+    // After the output, the status is on a line of its own
+    if ((out_fd < 0) && (write(fd, "\n", 1) != 1))
+      fprintf(stderr, "Couldn't write reply to client\n");
+    serve_reply(fd, ret ? "ERR" : "OK", ret ? (xlsx_errmsg(conv->xlsx)[0] ? xlsx_errmsg(conv->xlsx) : "Could not write output") : NULL);
+  }
+  serve_give(serve, e);
+
+done:
+  if (out_fd >= 0)
+    close(out_fd);
+  close(fd);
 }
 
-int EndSheet(void *data, const XMLCH *uri, const XMLCH *localName, const XMLCH *el)
+static void *serve_worker_main(void *data)
 {
-  int j;
-  XLSXCtx *ctx = data;
+  Serve *serve = data;
+  XLSXConv conv;
+  int fd;
 
-  ctx->xml_depth--;
-  if ((ctx->xml_depth == 4) && (*el == 'v') && (el[1] == '\0')) {
-    ctx->shrdstr_tv = 0;
-    if (ctx->lookup_v) {
-      //fprintf(stderr, "v %s\n", ctx->shrdstr_array[atoi(ctx->shrdstr_buff)]);
-      output_csv(ctx->outf, ',', ctx->shrdstr_array[atoi(ctx->shrdstr_buff)], (ctx->current_col < ctx->sheet_num_cols));
-    }
-    else {
-      //fprintf(stderr, "v %s\n", ctx->shrdstr_buff);
-      output_csv(ctx->outf, ',', ctx->shrdstr_buff, (ctx->current_col < ctx->sheet_num_cols));
-    }
-  }
-  if ((ctx->xml_depth == 2) && (!strcmp(el, "row"))) {
-    for (j = ctx->expected_col; j<ctx->sheet_num_cols; j++)
-      putc(',', ctx->outf);
-    fprintf(ctx->outf, "\r\x0A");
-    // TODO: Check if \r\x0A portable between Windows & UNIX
+  conv = *serve->proto;
+  for (;;) {
+    fd = accept(serve->fd, NULL, NULL);
+    if (fd < 0)
+      continue;
+    serve_request(serve, &conv, fd);
   }
-  return 0;
+  return NULL;
 }
 
-int GetSheetBytes(BYTE *buf, int cBytes, int *cBytesActual, void *data)
+/*
+** Serve conversions on the Unix domain socket at path, with num_workers
+** threads. Only returns on failure to set up the socket.
+*/
+static int serve_main(XLSXConv *proto, const char *path, int num_workers)
 {
-  XLSXCtx *ctx = data;
-  char str[64];
+  Serve serve;
+  struct sockaddr_un addr;
+  struct stat st;
+  pthread_t thread;
+  int i;
 
-  //snprintf(str, 64, "%s", ctx->sheet_cur_ptr);
-  //fprintf(stderr, "GetSheetBytes %p %d '%s'\n", ctx->sheet_cur_ptr, cBytes, str);
-  if ((ctx->sheet_end_ptr - ctx->sheet_cur_ptr) >= cBytes) {
-    memcpy(buf, ctx->sheet_cur_ptr, cBytes);
-    *cBytesActual = cBytes;
-    ctx->sheet_cur_ptr += cBytes;
-    return 0;
+  memset(&serve, 0, sizeof(serve));
+  serve.proto = proto;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path '%s' is too long\n", path);
+    return -1;
   }
-  else {
-    *cBytesActual = ctx->sheet_end_ptr - ctx->sheet_cur_ptr;
-    memcpy(buf, ctx->sheet_cur_ptr, *cBytesActual);
-    ctx->sheet_cur_ptr = ctx->sheet_end_ptr;
-    return 1;
+  strcpy(addr.sun_path, path);
+  // A socket left by an earlier server is replaced, any other file is kept
+  if (!lstat(path, &st)) {
+    if (!S_ISSOCK(st.st_mode)) {
+      fprintf(stderr, "'%s' exists and is not a socket\n", path);
+      return -1;
+    }
+    unlink(path);
+  }
+  serve.fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if ((serve.fd < 0) || bind(serve.fd, (struct sockaddr *) &addr, sizeof(addr)) || listen(serve.fd, SOMAXCONN)) {
+    fprintf(stderr, "Couldn't listen on socket '%s' .\n", path);
+    return -1;
+  }
+  // A client that goes away must not kill the server
+  signal(SIGPIPE, SIG_IGN);
+  serve.cache_num = num_workers + SERVE_CACHE_SIZE;
+  serve.cache = calloc(serve.cache_num, sizeof(ServeEntry));
+  if (!serve.cache) {
+    fprintf(stderr, "Couldn't allocate memory for workbook cache\n");
+    return -1;
   }
+  pthread_mutex_init(&serve.mutex, NULL);
+  for (i = 1; i < num_workers; i++)
+    if (pthread_create(&thread, NULL, serve_worker_main, &serve)) {
+      fprintf(stderr, "Couldn't create server thread\n");
+      return -1;
+    }
+  serve_worker_main(&serve);
+  return 0;
 }
-
-void ErrorHandler(LPXMLPARSER parser) {} /* dummy, only for switching ErrorString etc. on */
-#endif /* CONFIG_PARSIFAL */
+#endif /* Not(_WIN32) */
 
 int main(int argc, char *argv[])
 {
   int i;
-  size_t sheet_size;
-  void *sheet_ptr;
-  XLSXCtx *parse_ctx;
-  char sheetname[64];
-#ifdef CONFIG_EXPAT
-  XML_Parser p;
-#endif /* CONFIG_EXPAT */
-#ifdef CONFIG_MXML
-  mxml_node_t *root_node;
-#endif /* CONFIG_MXML */
-#ifdef CONFIG_PARSIFAL
-  LPXMLPARSER parser;
-#endif /* CONFIG_PARSIFAL */
+  XLSXConv *conv;
   
   int opt_if = 0;
   int opt_sh = 0;
   int opt_of = 0;
+  int opt_gz = 0;
+  int opt_gzj = 0;
+  int opt_format = 0;
+  int opt_dict = 0;
+  int opt_batch = 0;
+  int opt_outdir = 0;
+  int opt_j = 0;
+  int opt_serve = 0;
+  int opt_max_memory = 0;
+  int opt_trace = 0;
+  int num_workers;
+  uint64_t start;
+  FILE *outf;
+  size_t len;
+  char *unit;
 
-  parse_ctx = calloc(1, sizeof(XLSXCtx));
+  conv = calloc(1, sizeof(XLSXConv));
   for (i=1; i<argc; i++) {
     if (i==opt_if)
       continue;
@@ -801,9 +2918,148 @@ int main(int argc, char *argv[])
         fputs(usage_str, stderr);
         return 1;
       }
+    if (i==opt_gz)
+      continue;
+    if (!strcmp("-gz", argv[i]))
+      if ((i+1) < argc)
+        opt_gz = i+1;
+      else {
+        fputs("'-gz' needs a compression level\n", stderr);
+        fputs(usage_str, stderr);
+        return 1;
+      }
+    if (i==opt_gzj)
+      continue;
+    if (!strcmp("-gzj", argv[i]))
+      if ((i+1) < argc)
+        opt_gzj = i+1;
+      else {
+        fputs("'-gzj' needs a number of threads\n", stderr);
+        fputs(usage_str, stderr);
+        return 1;
+      }
+    if (i==opt_format)
+      continue;
+    if (!strcmp("-format", argv[i]))
+      if ((i+1) < argc)
+        opt_format = i+1;
+      else {
+        fputs("'-format' needs an output format, csv or jsonl\n", stderr);
+        fputs(usage_str, stderr);
+        return 1;
+      }
+    if (!strcmp("-dates", argv[i]))
+      conv->dates = 1;
+    if (!strcmp("-stats", argv[i]) || !strcmp("--stats", argv[i]))
+      conv->stats = STATS_TEXT;
+    if (!strcmp("-stats-json", argv[i]))
+      conv->stats = STATS_JSON;
+    if (!strcmp("-perf-counters", argv[i]) || !strcmp("--perf-counters", argv[i]))
+      conv->perf = 1;
+    if (!strcmp("-progress", argv[i]) || !strcmp("--progress", argv[i]))
+      conv->progress = 1;
+    if (!strcmp("-hugepages", argv[i]) || !strcmp("--hugepages", argv[i]))
+      conv->hugepages = 1;
+    if (i==opt_dict)
+      continue;
+    if (!strcmp("-dict", argv[i]))
+      if ((i+1) < argc)
+        opt_dict = i+1;
+      else {
+        fputs("'-dict' needs a CSV file name for the dictionary\n", stderr);
+        fputs(usage_str, stderr);
+        return 1;
+      }
+    if (i==opt_batch)
+      continue;
+    if (!strcmp("-batch", argv[i]))
+      if ((i+1) < argc)
+        opt_batch = i+1;
+      else {
+        fputs("'-batch' needs a file with the list of Excel files\n", stderr);
+        fputs(usage_str, stderr);
+        return 1;
+      }
+    if (i==opt_outdir)
+      continue;
+    if (!strcmp("-outdir", argv[i]))
+      if ((i+1) < argc)
+        opt_outdir = i+1;
+      else {
+        fputs("'-outdir' needs a directory for output\n", stderr);
+        fputs(usage_str, stderr);
+        return 1;
+      }
+    if (i==opt_j)
+      continue;
+    if (!strcmp("-j", argv[i]))
+      if ((i+1) < argc)
+        opt_j = i+1;
+      else {
+        fputs("'-j' needs a number of workers\n", stderr);
+        fputs(usage_str, stderr);
+        return 1;
+      }
+    if (i==opt_serve)
+      continue;
+    if (!strcmp("-serve", argv[i]))
+      if ((i+1) < argc)
+        opt_serve = i+1;
+      else {
+        fputs("'-serve' needs a path for the socket\n", stderr);
+        fputs(usage_str, stderr);
+        return 1;
+      }
+    if (i==opt_max_memory)
+      continue;
+    if (!strcmp("-max-memory", argv[i]) || !strcmp("--max-memory", argv[i]))
+      if ((i+1) < argc)
+        opt_max_memory = i+1;
+      else {
+        fputs("'-max-memory' needs a number of bytes\n", stderr);
+        fputs(usage_str, stderr);
+        return 1;
+      }
+    if (i==opt_trace)
+      continue;
+    if (!strcmp("-trace", argv[i]) || !strcmp("--trace", argv[i]))
+      if ((i+1) < argc)
+        opt_trace = i+1;
+      else {
+        fputs("'-trace' needs a JSON file name for the trace\n", stderr);
+        fputs(usage_str, stderr);
+        return 1;
+      }
   }
 
-  if (!opt_if) {
+  // Hardware counters are reported along the times of -stats
+  if (conv->perf && !conv->stats)
+    conv->stats = STATS_TEXT;
+  if (opt_serve) {
+    // Reports of -stats, and traces, are for files converted from the command line
+    conv->stats = STATS_NONE;
+    conv->perf = 0;
+    conv->progress = 0;
+    opt_trace = 0;
+    if (opt_if || opt_of || opt_dict || opt_batch) {
+      fputs("'-serve' can't be used with '-if', '-of', '-dict' or '-batch'\n", stderr);
+      fputs(usage_str, stderr);
+      return 1;
+    }
+  }
+  else if (opt_batch) {
+    if (!opt_outdir) {
+      fputs("'-batch' needs '-outdir DIR'\n", stderr);
+      fputs(usage_str, stderr);
+      return 1;
+    }
+    if (opt_if || opt_of || opt_dict) {
+      fputs("'-batch' can't be used with '-if', '-of' or '-dict'\n", stderr);
+      fputs(usage_str, stderr);
+      return 1;
+    }
+  }
+  else if (!opt_if) {
     fputs("Missing '-if input.xlsx'\n", stderr);
     fputs(usage_str, stderr);
     return 1;
@@ -818,121 +3074,107 @@ int main(int argc, char *argv[])
     if (!opt_sh)
       opt_sh = 1;
   }
-  if (!opt_of) {
-    //fputs("Missing '-of output.csv', hence assuming STDOUT.\n", stderr);
-    parse_ctx->outf = stdout; 
+  conv->sheet_id = opt_sh;
+  if (opt_format) {
+    if (!strcmp(argv[opt_format], "jsonl")) {
+      conv->format = FORMAT_JSONL;
+    }
+    else if (strcmp(argv[opt_format], "csv")) {
+      fprintf(stderr, "Unknown output format '%s'\n", argv[opt_format]);
+      fputs(usage_str, stderr);
+      return 1;
+    }
   }
-  else {
-    parse_ctx->outf = fopen(argv[opt_of], "w");
-    if (!parse_ctx->outf) {
-      fprintf(stderr, "Couldn't open output file '%s' .\n", argv[opt_of]);
-      exit(-1);
+  conv->gz_level = MZ_DEFAULT_LEVEL;
+  if (opt_gz) {
+    conv->gz = 1;
+    conv->gz_level = atoi(argv[opt_gz]);
+    if ((conv->gz_level < 1) || (conv->gz_level > 9)) {
+      fputs("'-gz' level must be between 1 and 9\n", stderr);
+      fputs(usage_str, stderr);
+      return 1;
     }
   }
-
-  // Process xl/sharedStrings.xml and load them into shrdstr_array[]
-  sheet_ptr = mz_zip_extract_archive_file_to_heap(argv[opt_if], "xl/sharedStrings.xml", &sheet_size, MZ_ZIP_FLAG_CASE_SENSITIVE);
-  //fprintf(stderr, "xl/sharedStrings.xml size:%d\n", sheet_size);
-  if (sheet_ptr) {
-    parse_ctx->xml_depth = 0;
-#ifdef CONFIG_EXPAT  
-    p = XML_ParserCreate(NULL);
-    if (!p) {
-      fprintf(stderr, "Couldn't allocate memory for parser\n");
-      exit(-1);
+  conv->gz_threads = 1;
+  if (opt_gzj) {
+    conv->gz_threads = atoi(argv[opt_gzj]);
+    if (conv->gz_threads < 1) {
+      fputs("'-gzj' needs at least 1 thread\n", stderr);
+      fputs(usage_str, stderr);
+      return 1;
     }
-    XML_SetUserData(p, parse_ctx);
-    XML_SetElementHandler(p, StartSharedStrings, EndSharedStrings);
-    XML_SetCharacterDataHandler(p, ChrHndlr);
-    if (XML_Parse(p, sheet_ptr, sheet_size, -1) == XML_STATUS_ERROR) {
-      fprintf(stderr, "Parse error at line %" XML_FMT_INT_MOD "u:\n%s\n",
-               XML_GetCurrentLineNumber(p),
-               XML_ErrorString(XML_GetErrorCode(p)));
-      exit(-1);
+  }
+  conv->dict = (opt_dict != 0);
+
+  if (opt_max_memory) {
+    conv->max_memory = (size_t) strtoull(argv[opt_max_memory], &unit, 10);
+    if (*unit == 'K' || *unit == 'k')
+      conv->max_memory <<= 10;
+    else if (*unit == 'M' || *unit == 'm')
+      conv->max_memory <<= 20;
+    else if (*unit == 'G' || *unit == 'g')
+      conv->max_memory <<= 30;
+    else if (*unit)
+      conv->max_memory = 0;
+    if (!conv->max_memory) {
+      fputs("'-max-memory' needs a number of bytes, optionally followed by K, M or G\n", stderr);
+      fputs(usage_str, stderr);
+      return 1;
     }
-    XML_ParserFree(p);
-    //for (i = 0; i < ctx->shrdstr_cnt; i++)
-    //  printf("%s\n", ctx->shrdstr_array[i]);
-#endif /* CONFIG_EXPAT */
-#ifdef CONFIG_MXML
-    root_node = mxmlSAXLoadString(NULL, sheet_ptr, MXML_OPAQUE_CALLBACK, SharedStrings, parse_ctx);
-#endif /* CONFIG_MXML */
-#ifdef CONFIG_PARSIFAL
-    if (!XMLParser_Create(&parser)) {
-      printf("Error creating parser!\n");
-      exit(-1);
+  }
+
+  num_workers = 1;
+  if (opt_j) {
+    num_workers = atoi(argv[opt_j]);
+    if (num_workers < 1) {
+      fputs("'-j' needs at least 1 worker\n", stderr);
+      fputs(usage_str, stderr);
+      return 1;
     }
-    _XMLParser_SetFlag(parser, XMLFLAG_NAMESPACES, 0);
-    _XMLParser_SetFlag(parser, XMLFLAG_EXTERNAL_GENERAL_ENTITIES, 0);
-    _XMLParser_SetFlag(parser, XMLFLAG_PRESERVE_WS_ATTRIBUTES, -1);
-    parser->errorHandler = ErrorHandler;
-    parser->startElementHandler = StartSharedStrings;
-    parser->endElementHandler = EndSharedStrings;
-    parser->charactersHandler = ChrHndlr;
-    parser->UserData = parse_ctx;
-    parse_ctx->sheet_cur_ptr = sheet_ptr;
-    parse_ctx->sheet_end_ptr = sheet_ptr + sheet_size;
-    if (!XMLParser_Parse(parser, GetSheetBytes, parse_ctx, "UTF-8"))
-      printf("ShareStrings Error: %s\nLine: %d Col: %d\n", parser->ErrorString, parser->ErrorLine, parser->ErrorColumn);
-    XMLParser_Free(parser);
-#endif /* CONFIG_PARSIFAL */
+  }
+  if (opt_trace)
+    trace_start();
+  if (opt_serve) {
+#ifndef _WIN32
+    serve_main(conv, argv[opt_serve], num_workers);
+#else
+    fputs("'-serve' is not available on Windows\n", stderr);
+#endif /* Not(_WIN32) */
+    return 1;
+  }
+  if (opt_batch) {
+    i = batch_convert(conv, argv[opt_batch], argv[opt_outdir], num_workers);
+    free(conv);
+    if (opt_trace && trace_write(argv[opt_trace]))
+      return 1;
+    return i ? 1 : 0;
+  }
+
+  if (opt_of) {
+    len = strlen(argv[opt_of]);
+    if ((len > 3) && !strcmp(argv[opt_of] + len - 3, ".gz"))
+      conv->gz = 1;
+  }
+  if (!opt_of) {
+    //fputs("Missing '-of output.csv', hence assuming STDOUT.\n", stderr);
+    outf = stdout; 
   }
   else {
-    //fprintf(stderr, "Warning: could not read xl/sharedStrings.xml\n");
-    // TODO: Only warn about missing xl/sharedStrings.xml is it referenced by some t="s"
-  }
-
-  // Process xl/worksheets/sheet1.xml and load them into sheet_tbl[,]
-  sprintf(sheetname, "xl/worksheets/sheet%d.xml", opt_sh);
-  sheet_ptr = mz_zip_extract_archive_file_to_heap(argv[opt_if], sheetname, &sheet_size, MZ_ZIP_FLAG_CASE_SENSITIVE);
-  //fprintf(stderr, "%s size:%d\n", sheetname, sheet_size);
-  if (sheet_ptr) {
-    parse_ctx->xml_depth = 0;
-#ifdef CONFIG_EXPAT  
-    parse_ctx->shrdstr_tv = 0;
-    p = XML_ParserCreate(NULL);
-    if (!p) {
-      fprintf(stderr, "Couldn't allocate memory for parser\n");
-      exit(-1);
-    }
-    XML_SetUserData(p, parse_ctx);
-    XML_SetElementHandler(p, StartSheet, EndSheet);
-    XML_SetCharacterDataHandler(p, ChrHndlr);
-    if (XML_Parse(p, sheet_ptr, sheet_size, -1) == XML_STATUS_ERROR) {
-      fprintf(stderr, "Parse error at line %" XML_FMT_INT_MOD "u:\n%s\n",
-               XML_GetCurrentLineNumber(p),
-               XML_ErrorString(XML_GetErrorCode(p)));
-      exit(-1);
-    }
-    XML_ParserFree(p);
-#endif /* CONFIG_EXPAT */
-#ifdef CONFIG_MXML
-    root_node = mxmlSAXLoadString(NULL, sheet_ptr, MXML_OPAQUE_CALLBACK, Sheet, parse_ctx);
-#endif /* CONFIG_MXML */
-#ifdef CONFIG_PARSIFAL
-    if (!XMLParser_Create(&parser)) {
-      printf("Error creating parser!\n");
+    outf = fopen(argv[opt_of], conv->gz ? "wb" : "w+");
+    if (!outf) {
+      fprintf(stderr, "Couldn't open output file '%s' .\n", argv[opt_of]);
       exit(-1);
     }
-    _XMLParser_SetFlag(parser, XMLFLAG_NAMESPACES, 0);
-    _XMLParser_SetFlag(parser, XMLFLAG_EXTERNAL_GENERAL_ENTITIES, 0);
-    _XMLParser_SetFlag(parser, XMLFLAG_PRESERVE_WS_ATTRIBUTES, -1);
-    parser->errorHandler = ErrorHandler;
-    parser->startElementHandler = StartSheet;
-    parser->endElementHandler = EndSheet;
-    parser->charactersHandler = ChrHndlr;
-    parser->UserData = parse_ctx;
-    parse_ctx->sheet_cur_ptr = sheet_ptr;
-    parse_ctx->sheet_end_ptr = sheet_ptr + sheet_size;
-    if (!XMLParser_Parse(parser, GetSheetBytes, parse_ctx, "UTF-8"))
-      printf("Sheet Error: %s\nLine: %d Col: %d\n", parser->ErrorString, parser->ErrorLine, parser->ErrorColumn);
-    XMLParser_Free(parser);
-#endif /* CONFIG_PARSIFAL */
   }
-  else {
-    fprintf(stderr, "Error: could not read sheet number %d.\n", opt_sh);
+  start = trace_clock();
+  i = convert_file(conv, argv[opt_if], outf, opt_dict ? argv[opt_dict] : NULL);
+  trace_span("convert", start, 0);
+  // The trace of a failed conversion is written too, it may tell why
+  if ((opt_trace && trace_write(argv[opt_trace])) || i)
     exit(-1);
-  }
-
+  if (outf != stdout)
+    fclose(outf);
+  xlsx_close(conv->xlsx);
+  free(conv->in_buff);
   return 0;
 }
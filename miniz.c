@@ -989,6 +989,10 @@ mz_ulong mz_adler32(mz_ulong adler, const unsigned char *ptr, size_t buf_len)
   return (s2 << 16) + s1;
 }
 
+// With MINIZ_CRC32_DISPATCH the embedder defines mz_crc32(), and calls this one as mz_crc32_portable() where it has nothing faster.
+#ifdef MINIZ_CRC32_DISPATCH
+#define mz_crc32 mz_crc32_portable
+#endif
 // Karl Malbrain's compact CRC-32. See "A compact CCITT crc16 and crc32 C implementation that balances processor cache usage against speed": http://www.geocities.com/malbrain/
 mz_ulong mz_crc32(mz_ulong crc, const mz_uint8 *ptr, size_t buf_len)
 {
@@ -999,6 +1003,9 @@ mz_ulong mz_crc32(mz_ulong crc, const mz_uint8 *ptr, size_t buf_len)
   crcu32 = ~crcu32; while (buf_len--) { mz_uint8 b = *ptr++; crcu32 = (crcu32 >> 4) ^ s_crc32[(crcu32 & 0xF) ^ (b & 0xF)]; crcu32 = (crcu32 >> 4) ^ s_crc32[(crcu32 & 0xF) ^ (b >> 4)]; }
   return ~crcu32;
 }
+#ifdef MINIZ_CRC32_DISPATCH
+#undef mz_crc32
+#endif
 
 void mz_free(void *p)
 {
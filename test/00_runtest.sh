@@ -1,5 +1,26 @@
 #!/bin/bash
 
+# Compare two CSV files through csvtotab, other files byte for byte
+same()
+{
+  case $1 in
+  *.csv)
+    ./csvtotab $1 > ${1%.csv}.tab
+    ./csvtotab $2 > ${2%.csv}.tab
+    cmp ${1%.csv}.tab ${2%.csv}.tab;;
+  *)
+    cmp $1 $2;;
+  esac
+}
+
+report()
+{
+  if [ $1 -eq 0 ]
+  then echo "Passed $2"
+  else echo "Failed $2"
+  fi
+}
+
 for i in ??_*_??.xlsx
 do
   testname=${i%??.xlsx}
@@ -15,5 +36,161 @@ do
     then echo "Passed ${testname}$sheetid"
     else echo "Failed ${testname}$sheetid"
     fi
-  done  
+    # Same workbook read from STDIN
+    ../cxlsx_to_csv -if - -sh $sheetid -of validating_${testname}${sheetid}.stdin.csv < $i
+    same expected_${testname}$sheetid.csv validating_${testname}${sheetid}.stdin.csv
+    report $? "${testname}$sheetid stdin"
+    # Same sheet inflated and parsed in pieces: a budget of one byte streams every sheet
+    ../cxlsx_to_csv -if $i -sh $sheetid -max-memory 1 -of validating_${testname}${sheetid}.maxmem.csv
+    same expected_${testname}$sheetid.csv validating_${testname}${sheetid}.maxmem.csv
+    report $? "${testname}$sheetid max-memory"
+  done
+done
+
+# Variants of a test with more options: NN_name_II.variant.args holds the
+# options of sheet II, and expected_NN_name_II.variant.csv (or .jsonl) the
+# output. Other files written by the options, named validating_NN_name_II.variant.*,
+# are compared with their expected_NN_name_II.variant.* too.
+for a in ??_*_??.*.args
+do
+  base=${a%%.*}
+  variant=${a#*.}
+  variant=${variant%.args}
+  testname=${base%??}
+  sheetid=${base: -2}
+  expected=$(ls expected_$base.$variant.csv expected_$base.$variant.jsonl 2>/dev/null)
+  ext=${expected##*.}
+  ../cxlsx_to_csv -if ${testname}??.xlsx -sh $sheetid $(cat $a) -of validating_$base.$variant.$ext
+  failed=0
+  for e in expected_$base.$variant.*
+  do
+    case $e in
+    *.tab) ;;
+    *) same $e validating_${e#expected_} || failed=1;;
+    esac
+  done
+  report $failed "$base $variant"
 done
+
+# Diagnostics of a conversion, on STDERR or in a file, leave its output unchanged
+diag()
+{
+  ../cxlsx_to_csv -if 14_celltypes_01.xlsx "$@" -of validating_diag.csv 2> validating_diag.err &&
+    same expected_14_celltypes_01.csv validating_diag.csv
+}
+
+diag -stats && grep -q "sheet_parse" validating_diag.err && grep -q "rows 2, cells" validating_diag.err
+report $? "stats"
+diag -stats-json && python3 -m json.tool validating_diag.err > /dev/null
+report $? "stats-json"
+# Without access to the hardware counters, as in most containers, the counts are left out
+diag -perf-counters && grep -q "sheet_parse" validating_diag.err
+report $? "perf-counters"
+diag -trace validating_diag.trace.json && python3 -m json.tool validating_diag.trace.json > /dev/null &&
+  grep -q '"parse sheet"' validating_diag.trace.json
+report $? "trace"
+diag -progress && grep -q "2 rows, .* done in" validating_diag.err
+report $? "progress"
+diag -hugepages -stats && grep -q "huge pages of the process" validating_diag.err
+report $? "hugepages"
+
+# gzip output, in one stream (-gz) and in blocks deflated in parallel (-gzj),
+# of a generated sheet of several output blocks, and the reading of the sheet
+# in pieces (-max-memory)
+if [ -x ../bench/xlsx_gen ]
+then
+  ../bench/xlsx_gen -o validating_big.xlsx -rows 20000 -cols 10 > /dev/null
+  ../cxlsx_to_csv -if validating_big.xlsx -of validating_big.csv
+  for gzj in 1 4
+  do
+    rm -f validating_big.csv.gz
+    ../cxlsx_to_csv -if validating_big.xlsx -gzj $gzj -of validating_big.csv.gz
+    gzip -t validating_big.csv.gz && zcat validating_big.csv.gz | cmp - validating_big.csv
+    report $? "gzip -gzj $gzj"
+  done
+  # The same sheet, deflated and stored, inflated in pieces through the ring of stream_next()
+  ../cxlsx_to_csv -if validating_big.xlsx -max-memory 100000 -of validating_big.maxmem.csv
+  cmp validating_big.csv validating_big.maxmem.csv
+  report $? "max-memory deflated sheet"
+  ../bench/xlsx_gen -o validating_stored.xlsx -rows 20000 -cols 10 -level 0 > /dev/null
+  ../cxlsx_to_csv -if validating_stored.xlsx -max-memory 100000 -of validating_stored.maxmem.csv
+  cmp validating_big.csv validating_stored.maxmem.csv
+  report $? "max-memory stored sheet"
+  # Buffers of 2 MB or more are mapped with huge pages
+  ../cxlsx_to_csv -if validating_big.xlsx -hugepages -of validating_big.huge.csv
+  cmp validating_big.csv validating_big.huge.csv
+  report $? "hugepages of a big sheet"
+fi
+
+# Batch of all the tests, and a workbook that can't be read: its conversion
+# fails, with no output left behind, and the exit status is 1. Two workbooks
+# of the same name in different directories get outputs of different names.
+rm -rf validating_batch
+mkdir -p validating_batch/a validating_batch/b
+echo "not a workbook" > validating_batch/bad.xlsx
+cp 14_celltypes_01.xlsx validating_batch/a/same.xlsx
+cp 13_inlinestr_01.xlsx validating_batch/b/same.xlsx
+(ls ??_*_??.xlsx; echo validating_batch/bad.xlsx; echo validating_batch/a/same.xlsx; echo validating_batch/b/same.xlsx) > validating_batch/list.txt
+../cxlsx_to_csv -batch validating_batch/list.txt -outdir validating_batch -j 2 2> /dev/null
+failed=$?
+[ $failed -eq 1 ] && [ ! -e validating_batch/bad.csv ]
+report $? "batch exit status"
+for i in ??_*_??.xlsx
+do
+  testname=${i%??.xlsx}
+  same expected_${testname}01.csv validating_batch/${i%.xlsx}.csv
+  report $? "${testname}01 batch"
+done
+same expected_14_celltypes_01.csv validating_batch/same.csv && same expected_13_inlinestr_01.csv validating_batch/same-2.csv
+report $? "batch same names"
+
+# Server: a request on a socket gives "OK", the output and a last "OK" line,
+# or "ERR message". The path of a file that is not a socket is left alone.
+serve()
+{
+  python3 -c '
+import socket, sys
+s = socket.socket(socket.AF_UNIX)
+s.connect(sys.argv[1])
+s.sendall(sys.argv[2].encode() + b"\n")
+sys.stdout.buffer.write(b"".join(iter(lambda: s.recv(65536), b"")))
+' validating_serve.sock "$1"
+}
+
+if which python3 > /dev/null
+then
+  rm -f validating_serve.sock
+  ../cxlsx_to_csv -serve validating_serve.sock -j 2 &
+  server=$!
+  for i in $(seq 50)
+  do
+    [ -S validating_serve.sock ] && break
+    sleep 0.1
+  done
+  serve 14_celltypes_01.xlsx > validating_serve_ok.reply
+  [ "$(head -c 3 validating_serve_ok.reply)" = "OK" ] && [ "$(tail -c 4 validating_serve_ok.reply | tr '\n' .)" = ".OK." ] &&
+    tail -c +4 validating_serve_ok.reply | head -c -4 > validating_serve_ok.csv &&
+    same expected_14_celltypes_01.csv validating_serve_ok.csv
+  report $? "serve"
+  serve "$(printf '09_severalsheets_t_06.xlsx\t7')" > validating_serve_err.reply
+  [ "$(head -c 4 validating_serve_err.reply)" = "ERR " ] && [ $(wc -l < validating_serve_err.reply) -eq 1 ]
+  report $? "serve bad sheet"
+  serve "$(printf '10_entities_02.xlsx\t1\tcsv\t2\t3')" > validating_serve_range.reply
+  sed -n 2,3p expected_10_entities_01.csv > validating_serve_range.expected.csv
+  [ "$(tail -c 4 validating_serve_range.reply | tr '\n' .)" = ".OK." ] &&
+    tail -c +4 validating_serve_range.reply | head -c -4 > validating_serve_range.csv &&
+    same validating_serve_range.expected.csv validating_serve_range.csv
+  report $? "serve row range"
+  kill $server
+  wait $server 2> /dev/null
+  cp 14_celltypes_01.xlsx validating_serve_notsock.xlsx
+  timeout 5 ../cxlsx_to_csv -serve validating_serve_notsock.xlsx 2> /dev/null
+  [ $? -ne 124 ] && cmp -s 14_celltypes_01.xlsx validating_serve_notsock.xlsx
+  report $? "serve on a file"
+fi
+
+# API of the library, for what the converter does not use of it
+if [ -x ./test_cxlsx ]
+then
+  ./test_cxlsx
+fi
@@ -0,0 +1,363 @@
+/*****************************************************************
+ NAME:
+   test_cxlsx - tests of the API of the cxlsx library, and of its Arrow export
+
+ USAGE:
+   test_cxlsx
+
+   Run from the test directory, on its workbooks. Prints a "Passed" or
+   "Failed" line for each test, as 00_runtest.sh does, and exits with 1
+   when a test failed.
+
+ COMPILATION:
+   cc -DCONFIG_EXPAT -o test_cxlsx test_cxlsx.c ../cxlsx.c -l expat
+
+** Copyright (C) 2015 Victor Paesa
+**
+** This program is free software; you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation; either version 2 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+
+*****************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "../cxlsx.h"
+
+static int failures;
+
+static void report(int passed, const char *name)
+{
+  printf("%s %s\n", passed ? "Passed" : "Failed", name);
+  if (!passed)
+    failures++;
+}
+
+/*
+** Text of the rows of a sheet, one line per cell, to compare how they are read
+*/
+typedef struct Dump Dump;
+struct Dump {
+  char  *ptr;
+  size_t len, cap;
+};
+
+static void dump_add(Dump *d, const char *s, size_t len)
+{
+  if (d->len + len + 1 > d->cap) {
+    while (d->len + len + 1 > d->cap)
+      d->cap = d->cap ? 2 * d->cap : 4096;
+    d->ptr = realloc(d->ptr, d->cap);
+    if (!d->ptr) {
+      fputs("Couldn't allocate memory for rows\n", stderr);
+      exit(-1);
+    }
+  }
+  memcpy(d->ptr + d->len, s, len);
+  d->len += len;
+  d->ptr[d->len] = 0;
+}
+
+static void dump_row(void *data, const XLSXRow *row)
+{
+  Dump *d = data;
+  char head[64];
+  int i;
+
+  for (i = 0; i < row->num_cells; i++) {
+    snprintf(head, sizeof(head), "%d:%d:%d:%d:", row->row, row->cells[i].col, row->cells[i].type, row->cells[i].index);
+    dump_add(d, head, strlen(head));
+    dump_add(d, row->cells[i].ptr, row->cells[i].len);
+    dump_add(d, "\n", 1);
+  }
+}
+
+/*
+** Read sheet_id with xlsx_next_row() (pull) or xlsx_sheet_rows() (push).
+** Returns 0 on success, -1 on failure.
+*/
+static int dump_sheet(XLSXCtx *ctx, int sheet_id, int push, Dump *d)
+{
+  const XLSXRow *row;
+
+  d->len = 0;
+  dump_add(d, "", 0);
+  if (xlsx_sheet_open(ctx, sheet_id))
+    return -1;
+  if (push)
+    return xlsx_sheet_rows(ctx, dump_row, d);
+  while ((row = xlsx_next_row(ctx)))
+    dump_row(d, row);
+  return xlsx_errmsg(ctx)[0] ? -1 : 0;
+}
+
+static char *read_file(const char *filename, size_t *size)
+{
+  FILE *f;
+  char *buf;
+  long n;
+
+  if (!(f = fopen(filename, "rb")))
+    return NULL;
+  fseek(f, 0, SEEK_END);
+  n = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  buf = malloc(n ? n : 1);
+  if (buf && (fread(buf, 1, n, f) != (size_t) n)) {
+    free(buf);
+    buf = NULL;
+  }
+  fclose(f);
+  *size = n;
+  return buf;
+}
+
+/*
+** Every sheet read by pulling its rows and by pushing them gives the same rows
+*/
+static void test_pull_push(const char *filename, int sheets)
+{
+  XLSXCtx *ctx;
+  Dump pull = { 0 }, push = { 0 };
+  char name[256];
+  int i, passed;
+
+  ctx = xlsx_open(filename, XLSX_DATES);
+  passed = ctx != NULL;
+  for (i = 1; passed && (i <= sheets); i++)
+    passed = !dump_sheet(ctx, i, 0, &pull) && !dump_sheet(ctx, i, 1, &push) &&
+             pull.len && (pull.len == push.len) && !memcmp(pull.ptr, push.ptr, pull.len);
+  xlsx_close(ctx);
+  snprintf(name, sizeof(name), "api pull push %s", filename);
+  report(passed, name);
+  free(pull.ptr);
+  free(push.ptr);
+}
+
+/*
+** A context reopened on another workbook, from a file or from memory, reads
+** it as a context opened on it alone
+*/
+static void test_reopen(const char *first, const char *second)
+{
+  XLSXCtx *ctx, *alone;
+  Dump d = { 0 }, expected = { 0 }, expected_first = { 0 };
+  char *buf;
+  size_t size;
+  int passed;
+
+  alone = xlsx_open(second, 0);
+  passed = alone && !dump_sheet(alone, 1, 0, &expected);
+  xlsx_close(alone);
+  ctx = xlsx_open(first, 0);
+  passed = passed && ctx && !dump_sheet(ctx, 1, 0, &expected_first) &&
+           !xlsx_reopen(ctx, second, 0) && !dump_sheet(ctx, 1, 0, &d) &&
+           (d.len == expected.len) && !memcmp(d.ptr, expected.ptr, d.len);
+  report(passed, "api xlsx_reopen");
+
+  // A workbook that can't be read leaves ctx empty, to be reopened again
+  passed = ctx && (xlsx_reopen(ctx, "00_runtest.sh", 0) == -1) && xlsx_errmsg(ctx)[0] &&
+           !xlsx_reopen(ctx, first, 0) && !dump_sheet(ctx, 1, 1, &d) &&
+           (d.len == expected_first.len) && !memcmp(d.ptr, expected_first.ptr, d.len);
+  report(passed, "api xlsx_reopen after failure");
+  xlsx_close(ctx);
+
+  buf = read_file(second, &size);
+  ctx = buf ? xlsx_open_mem(buf, size, 0) : NULL;
+  passed = ctx && !dump_sheet(ctx, 1, 0, &d) &&
+           (d.len == expected.len) && !memcmp(d.ptr, expected.ptr, d.len);
+  report(passed, "api xlsx_open_mem");
+  xlsx_close(ctx);
+  free(buf);
+
+  buf = read_file(first, &size);
+  ctx = xlsx_open(second, 0);
+  passed = buf && ctx && !xlsx_reopen_mem(ctx, buf, size, 0) && !dump_sheet(ctx, 1, 1, &d) &&
+           (d.len == expected_first.len) && !memcmp(d.ptr, expected_first.ptr, d.len);
+  report(passed, "api xlsx_reopen_mem");
+  xlsx_close(ctx);
+  free(buf);
+  free(d.ptr);
+  free(expected.ptr);
+  free(expected_first.ptr);
+}
+
+/*
+** Value of row i of an Arrow utf8 or dictionary column, NULL when null
+*/
+static const char *arrow_value(const struct ArrowArray *col, int i, int *len)
+{
+  const uint8_t *valid = col->buffers[0];
+  const int32_t *offs;
+
+  if (!(valid[i >> 3] & (1 << (i & 7))))
+    return NULL;
+  if (col->dictionary) {
+    i = ((const int32_t *) col->buffers[1])[i];
+    col = col->dictionary;
+  }
+  offs = col->buffers[1];
+  *len = offs[i + 1] - offs[i];
+  return (const char *) col->buffers[2] + offs[i];
+}
+
+static int arrow_is(const struct ArrowArray *col, int i, const char *text)
+{
+  const char *value;
+  int len;
+
+  value = arrow_value(col, i, &len);
+  return value && (len == (int) strlen(text)) && !memcmp(value, text, len);
+}
+
+/*
+** Types of the columns, values and nulls of a batch without a header row,
+** dictionary, float64 and utf8 columns
+*/
+static void test_arrow_types(void)
+{
+  struct ArrowArray a;
+  struct ArrowSchema s;
+  XLSXCtx *ctx;
+  const double *dbls;
+  int passed;
+
+  ctx = xlsx_open("14_celltypes_01.xlsx", 0);
+  passed = ctx && !xlsx_sheet_open(ctx, 1) && (xlsx_arrow_batch(ctx, 100, 0, &a, &s) == 2);
+  if (passed) {
+    dbls = a.children[0]->buffers[1];
+    passed = (s.n_children == 6) && (a.n_children == 6) && (a.length == 2) &&
+             !strcmp(s.children[0]->name, "A") && !strcmp(s.children[5]->name, "F") &&
+             !strcmp(s.children[0]->format, "g") && (dbls[0] == 3.5) && (dbls[1] == -1.25E-3) &&
+             !strcmp(s.children[1]->format, "i") && s.children[1]->dictionary &&
+             arrow_is(a.children[1], 0, "hello, world") && arrow_is(a.children[1], 1, "plain") &&
+             !strcmp(s.children[2]->format, "u") && arrow_is(a.children[2], 0, "a,b") && arrow_is(a.children[2], 1, "1") &&
+             arrow_is(a.children[5], 0, "inline") && arrow_is(a.children[5], 1, "hello, world") &&
+             !a.children[0]->null_count && !a.children[5]->null_count;
+    a.release(&a);
+    s.release(&s);
+    passed = passed && !xlsx_arrow_batch(ctx, 100, 0, &a, &s) && !a.release && !s.release;
+  }
+  report(passed, "arrow types");
+  xlsx_close(ctx);
+}
+
+/*
+** Batches with a header row: the names of the columns, and a schema that
+** outlives the workbook
+*/
+static void test_arrow_header(void)
+{
+  struct ArrowArray a;
+  struct ArrowSchema s, first;
+  XLSXCtx *ctx;
+  int n, rows, batches, passed;
+
+  ctx = xlsx_open("10_entities_02.xlsx", 0);
+  passed = ctx && !xlsx_sheet_open(ctx, 1) && (xlsx_arrow_batch(ctx, 2, XLSX_ARROW_HEADER, &a, &first) == 2);
+  if (passed) {
+    passed = (first.n_children == 5) && !strcmp(first.children[0]->name, "Name") &&
+             !strcmp(first.children[4]->name, "Description") && !strcmp(first.children[0]->format, "i") &&
+             arrow_is(a.children[0], 0, "quot") && arrow_is(a.children[0], 1, "amp");
+    a.release(&a);
+    for (rows = 2, batches = 1; (n = xlsx_arrow_batch(ctx, 2, XLSX_ARROW_HEADER, &a, &s)) > 0; rows += n, batches++) {
+      a.release(&a);
+      s.release(&s);
+    }
+    passed = passed && !n && (rows == 5) && (batches == 3) &&
+             !xlsx_reopen(ctx, "14_celltypes_01.xlsx", 0) && !xlsx_sheet_open(ctx, 1) &&
+             !strcmp(first.children[2]->name, "Unicode code point (decimal)");
+    first.release(&first);
+  }
+  report(passed, "arrow header");
+  xlsx_close(ctx);
+}
+
+/*
+** Rows wider than the header row: the first batch has as many columns as
+** its widest row, a later row wider than them is an error
+*/
+static void test_arrow_wider(void)
+{
+  struct ArrowArray a;
+  struct ArrowSchema s;
+  XLSXCtx *ctx;
+  int n, passed;
+
+  ctx = xlsx_open("15_nodimension_01.xlsx", 0);
+  passed = ctx && !xlsx_sheet_open(ctx, 1) && (xlsx_arrow_batch(ctx, 2, XLSX_ARROW_HEADER, &a, &s) == 2);
+  if (passed) {
+    passed = (s.n_children == 3) && !strcmp(s.children[0]->name, "a") && !strcmp(s.children[1]->name, "1") &&
+             !strcmp(s.children[2]->name, "C") && arrow_is(a.children[2], 1, "x, y") && (a.children[1]->null_count == 2);
+    a.release(&a);
+    s.release(&s);
+    while ((n = xlsx_arrow_batch(ctx, 2, XLSX_ARROW_HEADER, &a, NULL)) > 0)
+      a.release(&a);
+    passed = passed && (n == -1) && strstr(xlsx_errmsg(ctx), "beyond the 3 columns");
+  }
+  passed = passed && !xlsx_sheet_open(ctx, 1) && (xlsx_arrow_batch(ctx, 2000, XLSX_ARROW_HEADER, &a, &s) == 1099);
+  if (passed) {
+    passed = (s.n_children == 5) && !strcmp(s.children[4]->name, "E") && arrow_is(a.children[4], 1098, "wide");
+    a.release(&a);
+    s.release(&s);
+  }
+  report(passed, "arrow wider rows");
+  xlsx_close(ctx);
+}
+
+/*
+** The rows missing from the sheet are null rows, across batches, and a
+** cell that does not fit the type of its column is an error
+*/
+static void test_arrow_gaps(void)
+{
+  struct ArrowArray a;
+  struct ArrowSchema s;
+  XLSXCtx *ctx;
+  int n, rows, passed;
+
+  ctx = xlsx_open("16_rowgaps_01.xlsx", 0);
+  passed = ctx && !xlsx_sheet_open(ctx, 1) && (xlsx_arrow_batch(ctx, 1000, 0, &a, &s) == 1000);
+  if (passed) {
+    passed = (s.n_children == 3) && !strcmp(s.children[2]->format, "g") &&
+             (a.children[0]->null_count == 1000) && (a.children[1]->null_count == 999) && (a.children[2]->null_count == 999) &&
+             arrow_is(a.children[1], 1, "first") && (((const double *) a.children[2]->buffers[1])[2] == 3) &&
+             !arrow_is(a.children[1], 2, "");
+    a.release(&a);
+    s.release(&s);
+    for (rows = 1000; (n = xlsx_arrow_batch(ctx, 1000, 0, &a, NULL)) > 0; rows += n) {
+      passed = passed && (a.children[2]->null_count == n);
+      a.release(&a);
+    }
+    // Row 5000 has text in the float64 column C
+    passed = passed && (n == -1) && (rows == 4000) && strstr(xlsx_errmsg(ctx), "Column C");
+  }
+  report(passed, "arrow null rows and type mismatch");
+  xlsx_close(ctx);
+}
+
+int main(void)
+{
+  test_pull_push("09_severalsheets_t_06.xlsx", 6);
+  test_pull_push("10_entities_02.xlsx", 2);
+  test_pull_push("14_celltypes_01.xlsx", 1);
+  test_pull_push("16_rowgaps_01.xlsx", 1);
+  test_pull_push("17_dates1900_01.xlsx", 1);
+  test_reopen("14_celltypes_01.xlsx", "10_entities_02.xlsx");
+  test_arrow_types();
+  test_arrow_header();
+  test_arrow_wider();
+  test_arrow_gaps();
+  return failures ? 1 : 0;
+}